@@ -188,14 +188,16 @@ static int on_event(struct rdma_cm_event *event) {
             s_conn->mr = ibv_reg_mr(s_ctx->pd, s_conn->buffer, MESSAGE_SIZE, access);
             if (!s_conn->mr) die("ibv_reg_mr failed");
             
+            // 使用设备支持的最大 outstanding READ/atomic 深度，而不是固定的 16
             struct rdma_conn_param p = {0};
-            p.initiator_depth = 16;
-            p.responder_resources = 16;
+            rd_atomic_limits(event->id->verbs, 0, &p.initiator_depth,
+                             &p.responder_resources);
 
             if (rdma_connect(event->id, &p)) die("rdma_connect failed");
             break;
         case RDMA_CM_EVENT_ESTABLISHED:
             printf("RDMA_CM_EVENT_ESTABLISHED! Connection successful.\n");
+            report_rd_atomic(event->id->qp, "client");
             
             if (event->param.conn.private_data && 
                 event->param.conn.private_data_len >= sizeof(s_remote_mr_info)) {
@@ -47,7 +47,8 @@ static void build_qp(struct rdma_cm_id *id) {
     if (rdma_create_qp(id, s_ctx->pd, &qp_attr)) die("rdma_create_qp failed");
 }
 
-static int on_connection_request(struct rdma_cm_id *id) {
+// cm_params 已由 rb_expect_request() 填好协商后的 READ 深度
+static int on_connection_request(struct rdma_cm_id *id, struct rdma_conn_param *cm_params) {
     printf("Client connected! Accepting connection (Type: %s)...\n", 
            RDMA_Q_TYPE == IBV_QPT_RC ? "RC" : "UC");
 
@@ -74,14 +75,10 @@ static int on_connection_request(struct rdma_cm_id *id) {
         .len = MESSAGE_SIZE 
     };
     
-    struct rdma_conn_param cm_params = {0};
-    cm_params.private_data = &mr_info;
-    cm_params.private_data_len = sizeof(mr_info);
-    
-    cm_params.responder_resources = 16;
-    cm_params.initiator_depth = 16;
+    cm_params->private_data = &mr_info;
+    cm_params->private_data_len = sizeof(mr_info);
     
-    if (rdma_accept(id, &cm_params)) die("rdma_accept failed");
+    if (rdma_accept(id, cm_params)) die("rdma_accept failed");
     return 0;
 }
 
@@ -102,11 +99,9 @@ static void on_disconnect(struct rdma_cm_id *id) {
 static int on_event(struct rdma_cm_event *event) {
     int ret = 0;
     switch (event->event) {
-        case RDMA_CM_EVENT_CONNECT_REQUEST:
-            on_connection_request(event->id);
-            break;
         case RDMA_CM_EVENT_ESTABLISHED:
             printf("Connection established. Waiting for client RDMA operation...\n");
+            report_rd_atomic(event->id->qp, "server");
             break; 
         case RDMA_CM_EVENT_DISCONNECTED:
             on_disconnect(event->id);
@@ -136,6 +131,10 @@ int main(int argc, char **argv) {
            DEFAULT_PORT, RDMA_Q_TYPE == IBV_QPT_RC ? "RC" : "UC");
     printf("RDMA Server listening...\n");
 
+    // 与客户端协商：不超过设备上限，也不超过对端请求的深度
+    struct rdma_conn_param cm_params = {0};
+    on_connection_request(rb_expect_request(ec, 0, &cm_params), &cm_params);
+
     struct rdma_cm_event *event = NULL;
     while (rdma_get_cm_event(ec, &event) == 0) {
         struct rdma_cm_event event_copy = *event;
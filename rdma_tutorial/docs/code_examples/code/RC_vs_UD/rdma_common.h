@@ -0,0 +1,41 @@
+// rdma_common.h: what RC_client.c and RC_server.c share. die() and the rest
+// of the connection helpers come from librdmabench.
+//
+// gcc -O3 RC_client.c ../librdmabench/*.c -o RC_client -lrdmacm -libverbs -lm
+#ifndef RDMA_COMMON_H
+#define RDMA_COMMON_H
+
+#include "../librdmabench/rdma_bench.h"
+
+// Both sides must agree on these; override them with -D on both builds.
+#ifndef MESSAGE_SIZE
+#define MESSAGE_SIZE 4096
+#endif
+#ifndef NUM_TRANSFERS
+#define NUM_TRANSFERS 1000000
+#endif
+#ifndef DEFAULT_PORT
+#define DEFAULT_PORT "18515"
+#endif
+
+// Device-wide resources, built on the first connection.
+struct context {
+  struct ibv_context *ctx;
+  struct ibv_pd *pd;
+  struct ibv_cq *cq;
+};
+
+struct connection {
+  struct rdma_cm_id *id;
+  struct ibv_qp *qp;
+  struct ibv_mr *mr;
+  char *buffer;
+};
+
+// Sent by the server as connect private data: its registered buffer.
+struct remote_mr_info {
+  uint64_t addr;
+  uint32_t rkey, len;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,194 @@
+// transport.h: QP setup shared by transport_client.cpp and
+// transport_server.cpp. The transport is picked at run time, so the QPs are
+// created with plain verbs and brought up from addresses exchanged over TCP
+// (rdma_cm has no UC port space). die() and open_device() come from the
+// verbs-only part of librdmabench.
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "../librdmabench/rdma_verbs.h"
+#include <arpa/inet.h>
+#include <infiniband/verbs.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define XPORT_QKEY 0x11111111
+#define XPORT_GRH 40 // UD receives start with room for the GRH
+
+enum Transport { XPORT_RC, XPORT_UC, XPORT_UD };
+enum Op { OP_SEND, OP_WRITE, OP_WRITE_IMM, OP_READ };
+
+// Which opcodes each transport can carry: UC has no READ, UD only SEND.
+static constexpr bool xport_supports(Transport t, Op op) {
+  return t == XPORT_RC || (t == XPORT_UC && op != OP_READ) ||
+         (t == XPORT_UD && op == OP_SEND);
+}
+
+// Client -> server: what to set up. Sent ahead of the client's QpInfo.
+struct Hello {
+  uint8_t transport, op;
+  uint32_t msg;
+} __attribute__((packed));
+
+// Everything the peer needs to address this QP and its buffer.
+struct QpInfo {
+  uint32_t qpn, psn, mtu;
+  uint16_t lid;
+  uint8_t gid[16];
+  uint64_t addr;
+  uint32_t rkey, len;
+  uint8_t rd_atom; // READs this side accepts in flight as the responder
+} __attribute__((packed));
+
+static inline const char *xport_str(Transport t) {
+  return t == XPORT_RC ? "rc" : (t == XPORT_UC ? "uc" : "ud");
+}
+
+static inline const char *op_str(Op op) {
+  static const char *const s[] = {"send", "write", "write_imm", "read"};
+  return s[op];
+}
+
+static inline void xfer_all(int fd, void *p, size_t n, int write_side) {
+  char *b = (char *)p;
+  while (n) {
+    ssize_t r = write_side ? write(fd, b, n) : read(fd, b, n);
+    if (r <= 0)
+      die(write_side ? "tcp write" : "tcp read");
+    b += r;
+    n -= (size_t)r;
+  }
+}
+
+// Create a QP of transport `t`. Returns the inline size actually granted in
+// *max_inline when asked for `want_inline` bytes.
+static inline struct ibv_qp *
+xport_create_qp(struct ibv_pd *pd, struct ibv_cq *scq, struct ibv_cq *rcq,
+                Transport t, uint32_t max_send, uint32_t max_recv,
+                uint32_t want_inline, uint32_t *max_inline) {
+  struct ibv_qp_init_attr qa = {};
+  qa.send_cq = scq;
+  qa.recv_cq = rcq;
+  qa.qp_type = t == XPORT_RC ? IBV_QPT_RC
+                             : (t == XPORT_UC ? IBV_QPT_UC : IBV_QPT_UD);
+  qa.cap.max_send_wr = max_send;
+  qa.cap.max_recv_wr = max_recv;
+  qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
+  qa.cap.max_inline_data = want_inline;
+  struct ibv_qp *qp = ibv_create_qp(pd, &qa);
+  if (!qp)
+    die("create_qp");
+  if (max_inline)
+    *max_inline = qa.cap.max_inline_data;
+  return qp;
+}
+
+static inline void xport_local_info(struct ibv_context *ctx, uint8_t port,
+                                    int gid_index, struct ibv_qp *qp,
+                                    struct QpInfo *me) {
+  struct ibv_port_attr pa;
+  if (ibv_query_port(ctx, port, &pa))
+    die("query_port");
+  union ibv_gid gid = {};
+  if (gid_index >= 0 && ibv_query_gid(ctx, port, gid_index, &gid))
+    die("query_gid");
+  me->qpn = qp->qp_num;
+  me->psn = (uint32_t)lrand48() & 0xffffff;
+  me->mtu = 128u << pa.active_mtu;
+  me->lid = pa.lid;
+  struct ibv_device_attr da;
+  if (ibv_query_device(ctx, &da))
+    die("query_device");
+  me->rd_atom = (uint8_t)(da.max_qp_rd_atom < 255 ? da.max_qp_rd_atom : 255);
+  memcpy(me->gid, gid.raw, sizeof(me->gid));
+}
+
+static inline struct ibv_ah_attr xport_ah_attr(uint8_t port, int gid_index,
+                                               const struct QpInfo *peer) {
+  struct ibv_ah_attr aa = {};
+  aa.dlid = peer->lid;
+  aa.port_num = port;
+  if (gid_index >= 0) {
+    aa.is_global = 1;
+    memcpy(aa.grh.dgid.raw, peer->gid, sizeof(peer->gid));
+    aa.grh.sgid_index = (uint8_t)gid_index;
+    aa.grh.hop_limit = 64;
+  }
+  return aa;
+}
+
+static inline enum ibv_mtu xport_ibv_mtu(uint32_t mtu) {
+  enum ibv_mtu m = IBV_MTU_256;
+  while (m < IBV_MTU_4096 && (256u << (m - IBV_MTU_256 + 1)) <= mtu)
+    m = (enum ibv_mtu)(m + 1);
+  return m;
+}
+
+// Bring `qp` to RTS against `peer`. RC and UC go through RTR with the
+// peer's QPN, PSN and path; UD only needs the Q_Key, and each send names
+// its destination through an address handle instead.
+static inline void xport_connect(struct ibv_qp *qp, Transport t, uint8_t port,
+                                 int gid_index, const struct QpInfo *me,
+                                 const struct QpInfo *peer) {
+  struct ibv_qp_attr a = {};
+  a.qp_state = IBV_QPS_INIT;
+  a.pkey_index = 0;
+  a.port_num = port;
+  int mask = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT;
+  if (t == XPORT_UD) {
+    a.qkey = XPORT_QKEY;
+    mask |= IBV_QP_QKEY;
+  } else {
+    a.qp_access_flags = IBV_ACCESS_REMOTE_WRITE |
+                        (t == XPORT_RC ? IBV_ACCESS_REMOTE_READ : 0);
+    mask |= IBV_QP_ACCESS_FLAGS;
+  }
+  if (ibv_modify_qp(qp, &a, mask))
+    die("modify_qp INIT");
+
+  memset(&a, 0, sizeof(a));
+  a.qp_state = IBV_QPS_RTR;
+  mask = IBV_QP_STATE;
+  if (t != XPORT_UD) {
+    a.path_mtu = xport_ibv_mtu(me->mtu < peer->mtu ? me->mtu : peer->mtu);
+    a.dest_qp_num = peer->qpn;
+    a.rq_psn = peer->psn;
+    a.ah_attr = xport_ah_attr(port, gid_index, peer);
+    mask |= IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN;
+    if (t == XPORT_RC) {
+      a.max_dest_rd_atomic = me->rd_atom;
+      a.min_rnr_timer = 12;
+      mask |= IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER;
+    }
+  }
+  if (ibv_modify_qp(qp, &a, mask))
+    die("modify_qp RTR");
+
+  memset(&a, 0, sizeof(a));
+  a.qp_state = IBV_QPS_RTS;
+  a.sq_psn = me->psn;
+  mask = IBV_QP_STATE | IBV_QP_SQ_PSN;
+  if (t == XPORT_RC) {
+    a.timeout = 14;
+    a.retry_cnt = 7;
+    a.rnr_retry = 7;
+    // Never more READs in flight than the peer accepts, or than we can
+    // initiate.
+    struct ibv_device_attr da;
+    if (ibv_query_device(qp->context, &da))
+      die("query_device");
+    a.max_rd_atomic = peer->rd_atom;
+    if (a.max_rd_atomic > da.max_qp_init_rd_atom)
+      a.max_rd_atomic = (uint8_t)da.max_qp_init_rd_atom;
+    mask |= IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
+            IBV_QP_MAX_QP_RD_ATOMIC;
+  }
+  if (ibv_modify_qp(qp, &a, mask))
+    die("modify_qp RTS");
+}
+
+#endif
@@ -0,0 +1,341 @@
+// g++ -O2 -std=c++17 transport_client.cpp ../librdmabench/verbs.c -o transport_client -libverbs
+#include "transport.h"
+#include <time.h>
+
+// Everything a run needs, set up before the hot loop starts.
+struct Bench {
+  struct ibv_qp *qp;
+  struct ibv_cq *cq;
+  struct ibv_ah *ah; // UD only
+  struct QpInfo peer;
+  char *buf;
+  uint32_t lkey;
+  size_t msg;
+  uint64_t iters, window, signal_every;
+};
+
+typedef uint64_t (*LoopFn)(Bench &b);
+
+// The closed-loop post/poll engine, specialized per transport, opcode,
+// signaling policy and inline use. One WR per window slot is filled in
+// before the clock starts, so the loop only sets wr_id, the signal bit and
+// (for write_imm) the immediate. Everything that depends on the flags is
+// resolved at compile time. With `Selective`, only every
+// b.signal_every-th WR and the last one are signaled. Completions are in
+// order on one send queue, so a completion for wr_id i retires every op up
+// to i. Returns the elapsed nanoseconds.
+template <Transport T, Op O, bool Selective, bool Inline>
+static uint64_t run_loop(Bench &b) {
+  static_assert(xport_supports(T, O), "opcode not valid on this transport");
+  constexpr enum ibv_wr_opcode opcode =
+      O == OP_SEND    ? IBV_WR_SEND
+      : O == OP_WRITE ? IBV_WR_RDMA_WRITE
+      : O == OP_READ  ? IBV_WR_RDMA_READ
+                      : IBV_WR_RDMA_WRITE_WITH_IMM;
+  constexpr unsigned base_flags = Inline ? IBV_SEND_INLINE : 0;
+
+  struct ibv_send_wr *wr =
+      (struct ibv_send_wr *)calloc(b.window, sizeof(*wr));
+  struct ibv_sge *sge = (struct ibv_sge *)calloc(b.window, sizeof(*sge));
+  if (!wr || !sge)
+    die("calloc");
+  for (uint64_t i = 0; i < b.window; ++i) {
+    sge[i].addr = (uintptr_t)(b.buf + i * b.msg);
+    sge[i].length = (uint32_t)b.msg;
+    sge[i].lkey = b.lkey;
+    wr[i].sg_list = &sge[i];
+    wr[i].num_sge = 1;
+    wr[i].opcode = opcode;
+    if constexpr (T == XPORT_UD) {
+      wr[i].wr.ud.ah = b.ah;
+      wr[i].wr.ud.remote_qpn = b.peer.qpn;
+      wr[i].wr.ud.remote_qkey = XPORT_QKEY;
+    } else if constexpr (O != OP_SEND) {
+      wr[i].wr.rdma.remote_addr = b.peer.addr;
+      wr[i].wr.rdma.rkey = b.peer.rkey;
+    }
+  }
+
+  const uint64_t iters = b.iters, window = b.window;
+  const uint64_t every = Selective ? b.signal_every : 1;
+  uint64_t posted = 0, done = 0;
+  struct ibv_wc wc[32];
+  struct timespec ts0, ts1;
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  while (done < iters) {
+    while (posted - done < window && posted < iters) {
+      struct ibv_send_wr *w = &wr[posted % window], *bad;
+      w->wr_id = posted;
+      if constexpr (Selective)
+        w->send_flags = base_flags |
+                        ((posted + 1) % every == 0 || posted + 1 == iters
+                             ? IBV_SEND_SIGNALED
+                             : 0);
+      else
+        w->send_flags = base_flags | IBV_SEND_SIGNALED;
+      if constexpr (O == OP_WRITE_IMM)
+        w->imm_data = htonl((uint32_t)posted);
+      if (ibv_post_send(b.qp, w, &bad))
+        die("post_send");
+      posted++;
+    }
+    int n = ibv_poll_cq(b.cq, 32, wc);
+    if (n < 0)
+      die("poll_cq");
+    for (int i = 0; i < n; ++i) {
+      if (wc[i].status != IBV_WC_SUCCESS) {
+        printf("RDMA error: wr_id=%lu status=%d(%s) vendor_err=0x%x\n",
+               wc[i].wr_id, wc[i].status, ibv_wc_status_str(wc[i].status),
+               wc[i].vendor_err);
+        die("wc");
+      }
+      done = wc[i].wr_id + 1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  free(wr);
+  free(sge);
+  return (uint64_t)(ts1.tv_sec - ts0.tv_sec) * 1000000000ull +
+         (ts1.tv_nsec - ts0.tv_nsec);
+}
+
+// Runtime flags -> specialized loop, resolved once before the run. Returns
+// NULL for combinations the transport cannot carry, without instantiating
+// them.
+template <Transport T, Op O, bool Selective>
+static LoopFn pick_inline(bool inl) {
+  if constexpr (!xport_supports(T, O))
+    return NULL;
+  else if constexpr (O == OP_READ)
+    return inl ? NULL : run_loop<T, O, Selective, false>;
+  else
+    return inl ? run_loop<T, O, Selective, true>
+               : run_loop<T, O, Selective, false>;
+}
+
+template <Transport T, Op O>
+static LoopFn pick_signal(bool selective, bool inl) {
+  return selective ? pick_inline<T, O, true>(inl)
+                   : pick_inline<T, O, false>(inl);
+}
+
+template <Transport T>
+static LoopFn pick_op(Op op, bool selective, bool inl) {
+  switch (op) {
+  case OP_SEND:
+    return pick_signal<T, OP_SEND>(selective, inl);
+  case OP_WRITE:
+    return pick_signal<T, OP_WRITE>(selective, inl);
+  case OP_WRITE_IMM:
+    return pick_signal<T, OP_WRITE_IMM>(selective, inl);
+  default:
+    return pick_signal<T, OP_READ>(selective, inl);
+  }
+}
+
+static LoopFn pick_loop(Transport t, Op op, bool selective, bool inl) {
+  switch (t) {
+  case XPORT_RC:
+    return pick_op<XPORT_RC>(op, selective, inl);
+  case XPORT_UC:
+    return pick_op<XPORT_UC>(op, selective, inl);
+  default:
+    return pick_op<XPORT_UD>(op, selective, inl);
+  }
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <server_ip> <tcp_port> [--transport rc|uc|ud] "
+          "[--mode send|write|write_imm|read] [--msg N] [--iters N] "
+          "[--window N] [--signal-every N] [--inline] [--dev NAME] "
+          "[--port N] [--gid-index N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *ip = argv[1];
+  const char *tcp_port = argv[2];
+  Transport transport = XPORT_RC;
+  Op op = OP_WRITE;
+  size_t msg = 4096;
+  uint64_t iters = 100000;
+  uint64_t window = 64;
+  uint64_t signal_every = 1;
+  int inl = 0;
+  const char *dev = NULL;
+  uint8_t port = 1;
+  int gid_index = 3; // RoCE v2 global GID, as in the UD examples
+
+  for (int i = 3; i < argc; ++i) {
+    if (!strcmp(argv[i], "--transport") && i + 1 < argc) {
+      const char *t = argv[++i];
+      if (!strcmp(t, "rc"))
+        transport = XPORT_RC;
+      else if (!strcmp(t, "uc"))
+        transport = XPORT_UC;
+      else if (!strcmp(t, "ud"))
+        transport = XPORT_UD;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
+      const char *m = argv[++i];
+      if (!strcmp(m, "send"))
+        op = OP_SEND;
+      else if (!strcmp(m, "write"))
+        op = OP_WRITE;
+      else if (!strcmp(m, "write_imm"))
+        op = OP_WRITE_IMM;
+      else if (!strcmp(m, "read"))
+        op = OP_READ;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
+      msg = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
+      iters = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+      window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--signal-every") && i + 1 < argc) {
+      signal_every = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--inline")) {
+      inl = 1;
+    } else if (!strcmp(argv[i], "--dev") && i + 1 < argc) {
+      dev = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = (uint8_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gid-index") && i + 1 < argc) {
+      gid_index = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!msg || !iters || !window || !signal_every) {
+    fprintf(stderr, "--msg, --iters, --window and --signal-every must be "
+                    ">= 1\n");
+    return 1;
+  }
+  // With fewer WRs in flight than the signaling interval, the window could
+  // fill up with unsignaled WRs and never see a completion.
+  if (signal_every > window) {
+    fprintf(stderr, "--signal-every must not exceed --window\n");
+    return 1;
+  }
+  LoopFn loop = pick_loop(transport, op, signal_every > 1, inl);
+  if (!loop) {
+    fprintf(stderr, "%s %s%s is not supported\n", xport_str(transport),
+            op_str(op), inl ? " with --inline" : "");
+    return 1;
+  }
+
+  struct ibv_context *ctx = open_device(dev);
+  if (transport == XPORT_UD && msg > port_mtu(ctx, port)) {
+    fprintf(stderr, "UD messages must fit the path MTU (%u)\n",
+            port_mtu(ctx, port));
+    return 1;
+  }
+  struct ibv_pd *pd = ibv_alloc_pd(ctx);
+  if (!pd)
+    die("alloc_pd");
+  struct ibv_cq *cq = ibv_create_cq(ctx, (int)window, NULL, NULL, 0);
+  if (!cq)
+    die("create_cq");
+  uint32_t max_inline = 0;
+  struct ibv_qp *qp =
+      xport_create_qp(pd, cq, cq, transport, (uint32_t)window, 1,
+                      inl ? (uint32_t)msg : 0, &max_inline);
+  if (inl && max_inline < msg) {
+    fprintf(stderr, "--inline: device allows %u bytes inline, msg=%zu\n",
+            max_inline, msg);
+    return 1;
+  }
+  // One slot per window entry, so a slot is reused only after its WR has
+  // completed (or, unsignaled, been retired by a later completion).
+  char *buf = (char *)aligned_alloc(4096, (window * msg + 4095) & ~4095ul);
+  if (!buf)
+    die("alloc");
+  memset(buf, 0x5a, window * msg);
+  struct ibv_mr *mr = ibv_reg_mr(pd, buf, window * msg,
+                                 IBV_ACCESS_LOCAL_WRITE);
+  if (!mr)
+    die("reg_mr");
+
+  // Handshake: Hello and our QpInfo out, the server's QpInfo back once its
+  // QP is ready and its receives are posted.
+  struct addrinfo hints = {}, *res;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(ip, tcp_port, &hints, &res))
+    die("getaddrinfo");
+  int s = socket(res->ai_family, SOCK_STREAM, 0);
+  if (s < 0 || connect(s, res->ai_addr, res->ai_addrlen))
+    die("connect");
+  freeaddrinfo(res);
+  srand48(getpid() ^ time(NULL));
+  struct Hello hello = {(uint8_t)transport, (uint8_t)op, (uint32_t)msg};
+  struct QpInfo me = {}, peer;
+  xport_local_info(ctx, port, gid_index, qp, &me);
+  xfer_all(s, &hello, sizeof(hello), 1);
+  xfer_all(s, &me, sizeof(me), 1);
+  xfer_all(s, &peer, sizeof(peer), 0);
+  if (!peer.qpn) {
+    fprintf(stderr, "server rejected %s %s msg=%zu\n", xport_str(transport),
+            op_str(op), msg);
+    return 1;
+  }
+  xport_connect(qp, transport, port, gid_index, &me, &peer);
+
+  Bench b = {};
+  b.qp = qp;
+  b.cq = cq;
+  b.peer = peer;
+  b.buf = buf;
+  b.lkey = mr->lkey;
+  b.msg = msg;
+  b.iters = iters;
+  b.window = window;
+  b.signal_every = signal_every;
+  if (transport == XPORT_UD) {
+    struct ibv_ah_attr aa = xport_ah_attr(port, gid_index, &peer);
+    b.ah = ibv_create_ah(pd, &aa);
+    if (!b.ah)
+      die("create_ah");
+  }
+
+  uint64_t ns = loop(b);
+
+  // Tell the server we are done; it answers with what it received.
+  uint64_t received = 0;
+  xfer_all(s, &iters, sizeof(iters), 1);
+  xfer_all(s, &received, sizeof(received), 0);
+  close(s);
+
+  double sec = ns / 1e9;
+  printf("[client] %s %s done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, "
+         "window=%lu, signal_every=%lu, inline=%d)\n",
+         xport_str(transport), op_str(op), iters / sec / 1e6,
+         iters * msg / sec / (1024.0 * 1024.0 * 1024.0), msg,
+         (unsigned long)window, (unsigned long)signal_every, inl);
+  if (op == OP_SEND || op == OP_WRITE_IMM)
+    printf("[client] server received %lu of %lu\n", (unsigned long)received,
+           (unsigned long)iters);
+
+  if (b.ah)
+    ibv_destroy_ah(b.ah);
+  ibv_destroy_qp(qp);
+  ibv_dereg_mr(mr);
+  free(buf);
+  ibv_destroy_cq(cq);
+  ibv_dealloc_pd(pd);
+  ibv_close_device(ctx);
+  return 0;
+}
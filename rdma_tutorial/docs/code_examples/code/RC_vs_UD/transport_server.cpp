@@ -0,0 +1,222 @@
+// g++ -O2 -std=c++17 transport_server.cpp ../librdmabench/verbs.c -o transport_server -libverbs
+#include "transport.h"
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#define REPOST_BATCH 32
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+// Post receives for ring slots [first, first + n), chained in batches.
+static void post_recvs(struct ibv_qp *qp, char *ring, size_t slot,
+                       uint32_t lkey, uint64_t first, uint64_t n,
+                       uint64_t depth) {
+  struct ibv_recv_wr wr[REPOST_BATCH], *bad;
+  struct ibv_sge sge[REPOST_BATCH];
+  while (n) {
+    int k = n < REPOST_BATCH ? (int)n : REPOST_BATCH;
+    for (int i = 0; i < k; ++i) {
+      uint64_t s = (first + i) % depth;
+      sge[i].addr = (uintptr_t)(ring + s * slot);
+      sge[i].length = (uint32_t)slot;
+      sge[i].lkey = lkey;
+      wr[i].wr_id = s;
+      wr[i].sg_list = &sge[i];
+      wr[i].num_sge = 1;
+      wr[i].next = i + 1 < k ? &wr[i + 1] : NULL;
+    }
+    if (ibv_post_recv(qp, wr, &bad))
+      die("post_recv");
+    first += k;
+    n -= k;
+  }
+}
+
+// Serve one client: set up the QP it asked for, count what arrives until
+// it reports that it is done, then answer with the count.
+static void serve(int c, struct ibv_context *ctx, struct ibv_pd *pd,
+                  uint8_t port, int gid_index, uint32_t recv_depth) {
+  struct Hello hello;
+  struct QpInfo peer, me = {};
+  xfer_all(c, &hello, sizeof(hello), 0);
+  xfer_all(c, &peer, sizeof(peer), 0);
+  Transport t = (Transport)hello.transport;
+  Op op = (Op)hello.op;
+  size_t msg = hello.msg;
+  if (t > XPORT_UD || op > OP_READ || !xport_supports(t, op) || !msg ||
+      (t == XPORT_UD && msg > port_mtu(ctx, port))) {
+    fprintf(stderr, "[server] rejecting transport=%u op=%u msg=%zu\n",
+            hello.transport, hello.op, msg);
+    xfer_all(c, &me, sizeof(me), 1); // qpn 0
+    return;
+  }
+
+  // SEND and write_imm consume receives; WRITE and READ only need the
+  // target buffer. UD receives are prefixed by the GRH slot.
+  int counts = op == OP_SEND || op == OP_WRITE_IMM;
+  uint64_t depth = counts ? recv_depth : 1;
+  size_t slot = op == OP_SEND ? msg + (t == XPORT_UD ? XPORT_GRH : 0) : 0;
+  size_t len = msg + depth * slot;
+  char *buf = (char *)aligned_alloc(4096, (len + 4095) & ~4095ul);
+  if (!buf)
+    die("alloc");
+  memset(buf, 0, len);
+  struct ibv_mr *mr =
+      ibv_reg_mr(pd, buf, len,
+                 IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                     IBV_ACCESS_REMOTE_READ);
+  if (!mr)
+    die("reg_mr");
+  struct ibv_cq *cq = ibv_create_cq(ctx, (int)depth + 1, NULL, NULL, 0);
+  if (!cq)
+    die("create_cq");
+  struct ibv_qp *qp =
+      xport_create_qp(pd, cq, cq, t, 1, (uint32_t)depth, 0, NULL);
+  xport_local_info(ctx, port, gid_index, qp, &me);
+  me.addr = (uintptr_t)buf;
+  me.rkey = mr->rkey;
+  me.len = (uint32_t)msg;
+  xport_connect(qp, t, port, gid_index, &me, &peer);
+  char *ring = buf + msg;
+  if (counts)
+    post_recvs(qp, ring, slot, mr->lkey, 0, depth, depth);
+  xfer_all(c, &me, sizeof(me), 1);
+
+  uint64_t received = 0, sent = 0;
+  if (counts) {
+    // Poll the CQ and keep the ring full; check the control socket for the
+    // client's "done" every few thousand empty polls.
+    struct ibv_wc wc[32];
+    uint64_t idle = 0, deadline = 0;
+    for (;;) {
+      int n = ibv_poll_cq(cq, 32, wc);
+      if (n < 0)
+        die("poll_cq");
+      for (int i = 0; i < n; ++i)
+        if (wc[i].status != IBV_WC_SUCCESS) {
+          fprintf(stderr, "recv wc error: %s\n",
+                  ibv_wc_status_str(wc[i].status));
+          die("wc");
+        }
+      if (n) {
+        post_recvs(qp, ring, slot, mr->lkey, received, (uint64_t)n, depth);
+        received += (uint64_t)n;
+        idle = 0;
+        continue;
+      }
+      if (++idle % 4096)
+        continue;
+      if (!deadline) {
+        ssize_t r = recv(c, &sent, sizeof(sent), MSG_DONTWAIT | MSG_PEEK);
+        if (r == (ssize_t)sizeof(sent) ||
+            (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || r == 0) {
+          // Give UC/UD stragglers 10 ms to land before reporting.
+          deadline = now_ns() + 10000000;
+        }
+      } else if (now_ns() > deadline) {
+        break;
+      }
+    }
+  }
+  xfer_all(c, &sent, sizeof(sent), 0);
+  xfer_all(c, &received, sizeof(received), 1);
+  if (counts)
+    printf("[server] %s %s: received %lu of %lu (msg=%zu bytes)\n",
+           xport_str(t), op_str(op), (unsigned long)received,
+           (unsigned long)sent, msg);
+  else
+    printf("[server] %s %s: client done after %lu ops (msg=%zu bytes)\n",
+           xport_str(t), op_str(op), (unsigned long)sent, msg);
+
+  ibv_destroy_qp(qp);
+  ibv_destroy_cq(cq);
+  ibv_dereg_mr(mr);
+  free(buf);
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <tcp_port> [--recv-depth N] [--dev NAME] [--port N] "
+          "[--gid-index N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int tcp_port = atoi(argv[1]);
+  uint32_t recv_depth = 4096;
+  const char *dev = NULL;
+  uint8_t port = 1;
+  int gid_index = 3; // RoCE v2 global GID, as in the UD examples
+
+  for (int i = 2; i < argc; ++i) {
+    if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
+      recv_depth = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--dev") && i + 1 < argc) {
+      dev = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = (uint8_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gid-index") && i + 1 < argc) {
+      gid_index = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  struct ibv_context *ctx = open_device(dev);
+  struct ibv_device_attr da;
+  if (ibv_query_device(ctx, &da))
+    die("query_device");
+  if (recv_depth < 1 || recv_depth > (uint32_t)da.max_qp_wr) {
+    fprintf(stderr, "--recv-depth must be 1-%d\n", da.max_qp_wr);
+    return 1;
+  }
+  struct ibv_pd *pd = ibv_alloc_pd(ctx);
+  if (!pd)
+    die("alloc_pd");
+  srand48(getpid() ^ time(NULL));
+
+  int ls = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(tcp_port);
+  if (ls < 0 || bind(ls, (struct sockaddr *)&a, sizeof(a)) || listen(ls, 8))
+    die("listen");
+  struct sigaction sa = {};
+  sa.sa_handler = on_signal; // no SA_RESTART: accept() returns on Ctrl-C
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  printf("[server] listening on tcp %d, recv_depth=%u (Ctrl-C to stop)\n",
+         tcp_port, recv_depth);
+
+  // One client at a time; each gets a fresh QP of the transport it asks
+  // for, so a single server covers a whole RC/UC/UD sweep.
+  while (!stop) {
+    int c = accept(ls, NULL, NULL);
+    if (c < 0) {
+      if (errno == EINTR)
+        continue;
+      die("accept");
+    }
+    serve(c, ctx, pd, port, gid_index, recv_depth);
+    close(c);
+  }
+
+  close(ls);
+  ibv_dealloc_pd(pd);
+  ibv_close_device(ctx);
+  return 0;
+}
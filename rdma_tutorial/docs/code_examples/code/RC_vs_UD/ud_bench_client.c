@@ -0,0 +1,207 @@
+// gcc ud_bench_client.c ../librdmabench/verbs.c -o ud_bench_client -libverbs
+#include "../librdmabench/rdma_verbs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QKEY 0x11111111
+#define MAX_DESTS 64
+
+// A remote UD QP. Destinations at the same address share one AH, which is
+// created once and reused for every send.
+struct Dest {
+  uint8_t gid[16];
+  uint16_t lid;
+  uint32_t qpn;
+  struct ibv_ah *ah;
+};
+
+// Parse "<32 hex digit GID>:<qpn>", or "<lid>:<qpn>" without a GRH.
+static int parse_dest(const char *s, struct Dest *d) {
+  const char *colon = strchr(s, ':');
+  if (!colon)
+    return -1;
+  memset(d, 0, sizeof(*d));
+  if (colon - s == 32) {
+    for (int b = 0; b < 16; ++b)
+      if (sscanf(s + 2 * b, "%2hhx", &d->gid[b]) != 1)
+        return -1;
+  } else {
+    d->lid = (uint16_t)strtoul(s, NULL, 0);
+  }
+  char *end;
+  d->qpn = (uint32_t)strtoul(colon + 1, &end, 0);
+  return *end || !d->qpn ? -1 : 0;
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <dest> [<dest> ...] [--msg N] [--iters N] "
+          "[--window N] [--qkey N] [--dev NAME] [--port N] "
+          "[--gid-index N]\n"
+          "  dest: <server_gid>:<qpn> as printed by ud_bench_server "
+          "(<lid>:<qpn> with --gid-index -1)\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  struct Dest dests[MAX_DESTS];
+  int ndest = 0;
+  size_t msg = 0; // default: the path MTU
+  uint64_t iters = 100000;
+  uint64_t window = 64;
+  uint32_t qkey = QKEY;
+  const char *dev = NULL;
+  uint8_t port = 1;
+  int gid_index = 3; // RoCE v2 global GID
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
+      msg = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
+      iters = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+      window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--qkey") && i + 1 < argc) {
+      qkey = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--dev") && i + 1 < argc) {
+      dev = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = (uint8_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gid-index") && i + 1 < argc) {
+      gid_index = atoi(argv[++i]);
+    } else if (argv[i][0] != '-' && ndest < MAX_DESTS &&
+               !parse_dest(argv[i], &dests[ndest])) {
+      ndest++;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!ndest || !iters || !window) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct ibv_context *ctx = open_device(dev);
+  uint32_t mtu = port_mtu(ctx, port);
+  if (!msg)
+    msg = mtu;
+  if (msg > mtu) {
+    // A UD message is a single packet: nothing larger than the MTU.
+    fprintf(stderr, "--msg must be at most the path MTU (%u)\n", mtu);
+    return 1;
+  }
+  struct ibv_pd *pd = ibv_alloc_pd(ctx);
+  if (!pd)
+    die("alloc_pd");
+  struct ibv_cq *cq = ibv_create_cq(ctx, (int)window, NULL, NULL, 0);
+  if (!cq)
+    die("create_cq");
+  struct ibv_qp_init_attr qi = {0};
+  qi.send_cq = cq;
+  qi.recv_cq = cq;
+  qi.qp_type = IBV_QPT_UD;
+  qi.cap.max_send_wr = (uint32_t)window;
+  qi.cap.max_recv_wr = 1;
+  qi.cap.max_send_sge = 1;
+  qi.cap.max_recv_sge = 1;
+  struct ibv_qp *qp = ibv_create_qp(pd, &qi);
+  if (!qp)
+    die("create_qp");
+  ud_qp_ready(qp, port, qkey);
+
+  int ahs = 0;
+  for (int i = 0; i < ndest; ++i) {
+    for (int j = 0; j < i && !dests[i].ah; ++j)
+      if (!memcmp(dests[j].gid, dests[i].gid, 16) &&
+          dests[j].lid == dests[i].lid)
+        dests[i].ah = dests[j].ah;
+    if (dests[i].ah)
+      continue;
+    struct ibv_ah_attr aa = {0};
+    aa.dlid = dests[i].lid;
+    aa.port_num = port;
+    if (gid_index >= 0) {
+      aa.is_global = 1;
+      memcpy(aa.grh.dgid.raw, dests[i].gid, 16);
+      aa.grh.sgid_index = (uint8_t)gid_index;
+      aa.grh.hop_limit = 64;
+    }
+    dests[i].ah = ibv_create_ah(pd, &aa);
+    if (!dests[i].ah)
+      die("create_ah");
+    ahs++;
+  }
+
+  // Send slots are used round-robin; a slot is only reused after the send
+  // that last used it completed, as in bench_client's loop.
+  char *buf = malloc(window * msg);
+  if (!buf)
+    die("malloc");
+  memset(buf, 0x5a, window * msg);
+  struct ibv_mr *mr = ibv_reg_mr(pd, buf, window * msg, 0);
+  if (!mr)
+    die("reg_mr");
+
+  // Closed loop with `window` sends in flight, every one signaled like
+  // bench_client's, so the two are measured the same way. A UD send
+  // completes once the packet has left the NIC: the server reports how
+  // many actually arrived.
+  uint64_t posted = 0, done = 0;
+  struct ibv_wc wc[32];
+  uint64_t t0 = now_ns();
+  while (done < iters) {
+    while (posted - done < window && posted < iters) {
+      struct Dest *d = &dests[posted % ndest];
+      struct ibv_sge s = {.addr = (uintptr_t)(buf + (posted % window) * msg),
+                          .length = (uint32_t)msg,
+                          .lkey = mr->lkey};
+      struct ibv_send_wr wr = {0}, *bad = NULL;
+      wr.wr_id = posted;
+      wr.sg_list = &s;
+      wr.num_sge = 1;
+      wr.opcode = IBV_WR_SEND;
+      wr.send_flags = IBV_SEND_SIGNALED;
+      wr.wr.ud.ah = d->ah;
+      wr.wr.ud.remote_qpn = d->qpn;
+      wr.wr.ud.remote_qkey = qkey;
+      if (ibv_post_send(qp, &wr, &bad))
+        die("post_send");
+      posted++;
+    }
+    int n = ibv_poll_cq(cq, 32, wc);
+    if (n < 0)
+      die("poll_cq");
+    for (int i = 0; i < n; ++i) {
+      if (wc[i].status != IBV_WC_SUCCESS) {
+        printf("UD error: wr_id=%lu status=%d(%s) vendor_err=0x%x\n",
+               wc[i].wr_id, wc[i].status, ibv_wc_status_str(wc[i].status),
+               wc[i].vendor_err);
+        die("wc");
+      }
+      done++;
+    }
+  }
+  double sec = (now_ns() - t0) / 1e9;
+  printf("[client] ud send done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, "
+         "window=%lu, dests=%d, ahs=%d)\n",
+         iters / sec / 1e6, iters * msg / sec / (1024.0 * 1024.0 * 1024.0),
+         msg, (unsigned long)window, ndest, ahs);
+
+  ibv_destroy_qp(qp);
+  for (int i = 0; i < ndest; ++i)
+    if (dests[i].ah) { // shared AHs: destroy once, clear every user
+      struct ibv_ah *ah = dests[i].ah;
+      for (int j = i; j < ndest; ++j)
+        if (dests[j].ah == ah)
+          dests[j].ah = NULL;
+      ibv_destroy_ah(ah);
+    }
+  ibv_dereg_mr(mr);
+  free(buf);
+  ibv_destroy_cq(cq);
+  ibv_dealloc_pd(pd);
+  ibv_close_device(ctx);
+  return 0;
+}
@@ -0,0 +1,228 @@
+// gcc ud_bench_server.c ../librdmabench/verbs.c -o ud_bench_server -libverbs
+#include "../librdmabench/rdma_verbs.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QKEY 0x11111111
+#define UD_GRH 40 // every UD receive starts with room for the GRH
+#define REPOST_BATCH 32
+#define IDLE_NS 1000000000ull // a run ends after 1 s without messages
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+// One destination: a UD QP with its own ring of `depth` receive slots, each
+// UD_GRH + mtu bytes, so any message up to the path MTU fits.
+struct Dest {
+  struct ibv_qp *qp;
+  char *ring;
+  uint32_t lkey;
+  struct ibv_recv_wr wr[REPOST_BATCH];
+  struct ibv_sge sge[REPOST_BATCH];
+  int pending;
+};
+
+static size_t slot_len;
+
+static void flush_recvs(struct Dest *d) {
+  if (!d->pending)
+    return;
+  struct ibv_recv_wr *bad;
+  if (ibv_post_recv(d->qp, d->wr, &bad))
+    die("post_recv");
+  d->pending = 0;
+}
+
+// Queue slot `i` of `d` for reposting; reposts go out in batches of
+// REPOST_BATCH chained WRs, one doorbell each.
+static void repost(struct Dest *d, uint64_t i) {
+  struct ibv_sge *s = &d->sge[d->pending];
+  struct ibv_recv_wr *w = &d->wr[d->pending];
+  s->addr = (uintptr_t)(d->ring + i * slot_len);
+  s->length = (uint32_t)slot_len;
+  s->lkey = d->lkey;
+  w->wr_id = i;
+  w->sg_list = s;
+  w->num_sge = 1;
+  w->next = NULL;
+  if (d->pending)
+    d->wr[d->pending - 1].next = w;
+  if (++d->pending == REPOST_BATCH)
+    flush_recvs(d);
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s [--recv-depth N] [--qps N] [--iters N] [--dev NAME] "
+          "[--port N] [--gid-index N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  uint32_t recv_depth = 4096;
+  int qps = 1;
+  uint64_t iters = 0; // expected per run, to report losses; 0 = unknown
+  const char *dev = NULL;
+  uint8_t port = 1;
+  int gid_index = 3; // RoCE v2 global GID
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
+      recv_depth = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--qps") && i + 1 < argc) {
+      qps = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
+      iters = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--dev") && i + 1 < argc) {
+      dev = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = (uint8_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gid-index") && i + 1 < argc) {
+      gid_index = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (recv_depth < REPOST_BATCH || qps < 1) {
+    fprintf(stderr, "--recv-depth must be >= %d and --qps >= 1\n",
+            REPOST_BATCH);
+    return 1;
+  }
+
+  struct ibv_context *ctx = open_device(dev);
+  struct ibv_port_attr pa;
+  if (ibv_query_port(ctx, port, &pa))
+    die("query_port");
+  uint32_t mtu = 128u << pa.active_mtu;
+  slot_len = UD_GRH + mtu;
+  struct ibv_device_attr da;
+  if (ibv_query_device(ctx, &da))
+    die("query_device");
+  if (recv_depth > (uint32_t)da.max_qp_wr) {
+    fprintf(stderr, "[server] clamping --recv-depth to max_qp_wr=%d\n",
+            da.max_qp_wr);
+    recv_depth = (uint32_t)da.max_qp_wr;
+  }
+  struct ibv_pd *pd = ibv_alloc_pd(ctx);
+  if (!pd)
+    die("alloc_pd");
+  // All destinations share one CQ; wr_id carries the slot, qp_num the QP.
+  struct ibv_cq *cq = ibv_create_cq(ctx, recv_depth * qps, NULL, NULL, 0);
+  if (!cq)
+    die("create_cq");
+  size_t ring_len = (size_t)recv_depth * slot_len;
+  char *buf = malloc(ring_len * qps);
+  if (!buf)
+    die("malloc");
+  struct ibv_mr *mr = ibv_reg_mr(pd, buf, ring_len * qps,
+                                 IBV_ACCESS_LOCAL_WRITE);
+  if (!mr)
+    die("reg_mr");
+
+  union ibv_gid gid = {0};
+  if (gid_index >= 0 && ibv_query_gid(ctx, port, gid_index, &gid))
+    die("query_gid");
+  struct Dest *d = calloc((size_t)qps, sizeof(*d));
+  if (!d)
+    die("calloc");
+  printf("[server] %d UD QP(s), recv_depth=%u, mtu=%u\n", qps, recv_depth,
+         mtu);
+  for (int q = 0; q < qps; ++q) {
+    struct ibv_qp_init_attr qi = {0};
+    qi.send_cq = cq;
+    qi.recv_cq = cq;
+    qi.qp_type = IBV_QPT_UD;
+    qi.cap.max_send_wr = 1;
+    qi.cap.max_recv_wr = recv_depth;
+    qi.cap.max_send_sge = 1;
+    qi.cap.max_recv_sge = 1;
+    d[q].qp = ibv_create_qp(pd, &qi);
+    if (!d[q].qp)
+      die("create_qp");
+    ud_qp_ready(d[q].qp, port, QKEY);
+    d[q].ring = buf + q * ring_len;
+    d[q].lkey = mr->lkey;
+    for (uint32_t i = 0; i < recv_depth; ++i)
+      repost(&d[q], i);
+    flush_recvs(&d[q]);
+
+    // Paste these as the client's destinations.
+    printf("  dest = ");
+    for (int b = 0; b < 16; ++b)
+      printf("%02x", gid.raw[b]);
+    printf(":%u\n", d[q].qp->qp_num);
+  }
+  if (gid_index < 0)
+    printf("  lid  = %u\n", pa.lid);
+  printf("  qkey = 0x%x\n", QKEY);
+
+  struct sigaction sa = {0};
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // Each run ends when the client stops sending: report what arrived.
+  uint64_t msgs = 0, bytes = 0, bad = 0, t_first = 0, t_last = 0;
+  struct ibv_wc wc[32];
+  while (!stop) {
+    int n = ibv_poll_cq(cq, 32, wc);
+    if (n < 0)
+      die("poll_cq");
+    if (n == 0) {
+      if (msgs && now_ns() - t_last > IDLE_NS) {
+        double sec = (t_last - t_first) / 1e9;
+        if (sec <= 0)
+          sec = 1e-9;
+        printf("[server] received %lu msgs, %.2f Mops, %.2f GiB/s",
+               (unsigned long)msgs, msgs / sec / 1e6,
+               bytes / sec / (1024.0 * 1024.0 * 1024.0));
+        if (iters)
+          printf(", %ld lost", (long)(iters - msgs));
+        printf(" (%lu malformed)\n", (unsigned long)bad);
+        msgs = bytes = bad = 0;
+      }
+      continue;
+    }
+    uint64_t now = now_ns();
+    if (!msgs)
+      t_first = now;
+    t_last = now;
+    for (int i = 0; i < n; ++i) {
+      if (wc[i].status != IBV_WC_SUCCESS) {
+        fprintf(stderr, "recv wc error: %s\n",
+                ibv_wc_status_str(wc[i].status));
+        die("wc");
+      }
+      // The payload starts after the GRH slot whether or not the packet
+      // carried one (IBV_WC_GRH); byte_len includes those 40 bytes.
+      if (wc[i].byte_len < UD_GRH)
+        bad++;
+      else
+        bytes += wc[i].byte_len - UD_GRH;
+      msgs++;
+      int q = 0;
+      while (q < qps - 1 && d[q].qp->qp_num != wc[i].qp_num)
+        q++;
+      repost(&d[q], wc[i].wr_id);
+    }
+    for (int q = 0; q < qps; ++q)
+      flush_recvs(&d[q]);
+  }
+
+  for (int q = 0; q < qps; ++q)
+    ibv_destroy_qp(d[q].qp);
+  ibv_dereg_mr(mr);
+  free(buf);
+  free(d);
+  ibv_destroy_cq(cq);
+  ibv_dealloc_pd(pd);
+  ibv_close_device(ctx);
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include "rdma_bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE (2ul << 20)
+
+void buf_alloc(struct Buf *b, struct ibv_pd *pd, size_t len, int access,
+               enum BufBackend backend) {
+  memset(b, 0, sizeof(*b));
+  b->len = len;
+  b->backend = backend;
+  if (backend == BUF_HUGE) {
+    size_t mlen = (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    void *p = mmap(NULL, mlen, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      fprintf(stderr, "no hugepages for %zu bytes, using normal pages\n",
+              len);
+      b->backend = BUF_HOST;
+    } else {
+      b->base = p;
+    }
+  }
+  if (b->backend == BUF_HOST &&
+      posix_memalign((void **)&b->base, 4096, len ? len : 1))
+    die("alloc");
+  memset(b->base, 0, len);
+  b->mr = ibv_reg_mr(pd, b->base, len, access);
+  if (!b->mr)
+    die("reg_mr");
+}
+
+void buf_wrap(struct Buf *b, struct ibv_pd *pd, void *p, size_t len,
+              int access) {
+  memset(b, 0, sizeof(*b));
+  b->base = p;
+  b->len = len;
+  b->backend = BUF_EXTERNAL;
+  b->mr = ibv_reg_mr(pd, p, len, access);
+  if (!b->mr)
+    die("reg_mr");
+}
+
+void buf_free(struct Buf *b) {
+  if (b->mr)
+    ibv_dereg_mr(b->mr);
+  if (b->backend == BUF_HUGE)
+    munmap(b->base, (b->len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+  else if (b->backend == BUF_HOST)
+    free(b->base);
+  memset(b, 0, sizeof(*b));
+}
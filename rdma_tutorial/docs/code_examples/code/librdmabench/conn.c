@@ -0,0 +1,168 @@
+#include "rdma_bench.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct rdma_cm_id *rb_resolve(struct rdma_event_channel *ec, const char *ip,
+                              int port, int family) {
+  struct addrinfo hints = {0}, *res;
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  char ps[16];
+  snprintf(ps, sizeof(ps), "%d", port);
+  int err = getaddrinfo(ip, ps, &hints, &res);
+  if (err) {
+    fprintf(stderr, "getaddrinfo %s: %s\n", ip, gai_strerror(err));
+    exit(1);
+  }
+  struct rdma_cm_id *id;
+  if (rdma_create_id(ec, &id, NULL, RDMA_PS_TCP))
+    die("create_id");
+  if (rdma_resolve_addr(id, NULL, res->ai_addr, 2000))
+    die("resolve_addr");
+  freeaddrinfo(res);
+  rb_expect(ec, RDMA_CM_EVENT_ADDR_RESOLVED, NULL, 0);
+  if (rdma_resolve_route(id, 2000))
+    die("resolve_route");
+  rb_expect(ec, RDMA_CM_EVENT_ROUTE_RESOLVED, NULL, 0);
+  return id;
+}
+
+struct rdma_cm_id *rb_listen(struct rdma_event_channel *ec, const char *ip,
+                             int port, int backlog) {
+  struct sockaddr_storage ss = {0};
+  if (ip && strchr(ip, ':')) {
+    struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&ss;
+    a6->sin6_family = AF_INET6;
+    a6->sin6_port = htons(port);
+    if (inet_pton(AF_INET6, ip, &a6->sin6_addr) != 1)
+      die("inet_pton");
+  } else {
+    struct sockaddr_in *a = (struct sockaddr_in *)&ss;
+    a->sin_family = AF_INET;
+    a->sin_port = htons(port);
+    if (ip && inet_pton(AF_INET, ip, &a->sin_addr) != 1)
+      die("inet_pton");
+  }
+  struct rdma_cm_id *lid;
+  if (rdma_create_id(ec, &lid, NULL, RDMA_PS_TCP))
+    die("create_id");
+  if (rdma_bind_addr(lid, (struct sockaddr *)&ss))
+    die("bind");
+  if (rdma_listen(lid, backlog))
+    die("listen");
+  return lid;
+}
+
+struct rdma_cm_id *rb_expect(struct rdma_event_channel *ec,
+                             enum rdma_cm_event_type type, void *priv,
+                             size_t len) {
+  struct rdma_cm_event *e;
+  if (rdma_get_cm_event(ec, &e))
+    die("get_cm_event");
+  if (e->event != type) {
+    fprintf(stderr, "expected %s, got %s (status %d)\n",
+            rdma_event_str(type), rdma_event_str(e->event), e->status);
+    exit(1);
+  }
+  struct rdma_cm_id *id = e->id;
+  if (priv) {
+    if (e->param.conn.private_data_len < len) {
+      fprintf(stderr, "%s: short private data (%u < %zu)\n",
+              rdma_event_str(type), e->param.conn.private_data_len, len);
+      exit(1);
+    }
+    memcpy(priv, e->param.conn.private_data, len);
+  }
+  rdma_ack_cm_event(e);
+  return id;
+}
+
+void rd_atomic_limits(struct ibv_context *ctx, int want, uint8_t *initiator,
+                      uint8_t *responder) {
+  struct ibv_device_attr da;
+  if (ibv_query_device(ctx, &da))
+    die("query_device");
+  int init = da.max_qp_init_rd_atom, resp = da.max_qp_rd_atom;
+  if (want > 0 && (want > init || want > resp))
+    fprintf(stderr, "--rd-atomic %d above device limit (init %d, resp %d)\n",
+            want, init, resp);
+  if (want > 0 && init > want)
+    init = want;
+  if (want > 0 && resp > want)
+    resp = want;
+  *initiator = (uint8_t)(init > 255 ? 255 : init);
+  *responder = (uint8_t)(resp > 255 ? 255 : resp);
+}
+
+struct rdma_cm_id *rb_expect_request(struct rdma_event_channel *ec, int want,
+                                     struct rdma_conn_param *p) {
+  struct rdma_cm_event *e;
+  if (rdma_get_cm_event(ec, &e))
+    die("get_cm_event");
+  if (e->event != RDMA_CM_EVENT_CONNECT_REQUEST) {
+    fprintf(stderr, "expected a connect request, got %s\n",
+            rdma_event_str(e->event));
+    exit(1);
+  }
+  struct rdma_cm_id *id = e->id;
+  uint8_t peer_init = e->param.conn.initiator_depth;
+  uint8_t peer_resp = e->param.conn.responder_resources;
+  rdma_ack_cm_event(e);
+  uint8_t init, resp;
+  rd_atomic_limits(id->verbs, want, &init, &resp);
+  p->responder_resources = resp < peer_init ? resp : peer_init;
+  p->initiator_depth = init < peer_resp ? init : peer_resp;
+  return id;
+}
+
+uint8_t report_rd_atomic(struct ibv_qp *qp, const char *who) {
+  struct ibv_qp_attr a;
+  struct ibv_qp_init_attr ia;
+  if (ibv_query_qp(qp, &a, IBV_QP_MAX_QP_RD_ATOMIC | IBV_QP_MAX_DEST_RD_ATOMIC,
+                   &ia))
+    die("query_qp");
+  printf("[%s] rd_atomic: initiator=%u responder=%u\n", who, a.max_rd_atomic,
+         a.max_dest_rd_atomic);
+  return a.max_rd_atomic;
+}
+
+void timers_set_id(struct rdma_cm_id *id, const struct Timers *t) {
+  if (t->timeout < 0)
+    return;
+  uint8_t v = (uint8_t)t->timeout;
+  if (rdma_set_option(id, RDMA_OPTION_ID, RDMA_OPTION_ID_ACK_TIMEOUT, &v,
+                      sizeof(v)))
+    die("set_option ack_timeout");
+}
+
+void timers_set_param(struct rdma_conn_param *p, const struct Timers *t) {
+  if (t->retry_cnt >= 0)
+    p->retry_count = (uint8_t)t->retry_cnt;
+  if (t->rnr_retry >= 0)
+    p->rnr_retry_count = (uint8_t)t->rnr_retry;
+}
+
+void timers_set_qp(struct ibv_qp *qp, const struct Timers *t,
+                   const char *who) {
+  struct ibv_qp_attr a = {0};
+  struct ibv_qp_init_attr ia;
+  if (t->min_rnr_timer >= 0) {
+    a.qp_state = IBV_QPS_RTS;
+    a.min_rnr_timer = (uint8_t)t->min_rnr_timer;
+    if (ibv_modify_qp(qp, &a, IBV_QP_STATE | IBV_QP_MIN_RNR_TIMER))
+      die("modify_qp min_rnr_timer");
+  }
+  if (!who)
+    return;
+  if (ibv_query_qp(qp, &a,
+                   IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
+                       IBV_QP_MIN_RNR_TIMER,
+                   &ia))
+    die("query_qp");
+  printf("[%s] timers: timeout=%u retry_cnt=%u rnr_retry=%u "
+         "min_rnr_timer=%u\n",
+         who, a.timeout, a.retry_cnt, a.rnr_retry, a.min_rnr_timer);
+}
@@ -0,0 +1,372 @@
+#include "rdma_bench.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void post_recv_slot(struct rdma_cm_id *id, char *buf, struct ibv_mr *mr,
+                    size_t msg, int slot) {
+  struct ibv_sge s = {.addr = (uintptr_t)(buf + (size_t)slot * msg),
+                      .length = (uint32_t)msg,
+                      .lkey = mr->lkey};
+  struct ibv_recv_wr wr = {
+      .wr_id = (uint64_t)slot, .sg_list = &s, .num_sge = 1};
+  struct ibv_recv_wr *bad;
+  if (ibv_post_recv(id->qp, &wr, &bad))
+    die("post_recv");
+}
+
+enum ibv_wr_opcode mode_opcode(enum Mode mode) {
+  static const enum ibv_wr_opcode op[] = {IBV_WR_RDMA_READ, IBV_WR_RDMA_WRITE,
+                                          IBV_WR_SEND,
+                                          IBV_WR_RDMA_WRITE_WITH_IMM};
+  return op[mode];
+}
+
+void wr_init(struct ibv_send_wr *wr, struct ibv_sge *s, enum Mode mode,
+             const struct Info *remote) {
+  memset(wr, 0, sizeof(*wr));
+  wr->sg_list = s;
+  wr->num_sge = 1;
+  wr->send_flags = IBV_SEND_SIGNALED;
+  wr->opcode = mode_opcode(mode);
+  if (remote) {
+    wr->wr.rdma.remote_addr = remote->addr;
+    wr->wr.rdma.rkey = remote->rkey;
+  }
+}
+
+void wr_set_offset(struct ibv_send_wr *wr, const struct Info *remote,
+                   uint64_t off) {
+  wr->wr.rdma.remote_addr = remote->addr + off;
+  wr->imm_data = htonl((uint32_t)off);
+}
+
+void wc_report(const struct ibv_wc *wc) {
+  printf("RDMA error: wr_id=%lu status=%d(%s) vendor_err=0x%x\n",
+         (unsigned long)wc->wr_id, wc->status, ibv_wc_status_str(wc->status),
+         wc->vendor_err);
+}
+
+void wc_die(const struct ibv_wc *wc) {
+  wc_report(wc);
+  die("wc");
+}
+
+int poll_cq_ok(struct ibv_cq *cq, int max, struct ibv_wc *wc) {
+  int n = ibv_poll_cq(cq, max, wc);
+  if (n < 0)
+    die("poll_cq");
+  for (int i = 0; i < n; ++i)
+    if (wc[i].status)
+      wc_die(&wc[i]);
+  return n;
+}
+
+void grant_credits(struct rdma_cm_id *id, uint32_t n) {
+  struct ibv_wc wc[8];
+  int got = ibv_poll_cq(id->send_cq, 8, wc);
+  if (got < 0)
+    die("poll_cq");
+  for (int i = 0; i < got; ++i)
+    if (wc[i].status && wc[i].status != IBV_WC_WR_FLUSH_ERR)
+      fprintf(stderr, "[server] credit update failed: %s\n",
+              ibv_wc_status_str(wc[i].status));
+  struct ibv_send_wr wr = {0}, *bad;
+  wr.wr_id = CREDIT_WRID;
+  wr.opcode = IBV_WR_SEND_WITH_IMM;
+  wr.imm_data = htonl(n);
+  wr.send_flags = IBV_SEND_SIGNALED;
+  if (ibv_post_send(id->qp, &wr, &bad))
+    die("post_send");
+}
+
+// One WR is reused: per op only the SGE, opcode, offset, wr_id and
+// signal bit change. Completions on one send queue arrive in order, so
+// with selective signaling the completion for wr_id i retires every op up
+// to i, signaled or not.
+int run_ops(const struct OpLoop *l, struct Stats *st, struct OpErrors *err) {
+  uint64_t iters = l->iters, window = l->window;
+  uint64_t every = signal_interval(l->signal_every, window);
+  uint64_t *due = NULL;
+  if (l->lat && !(due = malloc(iters * sizeof(*due))))
+    die("malloc");
+  struct Prof own = {0}, *prof = l->prof ? l->prof : &own;
+  struct ibv_sge s = {.lkey = l->lkey};
+  struct ibv_send_wr wr, *bad = NULL;
+  wr_init(&wr, &s, MODE_READ, l->remote);
+
+  struct OpErrors e = {0};
+  struct WrOp op;
+  uint64_t posted = 0, done = 0, bytes = 0;
+  int failed = 0;
+  struct ibv_wc wc[32];
+  uint64_t t0 = now_ns(), now = 0;
+  while (failed ? done < posted : done < iters) {
+    while (!failed && posted - done < window && posted < iters) {
+      if (l->next(l->arg, posted, now, &op))
+        break;
+      int signaled = (posted + 1) % every == 0 || posted + 1 == iters;
+      if (due)
+        due[posted] = op.due;
+      bytes += op.len;
+      if (l->post) {
+        uint64_t t = prof_ticks();
+        l->post(l->arg, posted, &op, signaled);
+        prof_post(prof, t);
+        posted++;
+        continue;
+      }
+      s.addr = (uintptr_t)op.src;
+      s.length = op.len;
+      wr.opcode = mode_opcode(op.mode);
+      wr.wr_id = posted;
+      wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+      if (op.mode != MODE_SEND)
+        wr_set_offset(&wr, l->remote, op.offset);
+      uint64_t t = prof_ticks();
+      if (ibv_post_send(l->qp[op.qp], &wr, &bad))
+        die("post_send");
+      prof_post(prof, t);
+      posted++;
+    }
+
+    uint64_t t = prof_ticks();
+    int n = l->poll ? l->poll(l->arg, 32, wc) : ibv_poll_cq(l->cq, 32, wc);
+    prof_poll(prof, t, n);
+    if (n < 0)
+      die("poll_cq");
+    if (due)
+      now = now_ns() - t0;
+    for (int i = 0; i < n; ++i) {
+      uint64_t id = wc[i].wr_id;
+      done = every > 1 ? id + 1 : done + 1;
+      if (due)
+        l->lat[id] = now - due[id];
+      if (wc[i].status == IBV_WC_SUCCESS)
+        continue;
+      if (!err)
+        wc_die(&wc[i]);
+      failed = 1;
+      if (wc[i].status == IBV_WC_RNR_RETRY_EXC_ERR)
+        e.rnr_exc++;
+      else if (wc[i].status == IBV_WC_RETRY_EXC_ERR)
+        e.retry_exc++;
+      else if (wc[i].status == IBV_WC_WR_FLUSH_ERR)
+        e.flushed++;
+      else
+        wc_die(&wc[i]);
+    }
+  }
+  st->ns = now_ns() - t0;
+  st->ops = done - e.rnr_exc - e.retry_exc - e.flushed;
+  st->bytes = bytes;
+  free(due);
+  if (err)
+    *err = e;
+  return failed ? -1 : 0;
+}
+
+// run_closed_loop()'s ops: the same one every time.
+static int same_op(void *arg, uint64_t i, uint64_t now,
+                   struct WrOp *op) {
+  (void)i;
+  (void)now;
+  *op = *(const struct WrOp *)arg;
+  return 0;
+}
+
+void run_closed_loop(struct ibv_qp *qp, struct ibv_cq *cq,
+                     const struct Loop *l, struct Stats *st) {
+  struct WrOp op = {l->mode, 0, (uint32_t)l->msg, l->src->base, 0, 0};
+  struct OpLoop ol = {.qp = &qp,
+                      .cq = cq,
+                      .remote = l->remote,
+                      .lkey = l->src->mr->lkey,
+                      .iters = l->iters,
+                      .window = l->window,
+                      .signal_every = l->signal_every,
+                      .next = same_op,
+                      .arg = &op};
+  run_ops(&ol, st, NULL);
+}
+
+void run_xfer(struct XferRail *rail, int nrail, const struct Xfer *x,
+              struct Stats *st) {
+  uint64_t chunks = (x->len + x->chunk - 1) / x->chunk;
+  // QP k is QP k / nrail of rail k % nrail.
+  int nqp = nrail * rail[0].nqp;
+  uint64_t *inflight = calloc((size_t)nqp, sizeof(*inflight));
+  if (!inflight)
+    die("calloc");
+  struct ibv_sge s;
+  struct ibv_send_wr wr, *bad = NULL;
+  wr_init(&wr, &s, x->mode, NULL);
+
+  // wr_id = chunk * nqp + k, so a completion names both.
+  uint64_t next = 0, done = 0;
+  int k = 0;
+  struct ibv_wc wc[32];
+  uint64_t t0 = now_ns();
+  while (done < chunks) {
+    // Stop dealing once a full round finds every QP's window full.
+    for (int full = 0; next < chunks && full < nqp; k = (k + 1) % nqp) {
+      if (inflight[k] == x->window) {
+        full++;
+        continue;
+      }
+      full = 0;
+      struct XferRail *r = &rail[k % nrail];
+      uint64_t off = next * x->chunk;
+      uint64_t span = r->remote.len / x->chunk * x->chunk;
+      s.addr = (uintptr_t)x->local + off;
+      s.length = (uint32_t)(x->len - off < x->chunk ? x->len - off : x->chunk);
+      s.lkey = r->lkey;
+      wr.wr.rdma.remote_addr = r->remote.addr + off % span;
+      wr.wr.rdma.rkey = r->remote.rkey;
+      wr.wr_id = next * (uint64_t)nqp + (uint64_t)k;
+      if (ibv_post_send(r->qp[k / nrail], &wr, &bad))
+        die("post_send");
+      inflight[k]++;
+      next++;
+    }
+    for (int i = 0; i < nrail; ++i) {
+      int n = poll_cq_ok(rail[i].cq, 32, wc);
+      for (int j = 0; j < n; ++j) {
+        uint64_t c = wc[j].wr_id / (uint64_t)nqp;
+        rail[i].bytes += c + 1 == chunks ? x->len - c * x->chunk : x->chunk;
+        inflight[wc[j].wr_id % (uint64_t)nqp]--;
+        done++;
+      }
+    }
+  }
+  st->ns = now_ns() - t0;
+  st->ops = chunks;
+  st->bytes = x->len;
+  free(inflight);
+}
+
+void run_recv_loop(struct rdma_cm_id *id, const struct Buf *buf, size_t msg,
+                   uint64_t iters, int credit_batch, struct Stats *st) {
+  uint64_t done = 0;
+  int ungranted = 0;
+  struct ibv_wc wc[32];
+  uint64_t t0 = now_ns();
+  while (done < iters) {
+    int n = poll_cq_ok(id->recv_cq, 32, wc);
+    for (int i = 0; i < n; ++i) {
+      done++;
+      post_recv_slot(id, buf->base, buf->mr, msg, (int)wc[i].wr_id);
+      if (credit_batch && ++ungranted == credit_batch) {
+        grant_credits(id, (uint32_t)ungranted);
+        ungranted = 0;
+      }
+    }
+  }
+  st->ns = now_ns() - t0;
+  st->ops = iters;
+  st->bytes = iters * msg;
+}
+
+void run_bidir(struct rdma_cm_id *id, struct ibv_cq *cq, enum Mode mode,
+               char *buf, struct ibv_mr *mr, size_t msg, int recv_depth,
+               uint64_t iters, uint64_t window, const struct Info *peer,
+               const char *who) {
+  char *tx = buf + (size_t)recv_depth * msg;
+  uint64_t posted = 0, done = 0, rx = 0;
+  int stats_sent = 0, stats_acked = 0, have_peer = 0;
+  struct BidirStats mine = {0}, theirs = {0};
+  struct ibv_sge s = {
+      .addr = (uintptr_t)tx, .length = (uint32_t)msg, .lkey = mr->lkey};
+  struct ibv_send_wr wr, *bad = NULL;
+  wr_init(&wr, &s, mode, mode == MODE_SEND ? NULL : peer);
+  struct ibv_wc wc[32];
+  // Each of our sends (and write_imms) takes one of the peer's receives,
+  // and nothing but the window paces us, so it must stay inside the ring
+  // the peer advertised. One receive is left for our STATS_IMM message,
+  // which can go out while the peer is still reposting the last sends.
+  if (mode == MODE_SEND || mode == MODE_WRITE_IMM) {
+    uint64_t peer_depth = peer->slot ? peer->len / peer->slot : 0;
+    if (peer_depth < 2) {
+      fprintf(stderr, "[%s] the peer posts %lu receives, --bidir needs at "
+                      "least 2\n",
+              who, (unsigned long)peer_depth);
+      exit(1);
+    }
+    if (window > peer_depth - 1) {
+      printf("[%s] window %lu capped at the peer's %lu receives less one\n",
+             who, (unsigned long)window, (unsigned long)(peer_depth - 1));
+      window = peer_depth - 1;
+    }
+  }
+  uint64_t t0 = now_ns();
+
+  while (!stats_acked || !have_peer) {
+    while (posted - done < window && posted < iters) {
+      wr.wr_id = posted;
+      if (ibv_post_send(id->qp, &wr, &bad))
+        die("post_send");
+      posted++;
+    }
+
+    if (done == iters && !stats_sent) {
+      mine.ops = iters;
+      mine.bytes = iters * msg;
+      mine.nsec = now_ns() - t0;
+      memcpy(tx, &mine, sizeof(mine));
+      struct ibv_sge ss = {.addr = (uintptr_t)tx,
+                           .length = (uint32_t)sizeof(mine),
+                           .lkey = mr->lkey};
+      struct ibv_send_wr sw = {0};
+      sw.wr_id = STATS_WRID;
+      sw.sg_list = &ss;
+      sw.num_sge = 1;
+      sw.opcode = IBV_WR_SEND_WITH_IMM;
+      sw.imm_data = htonl(STATS_IMM);
+      sw.send_flags = IBV_SEND_SIGNALED;
+      if (ibv_post_send(id->qp, &sw, &bad))
+        die("post_stats");
+      stats_sent = 1;
+    }
+
+    int n = poll_cq_ok(cq, 32, wc);
+    for (int i = 0; i < n; ++i) {
+      if (wc[i].wr_id == STATS_WRID)
+        stats_acked = 1;
+      else
+        done++;
+    }
+
+    n = poll_cq_ok(id->recv_cq, 32, wc);
+    for (int i = 0; i < n; ++i) {
+      int slot = (int)wc[i].wr_id;
+      if ((wc[i].wc_flags & IBV_WC_WITH_IMM) &&
+          ntohl(wc[i].imm_data) == STATS_IMM) {
+        memcpy(&theirs, buf + (size_t)slot * msg, sizeof(theirs));
+        have_peer = 1;
+      } else {
+        rx++;
+      }
+      post_recv_slot(id, buf, mr, msg, slot);
+    }
+  }
+
+  double tx_sec = mine.nsec / 1e9, rx_sec = theirs.nsec / 1e9;
+  double tx_mops = mine.ops / tx_sec / 1e6;
+  double tx_bw = mine.bytes / tx_sec / (1024.0 * 1024.0 * 1024.0);
+  double rx_mops = rx_sec > 0 ? theirs.ops / rx_sec / 1e6 : 0;
+  double rx_bw =
+      rx_sec > 0 ? theirs.bytes / rx_sec / (1024.0 * 1024.0 * 1024.0) : 0;
+  if (mode == MODE_SEND && rx != theirs.ops)
+    fprintf(stderr, "[%s] warning: received %lu sends, peer posted %lu\n", who,
+            (unsigned long)rx, (unsigned long)theirs.ops);
+  printf("[%s] %s tx: %.2f Mops, %.2f GiB/s\n", who, mode_str(mode), tx_mops,
+         tx_bw);
+  printf("[%s] %s rx: %.2f Mops, %.2f GiB/s (peer-reported)\n", who,
+         mode_str(mode), rx_mops, rx_bw);
+  printf("[%s] %s done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, window=%lu, "
+         "bidir)\n",
+         who, mode_str(mode), tx_mops + rx_mops, tx_bw + rx_bw, msg,
+         (unsigned long)window);
+}
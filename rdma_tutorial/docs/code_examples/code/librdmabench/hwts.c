@@ -0,0 +1,122 @@
+#include "rdma_bench.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t clock_ns(clockid_t c) {
+  struct timespec ts;
+  clock_gettime(c, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void hwts_create_cq(struct HwTs *h, struct ibv_context *ctx, int cqe,
+                    const char *who) {
+  memset(h, 0, sizeof(*h));
+  h->ctx = ctx;
+  h->tick[0] = h->tick[1] = -1;
+  struct ibv_device_attr_ex attr;
+  memset(&attr, 0, sizeof(attr));
+  if (!ibv_query_device_ex(ctx, NULL, &attr))
+    h->khz = attr.hca_core_clock;
+
+  // Wallclock first: it needs no conversion.
+  static const uint64_t tries[] = {
+      IBV_WC_EX_WITH_COMPLETION_TIMESTAMP_WALLCLOCK,
+      IBV_WC_EX_WITH_COMPLETION_TIMESTAMP};
+  for (size_t i = 0; i < 2 && !h->cqx; ++i) {
+    if (tries[i] == IBV_WC_EX_WITH_COMPLETION_TIMESTAMP &&
+        (!h->khz || !attr.completion_timestamp_mask))
+      break;
+    struct ibv_cq_init_attr_ex ca;
+    memset(&ca, 0, sizeof(ca));
+    ca.cqe = (uint32_t)cqe;
+    ca.wc_flags = IBV_WC_STANDARD_FLAGS | tries[i];
+    h->cqx = ibv_create_cq_ex(ctx, &ca);
+    h->wallclock = h->cqx && i == 0;
+  }
+  if (h->cqx) {
+    h->cq = ibv_cq_ex_to_cq(h->cqx);
+    printf("[%s] hw timestamps: %s\n", who,
+           h->wallclock ? "wallclock" : "raw clock");
+    return;
+  }
+  h->cq = ibv_create_cq(ctx, cqe, NULL, NULL, 0);
+  if (!h->cq)
+    die("create_cq");
+  printf("[%s] hw timestamps: not supported by %s, host clock only\n", who,
+         ibv_get_device_name(ctx->device));
+}
+
+uint64_t hwts_host_ns(const struct HwTs *h) {
+  return clock_ns(h->wallclock ? CLOCK_REALTIME : CLOCK_MONOTONIC);
+}
+
+void hwts_sync(struct HwTs *h, int i) {
+  if (!h->cqx || h->wallclock)
+    return;
+  // Keep the read with the tightest host bracket: its midpoint is the
+  // best estimate of when the device sampled its clock.
+  uint64_t best = UINT64_MAX;
+  for (int k = 0; k < 16; ++k) {
+    struct ibv_values_ex v;
+    memset(&v, 0, sizeof(v));
+    v.comp_mask = IBV_VALUES_MASK_RAW_CLOCK;
+    uint64_t t0 = clock_ns(CLOCK_MONOTONIC);
+    if (ibv_query_rt_values_ex(h->ctx, &v) ||
+        !(v.comp_mask & IBV_VALUES_MASK_RAW_CLOCK))
+      return;
+    uint64_t t1 = clock_ns(CLOCK_MONOTONIC);
+    if (t1 - t0 < best) {
+      best = t1 - t0;
+      h->tick[i] = (int64_t)((uint64_t)v.raw_clock.tv_sec * 1000000000ull +
+                             (uint64_t)v.raw_clock.tv_nsec);
+      h->host[i] = t0 + (t1 - t0) / 2;
+    }
+  }
+}
+
+int hwts_mapped(const struct HwTs *h) {
+  return h->wallclock || (h->tick[0] >= 0 && h->tick[1] > h->tick[0] &&
+                          h->host[1] > h->host[0]);
+}
+
+uint64_t hwts_to_host(const struct HwTs *h, uint64_t ts) {
+  if (h->wallclock)
+    return ts;
+  double ns_per_tick =
+      (double)(h->host[1] - h->host[0]) / (double)(h->tick[1] - h->tick[0]);
+  return h->host[0] +
+         (uint64_t)(int64_t)(((int64_t)ts - h->tick[0]) * ns_per_tick);
+}
+
+uint64_t hwts_ticks_to_ns(const struct HwTs *h, uint64_t ticks) {
+  if (h->wallclock)
+    return ticks;
+  return h->khz ? (uint64_t)(ticks * 1e6 / h->khz) : 0;
+}
+
+void hwts_poll(struct HwTs *h, struct ibv_wc *wc, uint64_t *ts) {
+  *ts = 0;
+  if (!h->cqx) {
+    int n;
+    while (!(n = ibv_poll_cq(h->cq, 1, wc)))
+      ;
+    if (n < 0)
+      die("poll_cq");
+    return;
+  }
+  struct ibv_poll_cq_attr pa = {0};
+  int rc;
+  while ((rc = ibv_start_poll(h->cqx, &pa)) == ENOENT)
+    ;
+  if (rc)
+    die("start_poll");
+  memset(wc, 0, sizeof(*wc));
+  wc->wr_id = h->cqx->wr_id;
+  wc->status = h->cqx->status;
+  wc->opcode = ibv_wc_read_opcode(h->cqx);
+  *ts = h->wallclock ? ibv_wc_read_completion_wallclock_ns(h->cqx)
+                     : ibv_wc_read_completion_ts(h->cqx);
+  ibv_end_poll(h->cqx);
+}
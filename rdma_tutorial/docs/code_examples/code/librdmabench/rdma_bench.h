@@ -0,0 +1,537 @@
+// rdma_bench.h: the benchmark core shared by the bench_* programs and the
+// RC examples, built as librdmabench.
+//
+// - verbs.c:  die(), clocks and device setup; see rdma_verbs.h.
+// - util.c:   modes, sizes and CRC32C.
+// - conn.c:   rdma_cm connection setup, READ depth and transport timers.
+// - buffer.c: registered buffers on host, hugepage or caller memory.
+// - engine.c: WR and completion helpers, the hook-driven post/poll engine
+//             (run_ops) with its closed loop, and the bidir and chunked
+//             engines.
+// - stats.c:  rates, percentiles, NIC port counters and CPU usage.
+// - sock.c:   the same closed loop over TCP, for --transport baselines.
+// - hwts.c:   NIC completion timestamps and their clock conversion.
+// - workload.c: mixed-op workload specs and their arrival processes.
+// - trace.c:  binary op traces for --replay.
+#ifndef RDMA_BENCH_H
+#define RDMA_BENCH_H
+
+#include "rdma_verbs.h"
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(RDMA_PROF) && defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sent by the server as connect private data: where the client may READ or
+// WRITE, and how many bytes. `slot` is the size of each posted receive,
+// which bounds a SEND or write_imm (0: none are posted).
+struct Info {
+  uint64_t addr;
+  uint32_t rkey, len, slot;
+} __attribute__((packed));
+
+enum Mode { MODE_READ, MODE_WRITE, MODE_SEND, MODE_WRITE_IMM };
+
+// Per-direction result each side sends to its peer at the end of a --bidir
+// run, so both ends can report what they received as well as what they sent.
+struct BidirStats {
+  uint64_t ops, bytes, nsec;
+} __attribute__((packed));
+
+#define STATS_WRID UINT64_MAX
+#define STATS_IMM 0x53544154u
+
+// Stamped at the front of each verified message. The CRC32C covers this
+// header (with crc = 0) and the payload that follows it.
+struct VerifyHdr {
+  uint32_t magic, crc;
+  uint64_t seq;
+} __attribute__((packed));
+
+#define VERIFY_MAGIC 0x56455246u
+#define VERIFY_SAMPLE_EVERY 64 // --verify sample stamps one message in 64
+
+// --credits: the server grants receive credits in zero-length
+// SEND_WITH_IMM messages (imm = count); the client keeps CREDIT_RECVS
+// receives posted for them.
+#define CREDIT_RECVS 32
+#define CREDIT_WRID (UINT64_MAX - 1) // the server's updates
+
+// A multi-rail bench_client connects over up to RAILS_MAX devices, one
+// server address each.
+#define RAILS_MAX 16
+
+// util.c
+const char *mode_str(enum Mode mode);
+// Parse read|write|send|write_imm; returns -1 for anything else.
+int mode_parse(const char *s, enum Mode *mode);
+// Parse a byte count with an optional binary K, M or G suffix ("1G" is
+// 2^30); returns -1 for anything else.
+int size_parse(const char *s, uint64_t *v);
+
+// CRC32C: the SSE4.2 instruction when the CPU has it, a table otherwise.
+// crc32c_select() must run first; it returns the implementation picked.
+extern uint32_t (*crc32c)(uint32_t crc, const void *p, size_t n);
+const char *crc32c_select(void);
+
+// conn.c
+// Resolve `ip`:`port` (restricted to `family` unless AF_UNSPEC) on a new
+// cm_id, ready for rdma_create_qp() and rdma_connect().
+struct rdma_cm_id *rb_resolve(struct rdma_event_channel *ec, const char *ip,
+                              int port, int family);
+// Listen on `ip`:`port` with room for `backlog` pending connects; a NULL
+// `ip` listens on every IPv4 address.
+struct rdma_cm_id *rb_listen(struct rdma_event_channel *ec, const char *ip,
+                             int port, int backlog);
+// Wait for the next event, which must be `type`. Copies up to `len` bytes
+// of its private data into `priv` when given, and returns the event's id.
+struct rdma_cm_id *rb_expect(struct rdma_event_channel *ec,
+                             enum rdma_cm_event_type type, void *priv,
+                             size_t len);
+
+// Outstanding RDMA READ/atomic depth to request: the device limits, capped
+// by `want` when > 0. rdma_conn_param only carries 8 bits.
+void rd_atomic_limits(struct ibv_context *ctx, int want, uint8_t *initiator,
+                      uint8_t *responder);
+// Wait for a CONNECT_REQUEST and set p's READ depths for accepting it:
+// rd_atomic_limits(`want`) on its device, capped by what the peer asked
+// for. Returns the request's id.
+struct rdma_cm_id *rb_expect_request(struct rdma_event_channel *ec, int want,
+                                     struct rdma_conn_param *p);
+// Print what the connection actually negotiated and return the initiator
+// depth, which is the cap on READs in flight per QP.
+uint8_t report_rd_atomic(struct ibv_qp *qp, const char *who);
+
+// Transport timers in their IB encodings; -1 keeps what rdma_cm sets up.
+// timeout: local ACK timeout, 4.096 us * 2^N. retry_cnt / rnr_retry:
+// retransmissions before IBV_WC_RETRY_EXC_ERR / IBV_WC_RNR_RETRY_EXC_ERR
+// (rnr_retry 7 retries forever). min_rnr_timer: how long (encoded 0-31)
+// our RNR NAKs ask the peer to back off.
+struct Timers {
+  int timeout, retry_cnt, rnr_retry, min_rnr_timer;
+};
+
+// Before connect/accept: the ACK timeout is a cm_id option.
+void timers_set_id(struct rdma_cm_id *id, const struct Timers *t);
+void timers_set_param(struct rdma_conn_param *p, const struct Timers *t);
+// Once established: rdma_cm does not carry min_rnr_timer, but RTS->RTS may
+// change it. Prints what the QP ended up with when `who` is set.
+void timers_set_qp(struct ibv_qp *qp, const struct Timers *t,
+                   const char *who);
+
+// buffer.c
+enum BufBackend {
+  BUF_HOST,     // page-aligned malloc
+  BUF_HUGE,     // 2 MiB hugepages, falling back to BUF_HOST
+  BUF_EXTERNAL, // memory the caller owns, e.g. from hipMalloc
+};
+
+struct Buf {
+  char *base;
+  size_t len;
+  struct ibv_mr *mr;
+  enum BufBackend backend;
+};
+
+// Allocate `len` bytes from `backend` (not BUF_EXTERNAL), zero them and
+// register them with `access`.
+void buf_alloc(struct Buf *b, struct ibv_pd *pd, size_t len, int access,
+               enum BufBackend backend);
+// Register caller-owned memory; buf_free() only deregisters it.
+void buf_wrap(struct Buf *b, struct ibv_pd *pd, void *p, size_t len,
+              int access);
+void buf_free(struct Buf *b);
+
+// engine.c
+void post_recv_slot(struct rdma_cm_id *id, char *buf, struct ibv_mr *mr,
+                    size_t msg, int slot);
+
+// The shared WR setup and completion check of every loop below and in
+// bench_client. wr_init() fills `wr` for signaled ops of `mode` reading
+// or writing the one SGE `s`, aimed at the start of `remote` (NULL for
+// SEND); per op the caller sets wr_id and the SGE, and wr_set_offset()
+// moves READ/WRITE/write_imm to `off` bytes into `remote` (write_imm
+// also carries `off` as its immediate).
+enum ibv_wr_opcode mode_opcode(enum Mode mode);
+void wr_init(struct ibv_send_wr *wr, struct ibv_sge *s, enum Mode mode,
+             const struct Info *remote);
+void wr_set_offset(struct ibv_send_wr *wr, const struct Info *remote,
+                   uint64_t off);
+// Print a failed completion; wc_die() then exits.
+void wc_report(const struct ibv_wc *wc);
+void wc_die(const struct ibv_wc *wc);
+// ibv_poll_cq() for up to `max` completions, exiting through wc_die() on
+// any failed one. Returns how many arrived.
+int poll_cq_ok(struct ibv_cq *cq, int max, struct ibv_wc *wc);
+// --credits: return `n` reposted receives to the client in a zero-length
+// SEND_WITH_IMM (imm = n), reaping earlier updates first.
+void grant_credits(struct rdma_cm_id *id, uint32_t n);
+
+// The post/poll engine under run_closed_loop() and bench_client's
+// one-directional loops (run_bidir() also drains receives, and run_xfer()
+// keeps a window per QP): keep up to `window` ops in flight until `iters`
+// have completed. Ops come from next(), which picks each op's class,
+// buffer and QP, and returns nonzero to hold op i back (not yet due, no
+// credit); the engine then polls and asks again. With `lat` set the
+// engine reads the clock once per poll, passes next() the ns since the
+// start as `now` (0 otherwise) and stores each op's completion time less
+// its `due` in lat[i]. With signal_every > 1 (one QP only; see
+// signal_interval()) only every signal_every-th op and the last are
+// signaled.
+struct WrOp {
+  enum Mode mode;
+  int qp; // index into OpLoop.qp
+  uint32_t len;
+  const char *src; // within the buffer of OpLoop.lkey
+  uint64_t offset; // into `remote`; write_imm also carries it as imm
+  uint64_t due;    // ns from the start, for `lat`
+};
+
+struct OpLoop {
+  struct ibv_qp **qp;
+  struct ibv_cq *cq; // send CQ of every QP
+  const struct Info *remote;
+  uint32_t lkey;
+  uint64_t iters, window, signal_every;
+  int (*next)(void *arg, uint64_t i, uint64_t now, struct WrOp *op);
+  // Optional: post op i instead of ibv_post_send() (--post-api ex).
+  void (*post)(void *arg, uint64_t i, const struct WrOp *op, int signaled);
+  // Optional: reap up to `max` completions instead of ibv_poll_cq().
+  int (*poll)(void *arg, int max, struct ibv_wc *wc);
+  void *arg;         // passed to the hooks
+  uint64_t *lat;     // optional, `iters` long
+  struct Prof *prof; // optional
+};
+
+// Failed completions counted by run_ops().
+struct OpErrors {
+  uint64_t rnr_exc, retry_exc, flushed;
+};
+
+// What a run did, for the rate helpers in stats.c.
+struct Stats {
+  uint64_t ops, bytes, ns;
+};
+
+// The signaling interval of run_ops(): `every` (0 means 1), at most the
+// window. A window of unsignaled ops would never see a completion.
+static inline uint64_t signal_interval(uint64_t every, uint64_t window) {
+  if (!every)
+    every = 1;
+  return every < window ? every : window;
+}
+
+// Fills `st` with the ops that succeeded and the bytes posted. Any failed
+// completion exits through wc_die() unless `err` is set; then
+// retry-exceeded and flushed ones are counted instead, posting stops (the
+// QP is in error), the ops in flight are drained and -1 is returned.
+int run_ops(const struct OpLoop *l, struct Stats *st, struct OpErrors *err);
+
+// One closed-loop run_ops(): every op sends `msg` bytes from the start of
+// `src`, and READ/WRITE target the start of `remote`.
+struct Loop {
+  enum Mode mode;
+  size_t msg;
+  uint64_t iters, window, signal_every;
+  const struct Buf *src;
+  const struct Info *remote;
+};
+
+void run_closed_loop(struct ibv_qp *qp, struct ibv_cq *cq,
+                     const struct Loop *l, struct Stats *st);
+// One chunked transfer: `len` bytes at `local`, READ into it or WRITTEN
+// from it, as `chunk`-sized WRs (the last may be shorter). Chunks are
+// dealt round-robin to the QPs that have fewer than `window` of them in
+// flight, so a slow QP takes fewer. The remote offset is the local one,
+// wrapped to a whole number of chunks of the peer's buffer, so a transfer
+// may be larger than it. Returns once every chunk has completed.
+struct Xfer {
+  enum Mode mode; // MODE_READ or MODE_WRITE
+  uint64_t len, chunk, window;
+  char *local;
+};
+
+// One rail: `nqp` QPs on one device, completing on `cq` (room for
+// nqp * window CQEs), with that device's lkey for the local buffer and the
+// peer's buffer as registered on the other end. run_xfer() adds the
+// payload the rail carried to `bytes`. With several rails every rail has
+// the same nqp, and consecutive chunks go to different rails.
+struct XferRail {
+  struct ibv_qp **qp;
+  int nqp;
+  struct ibv_cq *cq;
+  uint32_t lkey;
+  struct Info remote;
+  uint64_t bytes;
+};
+
+void run_xfer(struct XferRail *rail, int nrail, const struct Xfer *x,
+              struct Stats *st);
+// Receive side of a SEND run: `depth` msg-sized slots of `buf` are already
+// posted; reap `iters` receives, reposting each slot as it completes.
+// With credit_batch > 0, every credit_batch reposts are granted back.
+void run_recv_loop(struct rdma_cm_id *id, const struct Buf *buf, size_t msg,
+                   uint64_t iters, int credit_batch, struct Stats *st);
+
+// Full-duplex loop run by both endpoints at once. `buf` holds recv_depth
+// receive slots followed by one msg-sized TX slot; the peer targets slot 0
+// for READ/WRITE, and peer->len covers its receive ring. We keep `window`
+// of our own ops in flight (for send and write_imm, at most the peer's
+// ring) while draining the peer's traffic, then swap BidirStats
+// (SEND_WITH_IMM) so each side can report both directions.
+void run_bidir(struct rdma_cm_id *id, struct ibv_cq *cq, enum Mode mode,
+               char *buf, struct ibv_mr *mr, size_t msg, int recv_depth,
+               uint64_t iters, uint64_t window, const struct Info *peer,
+               const char *who);
+
+// sock.c
+// --transport: RDMA verbs, or a kernel TCP socket over the same loop for a
+// baseline: plain send()/recv(), MSG_ZEROCOPY sends, or io_uring.
+enum Transport {
+  TRANSPORT_RDMA,
+  TRANSPORT_TCP,
+  TRANSPORT_TCP_ZEROCOPY,
+  TRANSPORT_IO_URING,
+};
+
+const char *transport_str(enum Transport t);
+int transport_parse(const char *s, enum Transport *t);
+
+// One socket run. The client keeps `window` messages (READ: requests)
+// unacknowledged until `iters` have completed; the server takes its own
+// --msg as the largest message it accepts and learns the rest from the
+// client.
+struct SockRun {
+  enum Transport transport;
+  enum Mode mode;
+  size_t msg;
+  uint64_t iters, window;
+};
+
+// Both return the exit status for main().
+int sock_run_client(const char *ip, int port, const struct SockRun *r);
+int sock_run_server(int port, const struct SockRun *r);
+
+// hwts.c
+// A CQ whose completions carry the NIC's timestamp, when the device can:
+// CLOCK_REALTIME ns (wallclock), or else raw device clock ticks mapped to
+// CLOCK_MONOTONIC through two ibv_query_rt_values_ex() samples taken at
+// the start and end of a run. Without either it is a plain CQ.
+struct HwTs {
+  struct ibv_context *ctx;
+  struct ibv_cq_ex *cqx; // NULL: no timestamps
+  struct ibv_cq *cq;     // for rdma_create_qp()
+  int wallclock;
+  uint64_t khz; // raw clock rate (hca_core_clock)
+  int64_t tick[2];
+  uint64_t host[2];
+};
+
+// Create the CQ with `cqe` entries and print which timestamps it has.
+// ibv_destroy_cq(h->cq) frees it.
+void hwts_create_cq(struct HwTs *h, struct ibv_context *ctx, int cqe,
+                    const char *who);
+// Now, on the host clock timestamps are comparable with.
+uint64_t hwts_host_ns(const struct HwTs *h);
+// Pair the raw clock with the host clock: i = 0 before a run, 1 after.
+void hwts_sync(struct HwTs *h, int i);
+// Whether hwts_to_host() can place timestamps on the host clock.
+int hwts_mapped(const struct HwTs *h);
+uint64_t hwts_to_host(const struct HwTs *h, uint64_t ts);
+// A timestamp difference in ns, from the nominal clock rate; 0 if unknown.
+uint64_t hwts_ticks_to_ns(const struct HwTs *h, uint64_t ticks);
+// Spin for one completion; `ts` is its timestamp, or 0 without them.
+void hwts_poll(struct HwTs *h, struct ibv_wc *wc, uint64_t *ts);
+
+// workload.c
+// A --workload spec: op classes, each with a weight, an op and a size
+// distribution, and one arrival process. One item per line, or ';'
+// between items on the command line:
+//   closed | poisson RATE | onoff RATE ON_US OFF_US   (RATE in Mops)
+//   WEIGHT[%] read|write|send|write_imm SIZE|uniform:LO:HI|cdf:S=P,...
+#define WL_CLASSES 16
+#define WL_CDF 32
+
+enum SizeDist { SIZE_FIXED, SIZE_UNIFORM, SIZE_CDF };
+enum Arrival { ARRIVAL_CLOSED, ARRIVAL_POISSON, ARRIVAL_ONOFF };
+
+struct WlClass {
+  enum Mode mode;
+  double weight, share, cum; // as given, normalized, cumulative
+  enum SizeDist dist;
+  uint64_t lo, hi; // fixed: lo; uniform: lo-hi
+  int ncdf;        // cdf: size cdf_size[i] up to cumulative cdf_p[i]
+  uint64_t cdf_size[WL_CDF];
+  double cdf_p[WL_CDF];
+  char name[48]; // op and size as written, for reports
+};
+
+struct Workload {
+  enum Arrival arrival;
+  double rate;            // ops/s (poisson; onoff while on)
+  uint64_t on_ns, off_ns; // onoff
+  int n;
+  struct WlClass cls[WL_CLASSES];
+  uint64_t max_size;
+  uint64_t max_recv; // largest send or write_imm, 0 if none
+  uint64_t rng;      // fixed seed: runs draw the same sequence
+};
+
+// Parse `spec`, the name of a file holding one, or the spec itself.
+// Prints the offending line and returns -1 on error.
+int wl_parse(struct Workload *w, const char *spec);
+// Draw the next op: returns its class and sets its size.
+int wl_next(struct Workload *w, uint64_t *size);
+// Open arrivals: the time (ns from the start) of the arrival after `t`.
+uint64_t wl_arrival(struct Workload *w, uint64_t t);
+void wl_print(const struct Workload *w, const char *who);
+
+// trace.c
+// A --replay trace: a TraceHdr, then `count` TraceRecs sorted by time,
+// all fields little-endian. trace_convert writes one from CSV.
+#define TRACE_MAGIC "RBTRACE1"
+
+struct TraceHdr {
+  char magic[8];
+  uint64_t count;
+} __attribute__((packed));
+
+struct TraceRec {
+  uint64_t t_ns;   // issue time, from the first op
+  uint64_t offset; // into the target's buffer
+  uint32_t size;
+  uint16_t qp;  // connection index
+  uint8_t mode; // enum Mode
+  uint8_t pad;
+} __attribute__((packed));
+
+struct Trace {
+  struct TraceRec *rec;
+  uint64_t n;
+  uint64_t max_size;
+  uint64_t max_recv; // largest send or write_imm, 0 if none
+  int nqp;           // highest qp index + 1
+  int two_sided;     // has send or write_imm ops
+  uint64_t ops[4];   // per enum Mode
+};
+
+// Read and check a whole trace. Prints why and returns -1 if the file is
+// not a valid trace.
+int trace_load(const char *path, struct Trace *t);
+int trace_save(const char *path, const struct TraceRec *rec, uint64_t n);
+void trace_print(const struct Trace *t, const char *who);
+
+// stats.c
+double stats_mops(const struct Stats *st);
+double stats_gibs(const struct Stats *st);
+// Value at fraction `q` (0-1) of `n` sorted samples.
+uint64_t percentile(const uint64_t *sorted, uint64_t n, double q);
+
+// Port-wide counters from sysfs: wire bytes and packets, RNR NAKs
+// (rnr_nak_retry_err as requester, out_of_buffer as responder),
+// retransmission signs (ACK timeouts, sequence errors, duplicates) and
+// congestion signs (CNPs, ECN marks, transmit wait and discards). Counters
+// the driver does not expose read as -1.
+#define HW_COUNTERS 16
+enum { HW_TX_DATA, HW_RX_DATA, HW_TX_PKTS, HW_RX_PKTS };
+void hw_counters_read(struct rdma_cm_id *id, long long *v);
+// Print the deltas between two snapshots and which of RNR, retransmission
+// and congestion they point at. With `app`, also compare the wire rate
+// with the application's, whose payload flowed in (`rx`) or out.
+void hw_counters_report(const char *who, const long long *before,
+                        const long long *after, const struct Stats *app,
+                        int rx);
+
+// CPU this process spent over a run, for cycles-per-byte comparisons
+// between transports: user and system time from getrusage(), and CPU
+// cycles from perf_event_open() when the kernel lets us count them
+// (user-only under perf_event_paranoid 2, cycles = -1 without a PMU).
+// cpu_usage_stop() turns the start snapshot into deltas.
+struct CpuUsage {
+  uint64_t user_ns, sys_ns, wall_ns;
+  long long cycles;
+  int fd, user_only;
+};
+
+void cpu_usage_start(struct CpuUsage *c);
+void cpu_usage_stop(struct CpuUsage *c);
+void cpu_usage_report(const char *who, const struct CpuUsage *c,
+                      uint64_t bytes);
+
+// Hot-path profile of a post/poll loop: ticks spent in post calls, in
+// polls that returned completions and in empty polls, the spread of
+// completions per poll, and perf cycles and instructions per op. Only
+// built with -DRDMA_PROF (cmake -DRDMA_PROF=ON); otherwise the hooks are
+// empty inlines and the prof_* functions do nothing.
+#define PROF_HIST 33 // completions per poll, 0-32
+
+struct Prof {
+  uint64_t post, hit, empty;     // ticks
+  uint64_t posts, hits, empties; // calls
+  uint64_t hist[PROF_HIST];
+  uint64_t t0, ns0;  // at prof_start(); elapsed after prof_stop()
+  long long perf[2]; // cycles, instructions; -1 if unavailable
+  int fd[2], user_only;
+};
+
+void prof_start(struct Prof *p);
+void prof_stop(struct Prof *p);
+// Print the breakdown between prof_start() and prof_stop(), over `ops`.
+void prof_report(const char *who, const struct Prof *p, uint64_t ops);
+
+static inline uint64_t prof_ticks(void) {
+#if !defined(RDMA_PROF)
+  return 0;
+#elif defined(__x86_64__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t v;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+  return now_ns();
+#endif
+}
+
+// After a post call that started at tick `t0`.
+static inline void prof_post(struct Prof *p, uint64_t t0) {
+#ifdef RDMA_PROF
+  p->post += prof_ticks() - t0;
+  p->posts++;
+#else
+  (void)p;
+  (void)t0;
+#endif
+}
+
+// After a poll that started at tick `t0` and returned `n`.
+static inline void prof_poll(struct Prof *p, uint64_t t0, int n) {
+#ifdef RDMA_PROF
+  uint64_t d = prof_ticks() - t0;
+  if (n > 0) {
+    p->hit += d;
+    p->hits++;
+  } else {
+    p->empty += d;
+    p->empties++;
+  }
+  p->hist[n < 0 ? 0 : n < PROF_HIST ? n : PROF_HIST - 1]++;
+#else
+  (void)p;
+  (void)t0;
+  (void)n;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+// rdma_verbs.h: the part of librdmabench that needs only libibverbs, for
+// the examples that bring their QPs up over a TCP side channel instead of
+// rdma_cm (ud_bench, transport, ud_rpc). rdma_bench.h includes it.
+//
+// - verbs.c: die(), clocks, device opening and UD QP bring-up.
+#ifndef RDMA_VERBS_H
+#define RDMA_VERBS_H
+
+#include <infiniband/verbs.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+__attribute__((noreturn)) void die(const char *m);
+uint64_t now_ns(void);
+int cmp_u64(const void *a, const void *b);
+
+// Open the device called `name`, or the first one when NULL.
+struct ibv_context *open_device(const char *name);
+// The active MTU of `port` in bytes: the largest UD message it carries.
+uint32_t port_mtu(struct ibv_context *ctx, uint8_t port);
+// Take a fresh UD QP through INIT, RTR and RTS on `port`. Its peers send to
+// it with `qkey`.
+void ud_qp_ready(struct ibv_qp *qp, uint8_t port, uint32_t qkey);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
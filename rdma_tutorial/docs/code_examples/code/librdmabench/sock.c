@@ -0,0 +1,537 @@
+// --transport tcp|tcp-zerocopy|io_uring: the closed loop of engine.c over a
+// kernel TCP socket, so a verbs run can be compared with what the socket
+// stack does on the same host.
+//
+// WRITE, WRITE_IMM and SEND stream msg-byte messages to the server, which
+// acknowledges with cumulative 8-byte counts after every recv(). READ sends
+// 8-byte requests, each answered with msg bytes. Either way the client keeps
+// at most `window` messages unacknowledged, as it keeps `window` WRs in
+// flight on a QP.
+#define _GNU_SOURCE
+#include "rdma_bench.h"
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SOCK_BATCH 256 // acks / READ requests taken per recv()
+
+// The client's first message, in place of the connect private data. The
+// server answers with its --msg as a uint32, or 0 to refuse the run.
+struct SockHello {
+  uint32_t mode, transport;
+  uint64_t msg, iters, window;
+} __attribute__((packed));
+
+static const char *const transport_names[] = {"rdma", "tcp", "tcp-zerocopy",
+                                              "io_uring"};
+
+const char *transport_str(enum Transport t) { return transport_names[t]; }
+
+int transport_parse(const char *s, enum Transport *t) {
+  for (int i = TRANSPORT_RDMA; i <= TRANSPORT_IO_URING; ++i)
+    if (!strcmp(s, transport_names[i])) {
+      *t = (enum Transport)i;
+      return 0;
+    }
+  return -1;
+}
+
+// A raw-syscall io_uring: liburing is not a dependency of this repo, and
+// the loop only needs SEND and RECV.
+struct Uring {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned entries, tail, pending;
+};
+
+static void uring_init(struct Uring *u, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(u, 0, sizeof(*u));
+  u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0)
+    die("io_uring_setup");
+  size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && cq_len > sq_len)
+    sq_len = cq_len;
+  char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  char *cq = single ? sq
+                    : mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, u->fd,
+                           IORING_OFF_CQ_RING);
+  u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                 IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || u->sqes == MAP_FAILED)
+    die("mmap io_uring");
+  u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + p.sq_off.array);
+  u->cq_head = (unsigned *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  u->entries = p.sq_entries;
+  u->tail = *u->sq_tail;
+}
+
+// Queue an SQE; the kernel sees it at the next uring_enter().
+static struct io_uring_sqe *uring_sqe(struct Uring *u) {
+  unsigned i = u->tail++ & *u->sq_mask;
+  u->sq_array[i] = i;
+  struct io_uring_sqe *s = &u->sqes[i];
+  memset(s, 0, sizeof(*s));
+  return s;
+}
+
+// Submit everything queued and wait for `wait` completions, in one
+// syscall.
+static void uring_enter(struct Uring *u, unsigned wait) {
+  u->pending += u->tail - *u->sq_tail;
+  __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+  for (;;) {
+    int r = (int)syscall(__NR_io_uring_enter, u->fd, u->pending, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (r >= 0) {
+      u->pending -= (unsigned)r;
+      return;
+    }
+    if (errno != EINTR)
+      die("io_uring_enter");
+  }
+}
+
+// One end of a connection and the state its transport needs.
+struct SockIo {
+  enum Transport t;
+  int fd;
+  // MSG_ZEROCOPY: sends issued, sends whose pages the kernel has released,
+  // and how many of those it copied anyway (SO_EE_CODE_ZEROCOPY_COPIED).
+  uint64_t zc_sent, zc_done, zc_copied;
+  // io_uring: SENDs in flight, and the one RECV (user_data 0) if posted.
+  struct Uring u;
+  unsigned sends;
+  int recv_busy, recv_res;
+};
+
+// Take MSG_ZEROCOPY completions off the socket's error queue. Each one
+// covers a range of send() calls; with `block` wait until all are in.
+static void zc_reap(struct SockIo *io, int block) {
+  while (io->zc_done < io->zc_sent) {
+    char ctl[128];
+    struct msghdr mh = {0};
+    mh.msg_control = ctl;
+    mh.msg_controllen = sizeof(ctl);
+    if (recvmsg(io->fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno != EAGAIN && errno != EINTR)
+        die("recvmsg(MSG_ERRQUEUE)");
+      if (!block)
+        return;
+      // A non-empty error queue raises POLLERR.
+      struct pollfd p = {io->fd, 0, 0};
+      poll(&p, 1, -1);
+      continue;
+    }
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm;
+         cm = CMSG_NXTHDR(&mh, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      struct sock_extended_err *ee = (void *)CMSG_DATA(cm);
+      if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      uint64_t n = (uint64_t)(ee->ee_data - ee->ee_info) + 1;
+      io->zc_done += n;
+      if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        io->zc_copied += n;
+    }
+  }
+}
+
+static void send_all(struct SockIo *io, const char *p, size_t len, int zc) {
+  while (len) {
+    ssize_t n = send(io->fd, p, len, zc ? MSG_ZEROCOPY : 0);
+    if (n < 0) {
+      // ENOBUFS: too many zerocopy sends pinned (optmem_max).
+      if (zc && errno == ENOBUFS)
+        zc_reap(io, 1);
+      else if (errno != EINTR)
+        die("send");
+      continue;
+    }
+    if (zc)
+      io->zc_sent++;
+    p += n;
+    len -= (size_t)n;
+  }
+}
+
+// Reap io_uring completions, waiting for at least one.
+static void uring_wait(struct SockIo *io) {
+  struct Uring *u = &io->u;
+  uring_enter(u, 1);
+  unsigned head = *u->cq_head;
+  unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    struct io_uring_cqe *c = &u->cqes[head & *u->cq_mask];
+    if (!c->user_data) {
+      io->recv_busy = 0;
+      io->recv_res = c->res;
+      continue;
+    }
+    io->sends--;
+    if (c->res != (int)c->user_data) {
+      fprintf(stderr, "io_uring send: %s\n",
+              c->res < 0 ? strerror(-c->res) : "short send");
+      exit(1);
+    }
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Send `count` messages of `len` bytes from `p`. Only `payload` sends use
+// MSG_ZEROCOPY; acks and READ requests are a few bytes. io_uring queues
+// them as one linked chain, submitted with the next sock_recv(), and a new
+// chain waits for the last so the byte stream stays in order.
+static void sock_send(struct SockIo *io, const void *p, size_t len,
+                      uint64_t count, int payload) {
+  if (io->t != TRANSPORT_IO_URING) {
+    int zc = payload && io->t == TRANSPORT_TCP_ZEROCOPY;
+    for (uint64_t i = 0; i < count; ++i)
+      send_all(io, p, len, zc);
+    if (zc)
+      zc_reap(io, 0);
+    return;
+  }
+  while (count) {
+    while (io->sends)
+      uring_wait(io);
+    // Leave a slot for the RECV.
+    uint64_t k = count < io->u.entries - 1 ? count : io->u.entries - 1;
+    for (uint64_t i = 0; i < k; ++i) {
+      struct io_uring_sqe *s = uring_sqe(&io->u);
+      s->opcode = IORING_OP_SEND;
+      s->fd = io->fd;
+      s->addr = (uint64_t)(uintptr_t)p;
+      s->len = (uint32_t)len;
+      s->msg_flags = MSG_WAITALL;
+      s->user_data = len;
+      if (i + 1 < k)
+        s->flags = IOSQE_IO_LINK;
+    }
+    io->sends += (unsigned)k;
+    count -= k;
+    if (count)
+      uring_enter(&io->u, 0);
+  }
+}
+
+// Block until some bytes arrive; returns how many. The peer closing first
+// is an error: every run ends with a message the other side waits for.
+static size_t sock_recv(struct SockIo *io, void *p, size_t cap) {
+  ssize_t n;
+  if (io->t == TRANSPORT_IO_URING) {
+    if (!io->recv_busy) {
+      struct io_uring_sqe *s = uring_sqe(&io->u);
+      s->opcode = IORING_OP_RECV;
+      s->fd = io->fd;
+      s->addr = (uint64_t)(uintptr_t)p;
+      s->len = (uint32_t)cap;
+      io->recv_busy = 1;
+    }
+    while (io->recv_busy)
+      uring_wait(io);
+    n = io->recv_res;
+    if (n < 0) {
+      errno = (int)-n;
+      die("io_uring recv");
+    }
+  } else {
+    while ((n = recv(io->fd, p, cap, 0)) < 0)
+      if (errno != EINTR)
+        die("recv");
+  }
+  if (!n) {
+    fprintf(stderr, "peer closed the connection\n");
+    exit(1);
+  }
+  return (size_t)n;
+}
+
+// Wait for every send we issued to be done with its buffer.
+static void sock_flush(struct SockIo *io) {
+  if (io->t == TRANSPORT_IO_URING)
+    while (io->sends)
+      uring_wait(io);
+  else if (io->t == TRANSPORT_TCP_ZEROCOPY)
+    zc_reap(io, 1);
+}
+
+static void sock_setup(struct SockIo *io, enum Transport t, int fd,
+                       uint64_t window) {
+  memset(io, 0, sizeof(*io));
+  io->t = t;
+  io->fd = fd;
+  // Acks and READ requests are tiny; Nagle would hold them back.
+  int one = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+    die("TCP_NODELAY");
+  if (t == TRANSPORT_TCP_ZEROCOPY &&
+      setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+    die("SO_ZEROCOPY");
+  if (t == TRANSPORT_IO_URING) {
+    // A whole window of SENDs plus the RECV fits in one submission.
+    unsigned entries = 2;
+    while (entries < window + 1 && entries < 32768)
+      entries <<= 1;
+    uring_init(&io->u, entries);
+  }
+}
+
+static void sock_close(struct SockIo *io) {
+  if (io->t == TRANSPORT_IO_URING)
+    close(io->u.fd);
+  close(io->fd);
+}
+
+static void zc_report(const char *who, const struct SockIo *io) {
+  if (io->t != TRANSPORT_TCP_ZEROCOPY || !io->zc_sent)
+    return;
+  // Loopback and some drivers always copy; the kernel says so per send.
+  printf("[%s] zerocopy: %lu sends, %lu copied by the kernel\n", who,
+         (unsigned long)io->zc_sent, (unsigned long)io->zc_copied);
+}
+
+// Room for a batch of messages per recv(), capped for large messages.
+static size_t batch_len(size_t msg) {
+  size_t cap = (size_t)4 << 20;
+  if (msg >= cap)
+    return msg;
+  return msg * SOCK_BATCH < cap ? msg * SOCK_BATCH : cap / msg * msg;
+}
+
+static void *payload_alloc(size_t len) {
+  char *p = malloc(len);
+  if (!p)
+    die("malloc");
+  memset(p, 0xab, len);
+  return p;
+}
+
+int sock_run_client(const char *ip, int port, const struct SockRun *r) {
+  struct addrinfo hints = {0}, *res;
+  char svc[16];
+  snprintf(svc, sizeof(svc), "%d", port);
+  hints.ai_socktype = SOCK_STREAM;
+  int rc = getaddrinfo(ip, svc, &hints, &res);
+  if (rc) {
+    fprintf(stderr, "getaddrinfo %s: %s\n", ip, gai_strerror(rc));
+    return 1;
+  }
+  int fd = socket(res->ai_family, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen))
+    die("connect");
+  freeaddrinfo(res);
+
+  struct SockIo io;
+  sock_setup(&io, r->transport, fd, r->window);
+  struct SockHello hello = {r->mode, r->transport, r->msg, r->iters,
+                            r->window};
+  uint32_t server_msg;
+  send_all(&io, (const char *)&hello, sizeof(hello), 0);
+  if (recv(fd, &server_msg, sizeof(server_msg), MSG_WAITALL) !=
+          (ssize_t)sizeof(server_msg) ||
+      !server_msg) {
+    fprintf(stderr, "server refused the run; check --mode and --transport\n");
+    return 1;
+  }
+  if (server_msg < r->msg) {
+    fprintf(stderr, "server buffer too small (%u < %zu)\n", server_msg,
+            r->msg);
+    return 1;
+  }
+
+  int rd = r->mode == MODE_READ;
+  size_t buf_len = rd ? batch_len(r->msg) : r->msg;
+  char *buf = payload_alloc(buf_len);
+  // Acks are cumulative; `have` carries a word split across recv()s.
+  char acks[8 * SOCK_BATCH];
+  size_t have = 0;
+  uint64_t req = 0, posted = 0, done = 0, rx = 0;
+  struct CpuUsage cpu;
+  cpu_usage_start(&cpu);
+  uint64_t t0 = now_ns();
+  while (done < r->iters) {
+    uint64_t k = r->window - (posted - done);
+    if (k > r->iters - posted)
+      k = r->iters - posted;
+    if (k) {
+      if (rd)
+        sock_send(&io, &req, sizeof(req), k, 0);
+      else
+        sock_send(&io, buf, r->msg, k, 1);
+      posted += k;
+    }
+    if (rd) {
+      rx += sock_recv(&io, buf, buf_len);
+      done = rx / r->msg;
+      continue;
+    }
+    have += sock_recv(&io, acks + have, sizeof(acks) - have);
+    size_t words = have / 8;
+    if (words)
+      memcpy(&done, acks + (words - 1) * 8, sizeof(done));
+    memmove(acks, acks + words * 8, have % 8);
+    have %= 8;
+  }
+  uint64_t ns = now_ns() - t0;
+  sock_flush(&io);
+  cpu_usage_stop(&cpu);
+
+  struct Stats st = {r->iters, r->iters * r->msg, ns};
+  printf("[client] %s done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, "
+         "window=%lu, transport=%s)\n",
+         mode_str(r->mode), stats_mops(&st), stats_gibs(&st), r->msg,
+         (unsigned long)r->window, transport_str(r->transport));
+  zc_report("client", &io);
+  cpu_usage_report("client", &cpu, st.bytes);
+
+  sock_close(&io);
+  free(buf);
+  return 0;
+}
+
+// Listen on every address, IPv6 and IPv4 alike when the host has IPv6.
+static int sock_listen(int port) {
+  int one = 1, zero = 0;
+  int ls = socket(AF_INET6, SOCK_STREAM, 0);
+  if (ls >= 0) {
+    struct sockaddr_in6 a = {0};
+    a.sin6_family = AF_INET6;
+    a.sin6_port = htons((uint16_t)port);
+    a.sin6_addr = in6addr_any;
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(ls, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    if (bind(ls, (struct sockaddr *)&a, sizeof(a)))
+      die("bind");
+  } else {
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port = htons((uint16_t)port);
+    a.sin_addr.s_addr = htonl(INADDR_ANY);
+    ls = socket(AF_INET, SOCK_STREAM, 0);
+    if (ls < 0)
+      die("socket");
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(ls, (struct sockaddr *)&a, sizeof(a)))
+      die("bind");
+  }
+  if (listen(ls, 1))
+    die("listen");
+  return ls;
+}
+
+int sock_run_server(int port, const struct SockRun *r) {
+  int ls = sock_listen(port);
+  printf("[server] listening on %d (mode=%s msg=%zu iters=%lu "
+         "transport=%s)\n",
+         port, mode_str(r->mode), r->msg, (unsigned long)r->iters,
+         transport_str(r->transport));
+  fflush(stdout);
+  int fd = accept(ls, NULL, NULL);
+  if (fd < 0)
+    die("accept");
+
+  struct SockHello h;
+  if (recv(fd, &h, sizeof(h), MSG_WAITALL) != (ssize_t)sizeof(h))
+    die("recv hello");
+  uint32_t reply = (uint32_t)r->msg;
+  if (h.mode != (uint32_t)r->mode || h.transport != (uint32_t)r->transport ||
+      !h.msg || h.msg > r->msg || !h.window || !h.iters) {
+    fprintf(stderr, "client asked for mode=%s transport=%s msg=%lu; "
+                    "refusing\n",
+            h.mode <= MODE_WRITE_IMM ? mode_str((enum Mode)h.mode) : "?",
+            h.transport <= TRANSPORT_IO_URING
+                ? transport_str((enum Transport)h.transport)
+                : "?",
+            (unsigned long)h.msg);
+    reply = 0;
+  }
+  if (send(fd, &reply, sizeof(reply), 0) != (ssize_t)sizeof(reply))
+    die("send");
+  if (!reply)
+    return 1;
+
+  struct SockIo io;
+  sock_setup(&io, r->transport, fd, h.window);
+  size_t msg = h.msg;
+  int rd = r->mode == MODE_READ;
+  // READ: the response payload; otherwise the receive buffer.
+  size_t buf_len = rd ? msg : batch_len(msg);
+  char *buf = payload_alloc(buf_len);
+  char reqs[8 * SOCK_BATCH];
+  // Acks alternate between two words: io_uring may still be sending the
+  // previous one, but never the one before it (see sock_send()).
+  uint64_t acks[2];
+  uint64_t done = 0, bytes = 0, t0 = 0, t1 = 0;
+  struct CpuUsage cpu;
+  cpu_usage_start(&cpu);
+  while (done < h.iters) {
+    size_t n = rd ? sock_recv(&io, reqs, sizeof(reqs))
+                  : sock_recv(&io, buf, buf_len);
+    if (!bytes)
+      t0 = now_ns();
+    bytes += n;
+    // READ requests are 8 bytes each.
+    uint64_t now = rd ? bytes / 8 : bytes / msg;
+    if (now == done)
+      continue;
+    if (rd) {
+      sock_send(&io, buf, msg, now - done, 1);
+    } else {
+      uint64_t *ack = &acks[now & 1];
+      *ack = now;
+      sock_send(&io, ack, sizeof(*ack), 1, 0);
+    }
+    done = now;
+  }
+  sock_flush(&io);
+  t1 = now_ns();
+  cpu_usage_stop(&cpu);
+
+  if (rd) {
+    printf("[server] served %lu reads of %zu bytes\n", (unsigned long)done,
+           msg);
+  } else {
+    struct Stats st = {done, done * msg, t1 - t0};
+    printf("[server] recv done: %.2f Mops, %.2f GiB/s\n", stats_mops(&st),
+           stats_gibs(&st));
+  }
+  zc_report("server", &io);
+  cpu_usage_report("server", &cpu, done * msg);
+
+  // Wait for the client to hang up so it never sees a reset mid-run.
+  char x;
+  while (recv(fd, &x, 1, 0) > 0)
+    ;
+  sock_close(&io);
+  close(ls);
+  free(buf);
+  return 0;
+}
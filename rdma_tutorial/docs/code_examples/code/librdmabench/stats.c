@@ -0,0 +1,289 @@
+#include "rdma_bench.h"
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+double stats_mops(const struct Stats *st) {
+  return st->ns ? st->ops / (st->ns / 1e9) / 1e6 : 0;
+}
+
+double stats_gibs(const struct Stats *st) {
+  return st->ns ? st->bytes / (st->ns / 1e9) / (1024.0 * 1024.0 * 1024.0)
+                : 0;
+}
+
+uint64_t percentile(const uint64_t *sorted, uint64_t n, double q) {
+  if (!n)
+    return 0;
+  uint64_t i = (uint64_t)(q * n);
+  return sorted[i < n ? i : n - 1];
+}
+
+// counters/ holds the IBTA port counters (port_*_data in 4-byte words),
+// hw_counters/ the driver's own. The names are mlx5's; other drivers
+// expose a subset and the rest read as -1.
+enum HwClass { HW_WIRE, HW_RNR, HW_RETRANS, HW_CONGESTION };
+
+static const struct {
+  const char *dir, *name;
+  enum HwClass cls;
+} hw_counters[HW_COUNTERS] = {
+    {"counters", "port_xmit_data", HW_WIRE},
+    {"counters", "port_rcv_data", HW_WIRE},
+    {"counters", "port_xmit_packets", HW_WIRE},
+    {"counters", "port_rcv_packets", HW_WIRE},
+    {"hw_counters", "rnr_nak_retry_err", HW_RNR},
+    {"hw_counters", "out_of_buffer", HW_RNR},
+    {"hw_counters", "local_ack_timeout_err", HW_RETRANS},
+    {"hw_counters", "out_of_sequence", HW_RETRANS},
+    {"hw_counters", "packet_seq_err", HW_RETRANS},
+    {"hw_counters", "duplicate_request", HW_RETRANS},
+    {"hw_counters", "implied_nak_seq_err", HW_RETRANS},
+    {"counters", "port_xmit_wait", HW_CONGESTION},
+    {"counters", "port_xmit_discards", HW_CONGESTION},
+    {"hw_counters", "np_cnp_sent", HW_CONGESTION},
+    {"hw_counters", "np_ecn_marked_roce_packets", HW_CONGESTION},
+    {"hw_counters", "rp_cnp_handled", HW_CONGESTION},
+};
+
+void hw_counters_read(struct rdma_cm_id *id, long long *v) {
+  char path[256];
+  for (size_t i = 0; i < HW_COUNTERS; ++i) {
+    snprintf(path, sizeof(path), "/sys/class/infiniband/%s/ports/%u/%s/%s",
+             ibv_get_device_name(id->verbs->device), id->port_num,
+             hw_counters[i].dir, hw_counters[i].name);
+    FILE *f = fopen(path, "r");
+    v[i] = -1;
+    if (!f)
+      continue;
+    if (fscanf(f, "%lld", &v[i]) != 1)
+      v[i] = -1;
+    fclose(f);
+  }
+}
+
+// Wire traffic against what the application moved: port_*_data counts
+// every byte of every packet (headers, ACKs, other users of the port), so
+// app/wire below 100% is protocol overhead plus anything else on the port.
+static void report_wire(const char *who, const long long *d,
+                        const struct Stats *app, int rx) {
+  if (d[HW_TX_DATA] < 0 || d[HW_RX_DATA] < 0) {
+    printf("[%s] wire: n/a (no port_xmit_data/port_rcv_data)\n", who);
+    return;
+  }
+  double tx = d[HW_TX_DATA] * 4.0, rx_bytes = d[HW_RX_DATA] * 4.0;
+  double wire = rx ? rx_bytes : tx;
+  double sec = app->ns / 1e9, gib = 1024.0 * 1024.0 * 1024.0;
+  printf("[%s] wire: tx %.2f GiB/s, rx %.2f GiB/s; app %.2f GiB/s = %.1f%% "
+         "of wire %s",
+         who, sec > 0 ? tx / sec / gib : 0, sec > 0 ? rx_bytes / sec / gib : 0,
+         stats_gibs(app), wire > 0 ? app->bytes / wire * 100 : 0,
+         rx ? "rx" : "tx");
+  long long pkts = d[rx ? HW_RX_PKTS : HW_TX_PKTS];
+  if (pkts >= 0 && app->ops)
+    printf(", %.2f pkts/op", (double)pkts / app->ops);
+  printf("\n");
+}
+
+void hw_counters_report(const char *who, const long long *before,
+                        const long long *after, const struct Stats *app,
+                        int rx) {
+  long long d[HW_COUNTERS], sum[HW_CONGESTION + 1] = {0};
+  int missing[HW_CONGESTION + 1] = {0};
+  for (size_t i = 0; i < HW_COUNTERS; ++i) {
+    d[i] = before[i] < 0 || after[i] < 0 ? -1 : after[i] - before[i];
+    if (d[i] < 0)
+      missing[hw_counters[i].cls]++;
+    else
+      sum[hw_counters[i].cls] += d[i];
+  }
+  if (app)
+    report_wire(who, d, app, rx);
+
+  printf("[%s] hw counters:", who);
+  for (size_t i = 0; i < HW_COUNTERS; ++i)
+    if (hw_counters[i].cls != HW_WIRE && d[i] >= 0)
+      printf(" %s=+%lld", hw_counters[i].name, d[i]);
+  if (missing[HW_RNR] + missing[HW_RETRANS] + missing[HW_CONGESTION])
+    printf(" (%d n/a)",
+           missing[HW_RNR] + missing[HW_RETRANS] + missing[HW_CONGESTION]);
+  printf("\n");
+
+  // What a slow point ran into, as far as the port can tell.
+  static const char *const cls_names[] = {NULL, "receiver not ready",
+                                          "retransmission", "congestion"};
+  int any = 0;
+  printf("[%s] hw verdict:", who);
+  for (int c = HW_RNR; c <= HW_CONGESTION; ++c)
+    if (sum[c]) {
+      printf("%s %s", any ? "," : "", cls_names[c]);
+      any = 1;
+    }
+  if (!any)
+    printf(" no fabric events%s, so a shortfall is on the hosts",
+           missing[HW_RNR] + missing[HW_RETRANS] + missing[HW_CONGESTION]
+               ? " among the readable counters"
+               : "");
+  printf("\n");
+}
+
+static uint64_t tv_ns(struct timeval tv) {
+  return (uint64_t)tv.tv_sec * 1000000000ull + (uint64_t)tv.tv_usec * 1000;
+}
+
+// A hardware counter (`config`) for this thread, kernel included when
+// perf_event_paranoid allows it. A `group` member inherits the leader's
+// `user_only`. Returns -1 when the PMU is not available (most VMs and
+// containers).
+static int perf_open(uint64_t config, int group, int *user_only) {
+  struct perf_event_attr a;
+  memset(&a, 0, sizeof(a));
+  a.size = sizeof(a);
+  a.type = PERF_TYPE_HARDWARE;
+  a.config = config;
+  a.disabled = group < 0;
+  a.exclude_hv = 1;
+  int u = group < 0 ? 0 : *user_only;
+  for (; u < 2; ++u) {
+    a.exclude_kernel = (unsigned)u;
+    int fd = (int)syscall(SYS_perf_event_open, &a, 0, -1, group, 0);
+    if (fd >= 0) {
+      *user_only = u;
+      return fd;
+    }
+    if (group >= 0)
+      break;
+  }
+  return -1;
+}
+
+void cpu_usage_start(struct CpuUsage *c) {
+  memset(c, 0, sizeof(*c));
+  c->cycles = -1;
+  c->fd = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1, &c->user_only);
+  if (c->fd >= 0) {
+    ioctl(c->fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  c->user_ns = tv_ns(ru.ru_utime);
+  c->sys_ns = tv_ns(ru.ru_stime);
+  c->wall_ns = now_ns();
+}
+
+void cpu_usage_stop(struct CpuUsage *c) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  c->wall_ns = now_ns() - c->wall_ns;
+  c->user_ns = tv_ns(ru.ru_utime) - c->user_ns;
+  c->sys_ns = tv_ns(ru.ru_stime) - c->sys_ns;
+  if (c->fd >= 0) {
+    long long v;
+    ioctl(c->fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(c->fd, &v, sizeof(v)) == (ssize_t)sizeof(v))
+      c->cycles = v;
+    close(c->fd);
+    c->fd = -1;
+  }
+}
+
+void cpu_usage_report(const char *who, const struct CpuUsage *c,
+                      uint64_t bytes) {
+  double cpu = (double)(c->user_ns + c->sys_ns);
+  printf("[%s] cpu: user %.3fs sys %.3fs (%.0f%% of one core), %.3f ns/B",
+         who, c->user_ns / 1e9, c->sys_ns / 1e9,
+         c->wall_ns ? cpu / c->wall_ns * 100 : 0, bytes ? cpu / bytes : 0);
+  if (c->cycles < 0)
+    printf(", cycles n/a\n");
+  else
+    printf(", %.3f%s cycles/B\n", bytes ? (double)c->cycles / bytes : 0,
+           c->user_only ? " user" : "");
+}
+
+#ifdef RDMA_PROF
+void prof_start(struct Prof *p) {
+  memset(p, 0, sizeof(*p));
+  p->fd[0] = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1, &p->user_only);
+  p->fd[1] = p->fd[0] < 0 ? -1
+                          : perf_open(PERF_COUNT_HW_INSTRUCTIONS, p->fd[0],
+                                      &p->user_only);
+  if (p->fd[0] >= 0) {
+    ioctl(p->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(p->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  p->ns0 = now_ns();
+  p->t0 = prof_ticks();
+}
+
+void prof_stop(struct Prof *p) {
+  p->t0 = prof_ticks() - p->t0;
+  p->ns0 = now_ns() - p->ns0;
+  if (p->fd[0] >= 0)
+    ioctl(p->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  for (int i = 0; i < 2; ++i) {
+    p->perf[i] = -1;
+    if (p->fd[i] < 0)
+      continue;
+    if (read(p->fd[i], &p->perf[i], sizeof(p->perf[i])) !=
+        (ssize_t)sizeof(p->perf[i]))
+      p->perf[i] = -1;
+    close(p->fd[i]);
+    p->fd[i] = -1;
+  }
+}
+
+void prof_report(const char *who, const struct Prof *p, uint64_t ops) {
+  uint64_t ticks = p->t0, ns = p->ns0;
+  const long long *v = p->perf;
+  if (!ticks)
+    return;
+
+  // Ticks are TSC (or the virtual counter on arm64); ns per tick comes
+  // from the run itself.
+  double pct = 100.0 / ticks, tick_ns = (double)ns / ticks;
+  uint64_t in = p->post + p->hit + p->empty;
+  uint64_t polls = p->hits + p->empties;
+  printf("[%s] prof: post %.1f%% (%lu x %.0f ns), poll hit %.1f%% "
+         "(%lu x %.0f ns), poll empty %.1f%% (%lu x %.0f ns), other %.1f%%\n",
+         who, p->post * pct, (unsigned long)p->posts,
+         p->posts ? p->post * tick_ns / p->posts : 0, p->hit * pct,
+         (unsigned long)p->hits, p->hits ? p->hit * tick_ns / p->hits : 0,
+         p->empty * pct, (unsigned long)p->empties,
+         p->empties ? p->empty * tick_ns / p->empties : 0,
+         in < ticks ? (ticks - in) * pct : 0);
+  printf("[%s] prof: completions per poll:", who);
+  uint64_t reaped = 0;
+  for (int n = 0; n < PROF_HIST; ++n) {
+    reaped += (uint64_t)n * p->hist[n];
+    if (p->hist[n])
+      printf(" %d:%.1f%%", n, 100.0 * p->hist[n] / polls);
+  }
+  printf(" (%.2f per productive poll)\n",
+         p->hits ? (double)reaped / p->hits : 0);
+  if (v[0] < 0 || !ops) {
+    printf("[%s] prof: cycles/instructions n/a\n", who);
+    return;
+  }
+  printf("[%s] prof: %.1f%s cycles/op", who, (double)v[0] / ops,
+         p->user_only ? " user" : "");
+  if (v[1] >= 0)
+    printf(", %.1f instructions/op, IPC %.2f", (double)v[1] / ops,
+           v[0] ? (double)v[1] / v[0] : 0);
+  printf("\n");
+}
+#else
+void prof_start(struct Prof *p) { (void)p; }
+
+void prof_stop(struct Prof *p) { (void)p; }
+
+void prof_report(const char *who, const struct Prof *p, uint64_t ops) {
+  (void)who;
+  (void)p;
+  (void)ops;
+}
+#endif
@@ -0,0 +1,105 @@
+#include "rdma_bench.h"
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trace_load(const char *path, struct Trace *t) {
+  memset(t, 0, sizeof(*t));
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  struct TraceHdr h;
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic))) {
+    fprintf(stderr, "%s: not a trace; convert CSV with trace_convert\n",
+            path);
+    fclose(f);
+    return -1;
+  }
+  t->n = le64toh(h.count);
+  if (!t->n || t->n > SIZE_MAX / sizeof(*t->rec) ||
+      !(t->rec = malloc(t->n * sizeof(*t->rec)))) {
+    fprintf(stderr, "%s: cannot hold %lu ops\n", path, (unsigned long)t->n);
+    fclose(f);
+    return -1;
+  }
+  uint64_t got = fread(t->rec, sizeof(*t->rec), t->n, f);
+  fclose(f);
+  if (got != t->n) {
+    fprintf(stderr, "%s: truncated after %lu of %lu ops\n", path,
+            (unsigned long)got, (unsigned long)t->n);
+    goto bad;
+  }
+  for (uint64_t i = 0; i < t->n; ++i) {
+    struct TraceRec *r = &t->rec[i];
+    r->t_ns = le64toh(r->t_ns);
+    r->offset = le64toh(r->offset);
+    r->size = le32toh(r->size);
+    r->qp = le16toh(r->qp);
+    if (r->mode > MODE_WRITE_IMM || !r->size || r->size > (1u << 31) ||
+        (i && r->t_ns < r[-1].t_ns)) {
+      fprintf(stderr, "%s: op %lu is invalid or out of order\n", path,
+              (unsigned long)i);
+      goto bad;
+    }
+    if (r->size > t->max_size)
+      t->max_size = r->size;
+    if ((r->mode == MODE_SEND || r->mode == MODE_WRITE_IMM) &&
+        r->size > t->max_recv)
+      t->max_recv = r->size;
+    if (r->qp >= t->nqp)
+      t->nqp = r->qp + 1;
+    t->ops[r->mode]++;
+  }
+  t->two_sided = t->ops[MODE_SEND] || t->ops[MODE_WRITE_IMM];
+  return 0;
+bad:
+  free(t->rec);
+  t->rec = NULL;
+  return -1;
+}
+
+int trace_save(const char *path, const struct TraceRec *rec, uint64_t n) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  struct TraceHdr h;
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  h.count = htole64(n);
+  int err = fwrite(&h, sizeof(h), 1, f) != 1;
+  for (uint64_t i = 0; i < n && !err; ++i) {
+    struct TraceRec r = rec[i];
+    r.t_ns = htole64(r.t_ns);
+    r.offset = htole64(r.offset);
+    r.size = htole32(r.size);
+    r.qp = htole16(r.qp);
+    err = fwrite(&r, sizeof(r), 1, f) != 1;
+  }
+  if (fclose(f) || err) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+void trace_print(const struct Trace *t, const char *who) {
+  double sec = t->rec[t->n - 1].t_ns / 1e9;
+  printf("[%s] trace: %lu ops over %.3f s", who, (unsigned long)t->n, sec);
+  if (sec > 0)
+    printf(" (%.3f Mops)", t->n / sec / 1e6);
+  printf(", %d QPs, largest op %lu bytes", t->nqp,
+         (unsigned long)t->max_size);
+  const char *sep = ";";
+  for (int m = MODE_READ; m <= MODE_WRITE_IMM; ++m)
+    if (t->ops[m]) {
+      printf("%s %.1f%% %s", sep, 100.0 * t->ops[m] / t->n,
+             mode_str((enum Mode)m));
+      sep = ",";
+    }
+  printf("\n");
+}
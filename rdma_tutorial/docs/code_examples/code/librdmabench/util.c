@@ -0,0 +1,87 @@
+#include "rdma_bench.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+static const char *const mode_names[] = {"read", "write", "send",
+                                         "write_imm"};
+
+const char *mode_str(enum Mode mode) { return mode_names[mode]; }
+
+int mode_parse(const char *s, enum Mode *mode) {
+  for (int m = MODE_READ; m <= MODE_WRITE_IMM; ++m)
+    if (!strcmp(s, mode_names[m])) {
+      *mode = (enum Mode)m;
+      return 0;
+    }
+  return -1;
+}
+
+int size_parse(const char *s, uint64_t *v) {
+  char *end;
+  errno = 0;
+  uint64_t n = strtoull(s, &end, 0);
+  int shift = 0;
+  if (*end == 'K' || *end == 'k')
+    shift = 10;
+  else if (*end == 'M' || *end == 'm')
+    shift = 20;
+  else if (*end == 'G' || *end == 'g')
+    shift = 30;
+  if (shift)
+    end++;
+  if (errno || end == s || *end || *s == '-' || n > UINT64_MAX >> shift)
+    return -1;
+  *v = n << shift;
+  return 0;
+}
+
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_sw(uint32_t crc, const void *p, size_t n) {
+  const uint8_t *b = p;
+  crc = ~crc;
+  while (n--)
+    crc = crc32c_table[(crc ^ *b++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const void *p, size_t n) {
+  const uint8_t *b = p;
+  uint64_t c = ~crc;
+  for (; n >= 8; n -= 8, b += 8) {
+    uint64_t v;
+    memcpy(&v, b, sizeof(v));
+    c = _mm_crc32_u64(c, v);
+  }
+  uint32_t c32 = (uint32_t)c;
+  while (n--)
+    c32 = _mm_crc32_u8(c32, *b++);
+  return ~c32;
+}
+#endif
+
+uint32_t (*crc32c)(uint32_t, const void *, size_t) = crc32c_sw;
+
+// Build the table for the portable path and switch to the SSE4.2 crc32
+// instruction when the CPU has it.
+const char *crc32c_select(void) {
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+    crc32c_table[i] = c;
+  }
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c = crc32c_hw;
+    return "sse4.2";
+  }
+#endif
+  return "table";
+}
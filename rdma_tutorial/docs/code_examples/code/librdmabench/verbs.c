@@ -0,0 +1,62 @@
+#include "rdma_verbs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void die(const char *m) {
+  perror(m);
+  exit(1);
+}
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+struct ibv_context *open_device(const char *name) {
+  int n;
+  struct ibv_device **list = ibv_get_device_list(&n);
+  if (!list || !n)
+    die("get_device_list");
+  struct ibv_context *ctx = NULL;
+  for (int i = 0; i < n && !ctx; ++i)
+    if (!name || !strcmp(ibv_get_device_name(list[i]), name))
+      ctx = ibv_open_device(list[i]);
+  ibv_free_device_list(list);
+  if (!ctx)
+    die("open_device");
+  return ctx;
+}
+
+uint32_t port_mtu(struct ibv_context *ctx, uint8_t port) {
+  struct ibv_port_attr pa;
+  if (ibv_query_port(ctx, port, &pa))
+    die("query_port");
+  return 128u << pa.active_mtu;
+}
+
+void ud_qp_ready(struct ibv_qp *qp, uint8_t port, uint32_t qkey) {
+  struct ibv_qp_attr a;
+  memset(&a, 0, sizeof(a));
+  a.qp_state = IBV_QPS_INIT;
+  a.port_num = port;
+  a.qkey = qkey;
+  if (ibv_modify_qp(qp, &a,
+                    IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT |
+                        IBV_QP_QKEY))
+    die("modify_qp INIT");
+  a.qp_state = IBV_QPS_RTR;
+  if (ibv_modify_qp(qp, &a, IBV_QP_STATE))
+    die("modify_qp RTR");
+  a.qp_state = IBV_QPS_RTS;
+  a.sq_psn = 0;
+  if (ibv_modify_qp(qp, &a, IBV_QP_STATE | IBV_QP_SQ_PSN))
+    die("modify_qp RTS");
+}
@@ -0,0 +1,235 @@
+#include "rdma_bench.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t wl_rand(struct Workload *w) {
+  w->rng ^= w->rng << 13;
+  w->rng ^= w->rng >> 7;
+  w->rng ^= w->rng << 17;
+  return w->rng;
+}
+
+// Uniform in (0, 1]: never 0, so its log is finite.
+static double wl_unit(struct Workload *w) {
+  return ((wl_rand(w) >> 11) + 1) * 0x1.0p-53;
+}
+
+static int parse_rate_mops(const char *s, double *ops_per_s) {
+  char *end;
+  double v = strtod(s, &end);
+  if (end == s || !(v > 0) || (*end && strcmp(end, "Mops")))
+    return -1;
+  *ops_per_s = v * 1e6;
+  return 0;
+}
+
+// SIZE, uniform:LO:HI or cdf:SIZE=P,SIZE=P,...
+static int parse_size_dist(struct WlClass *c, char *s) {
+  if (!strncmp(s, "uniform:", 8)) {
+    char *hi = strchr(s + 8, ':');
+    if (!hi)
+      return -1;
+    *hi++ = '\0';
+    c->dist = SIZE_UNIFORM;
+    return size_parse(s + 8, &c->lo) || size_parse(hi, &c->hi) ||
+                   !c->lo || c->hi < c->lo
+               ? -1
+               : 0;
+  }
+  if (!strncmp(s, "cdf:", 4)) {
+    c->dist = SIZE_CDF;
+    char *save = NULL;
+    double prev = 0;
+    for (char *t = strtok_r(s + 4, ",", &save); t;
+         t = strtok_r(NULL, ",", &save)) {
+      char *eq = strchr(t, '=');
+      if (!eq || c->ncdf == WL_CDF)
+        return -1;
+      *eq++ = '\0';
+      uint64_t v;
+      char *end;
+      double p = strtod(eq, &end);
+      if (size_parse(t, &v) || !v || *end || p <= prev || p > 1)
+        return -1;
+      c->cdf_size[c->ncdf] = v;
+      c->cdf_p[c->ncdf++] = prev = p;
+    }
+    // The last point must cover every draw.
+    if (!c->ncdf || prev < 1 - 1e-9)
+      return -1;
+    c->cdf_p[c->ncdf - 1] = 1;
+    return 0;
+  }
+  c->dist = SIZE_FIXED;
+  return size_parse(s, &c->lo) || !c->lo ? -1 : 0;
+}
+
+static uint64_t dist_max(const struct WlClass *c) {
+  if (c->dist == SIZE_FIXED)
+    return c->lo;
+  if (c->dist == SIZE_UNIFORM)
+    return c->hi;
+  uint64_t m = 0;
+  for (int i = 0; i < c->ncdf; ++i)
+    if (c->cdf_size[i] > m)
+      m = c->cdf_size[i];
+  return m;
+}
+
+// One line: an arrival process or a class.
+static int parse_line(struct Workload *w, char *line) {
+  char *tok[8], *save = NULL;
+  int n = 0;
+  for (char *t = strtok_r(line, " \t\r\n", &save); t && n < 8;
+       t = strtok_r(NULL, " \t\r\n", &save))
+    tok[n++] = t;
+  if (!n || tok[0][0] == '#')
+    return 0;
+  if (!strcmp(tok[0], "closed") && n == 1) {
+    w->arrival = ARRIVAL_CLOSED;
+    return 0;
+  }
+  if (!strcmp(tok[0], "poisson") && n == 2) {
+    w->arrival = ARRIVAL_POISSON;
+    return parse_rate_mops(tok[1], &w->rate);
+  }
+  if (!strcmp(tok[0], "onoff") && n == 4) {
+    w->arrival = ARRIVAL_ONOFF;
+    char *end;
+    double on = strtod(tok[2], &end);
+    if (*end || !(on > 0))
+      return -1;
+    double off = strtod(tok[3], &end);
+    if (*end || off < 0)
+      return -1;
+    w->on_ns = (uint64_t)(on * 1e3);
+    w->off_ns = (uint64_t)(off * 1e3);
+    return parse_rate_mops(tok[1], &w->rate);
+  }
+  // WEIGHT[%] OP SIZE
+  if (n != 3 || w->n == WL_CLASSES)
+    return -1;
+  struct WlClass *c = &w->cls[w->n];
+  memset(c, 0, sizeof(*c));
+  char *end;
+  c->weight = strtod(tok[0], &end);
+  if (end == tok[0] || (*end && strcmp(end, "%")) || !(c->weight > 0) ||
+      mode_parse(tok[1], &c->mode))
+    return -1;
+  snprintf(c->name, sizeof(c->name), "%s %s", tok[1], tok[2]);
+  if (parse_size_dist(c, tok[2]))
+    return -1;
+  w->n++;
+  return 0;
+}
+
+int wl_parse(struct Workload *w, const char *spec) {
+  memset(w, 0, sizeof(*w));
+  w->rng = 0x9e3779b97f4a7c15ull;
+  // A file when one by that name exists; otherwise the spec itself.
+  char *text = NULL;
+  FILE *f = fopen(spec, "r");
+  if (f) {
+    size_t cap = 0, len = 0;
+    for (;;) {
+      if (len + 4096 + 1 > cap) {
+        cap = cap ? cap * 2 : 8192;
+        if (!(text = realloc(text, cap)))
+          die("realloc");
+      }
+      size_t got = fread(text + len, 1, 4096, f);
+      len += got;
+      if (got < 4096)
+        break;
+    }
+    fclose(f);
+    text[len] = '\0';
+  } else if (!(text = strdup(spec))) {
+    die("strdup");
+  }
+
+  int line_no = 0, err = 0;
+  char *save = NULL;
+  for (char *l = strtok_r(text, ";\n", &save); l && !err;
+       l = strtok_r(NULL, ";\n", &save)) {
+    line_no++;
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", l);
+    if (parse_line(w, l)) {
+      fprintf(stderr, "workload line %d: cannot parse \"%s\"\n", line_no,
+              copy);
+      err = 1;
+    }
+  }
+  free(text);
+  if (err)
+    return -1;
+  if (!w->n) {
+    fprintf(stderr, "workload has no op classes\n");
+    return -1;
+  }
+  // Weights become cumulative shares for wl_next().
+  double total = 0;
+  for (int i = 0; i < w->n; ++i)
+    total += w->cls[i].weight;
+  double sum = 0;
+  for (int i = 0; i < w->n; ++i) {
+    w->cls[i].share = w->cls[i].weight / total;
+    sum += w->cls[i].share;
+    w->cls[i].cum = sum;
+    uint64_t m = dist_max(&w->cls[i]);
+    if (m > w->max_size)
+      w->max_size = m;
+    if ((w->cls[i].mode == MODE_SEND || w->cls[i].mode == MODE_WRITE_IMM) &&
+        m > w->max_recv)
+      w->max_recv = m;
+  }
+  w->cls[w->n - 1].cum = 1;
+  return 0;
+}
+
+int wl_next(struct Workload *w, uint64_t *size) {
+  double u = wl_unit(w);
+  int i = 0;
+  while (i < w->n - 1 && w->cls[i].cum < u)
+    i++;
+  const struct WlClass *c = &w->cls[i];
+  if (c->dist == SIZE_FIXED) {
+    *size = c->lo;
+  } else if (c->dist == SIZE_UNIFORM) {
+    *size = c->lo + wl_rand(w) % (c->hi - c->lo + 1);
+  } else {
+    double v = wl_unit(w);
+    int k = 0;
+    while (k < c->ncdf - 1 && c->cdf_p[k] < v)
+      k++;
+    *size = c->cdf_size[k];
+  }
+  return i;
+}
+
+uint64_t wl_arrival(struct Workload *w, uint64_t t) {
+  if (w->arrival == ARRIVAL_POISSON)
+    return t + (uint64_t)(-log(wl_unit(w)) / w->rate * 1e9);
+  // onoff: evenly spaced while on, then skip the off period.
+  t += (uint64_t)(1e9 / w->rate);
+  uint64_t period = w->on_ns + w->off_ns;
+  uint64_t phase = t % period;
+  return phase < w->on_ns ? t : t - phase + period;
+}
+
+void wl_print(const struct Workload *w, const char *who) {
+  if (w->arrival == ARRIVAL_CLOSED)
+    printf("[%s] workload: closed loop", who);
+  else if (w->arrival == ARRIVAL_POISSON)
+    printf("[%s] workload: poisson %.3f Mops", who, w->rate / 1e6);
+  else
+    printf("[%s] workload: onoff %.3f Mops, %.1f us on, %.1f us off", who,
+           w->rate / 1e6, w->on_ns / 1e3, w->off_ns / 1e3);
+  for (int i = 0; i < w->n; ++i)
+    printf("%s %.1f%% %s", i ? "," : ";", w->cls[i].share * 100,
+           w->cls[i].name);
+  printf("\n");
+}
@@ -29,6 +29,10 @@ MODES = ["write", "send"]  # test these modes
 CLIENT_LINE_RE = re.compile(
     r"\[client\]\s+(\w+)\s+done:\s+([0-9.]+)\s+Mops,\s+([0-9.]+)\s+GiB/s"
 )
+CLIENT_POINT_RE = re.compile(
+    r"\[client\]\s+(\w+)\s+done:\s+([0-9.]+)\s+Mops,\s+([0-9.]+)\s+GiB/s"
+    r"\s+\(msg=(\d+) bytes, window=(\d+)"
+)
 
 
 def run_client(mode: str, msg: int, iters: int, window: int):
@@ -48,6 +52,10 @@ def run_client(mode: str, msg: int, iters: int, window: int):
         "--window",
         str(window),
     ]
+    if mode == "send":
+        # Credit flow control keeps the window from outrunning the server's
+        # reposted receives (RNR retry exceeded).
+        cmd.append("--credits")
     print("\n=== Running client ===")
     print(" ".join(cmd))
 
@@ -82,7 +90,7 @@ def run_client(mode: str, msg: int, iters: int, window: int):
 def ask_start_server(mode: str, msg: int, iters: int):
     """Prompt to start bench_server on the server, then wait for Enter."""
     if mode == "send":
-        srv_cmd = f"{BENCH_SERVER} {PORT} --mode send --msg {msg} --iters {iters} --recv-depth {max(256, FIXED_WINDOW*4)}"
+        srv_cmd = f"{BENCH_SERVER} {PORT} --mode send --msg {msg} --iters {iters} --recv-depth {max(256, FIXED_WINDOW*4)} --credits"
     elif mode in ("write", "read"):
         srv_cmd = f"{BENCH_SERVER} {PORT} --mode {mode} --msg {msg} --iters {iters}"
     else:
@@ -168,6 +176,67 @@ def run_msg_sweep():
     print("\nMsg sweep finished, results written to", RESULT_CSV)
 
 
+def run_inprocess_sweep():
+    """Sweep message size over one connection per mode using --sweep-msg.
+
+    The server registers once for the largest message and the client runs
+    every point back to back, so one server start covers the whole MSG_LIST.
+    """
+    sweep_spec = ",".join(str(m) for m in MSG_LIST)
+    results = []
+
+    for mode in MODES:
+        srv_cmd = f"{BENCH_SERVER} {PORT} --mode {mode} --msg {max(MSG_LIST)}"
+        if mode == "send":
+            srv_cmd += f" --sweep --recv-depth {max(256, FIXED_WINDOW*4)} --credits"
+        print("\n========================================")
+        print("Run on SERVER host (manual):")
+        print(f"  {srv_cmd}")
+        input("Press ENTER to run client...")
+
+        cmd = [
+            BENCH_CLIENT,
+            SERVER_IP,
+            str(PORT),
+            "--mode",
+            mode,
+            "--sweep-msg",
+            sweep_spec,
+            "--window",
+            str(FIXED_WINDOW),
+            "--iters",
+            str(ITERS),
+        ]
+        if mode == "send":
+            cmd.append("--credits")
+        print(" ".join(cmd))
+        proc = subprocess.run(cmd, capture_output=True, text=True)
+        print("client stdout:\n", proc.stdout.strip())
+        if proc.returncode != 0:
+            print("!! bench_client exited with non-zero code:", proc.returncode)
+            print("stderr:\n", proc.stderr)
+
+        for line in proc.stdout.splitlines():
+            m = CLIENT_POINT_RE.search(line)
+            if not m:
+                continue
+            mode_str, mops_str, gib_str, msg_str, window_str = m.groups()
+            results.append(
+                {
+                    "experiment": "msg_sweep",
+                    "mode": mode_str,
+                    "msg": int(msg_str),
+                    "window": int(window_str),
+                    "iters": ITERS,
+                    "mops": float(mops_str),
+                    "gib": float(gib_str),
+                }
+            )
+
+    append_result_csv(results)
+    print("\nIn-process sweep finished, results written to", RESULT_CSV)
+
+
 def load_results():
     import pandas as pd
 
@@ -235,12 +304,15 @@ def main():
         print("\nChoose an action:")
         print("  1) Run msg sweep with fixed window")
         print("  2) Plot only (use existing CSV)")
+        print("  3) Run msg sweep over a single connection (--sweep-msg)")
         print("  q) Quit")
         choice = input("> ").strip().lower()
         if choice == "1":
             run_msg_sweep()
         elif choice == "2":
             plot_results()
+        elif choice == "3":
+            run_inprocess_sweep()
         elif choice == "q":
             break
         else:
@@ -1,187 +1,1482 @@
-// gcc bench_client.c -o bench_client -lrdmacm -libverbs
+// gcc -O3 bench_client.c ../librdmabench/*.c -o bench_client -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
 #include <arpa/inet.h>
-#include <infiniband/verbs.h>
-#include <netdb.h>
-#include <rdma/rdma_cma.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-struct Info {
-  uint64_t addr;
-  uint32_t rkey, len;
-} __attribute__((packed));
+enum Verify { VERIFY_NONE, VERIFY_SAMPLE, VERIFY_FULL };
+enum QpSelect { QP_RR, QP_RANDOM, QP_ZIPF };
+enum RateUnit { RATE_MOPS, RATE_GBPS, RATE_PCT };
 
-enum Mode { MODE_READ, MODE_WRITE, MODE_SEND };
+#define SWEEP_MAX 64
 
-static void die(const char *m) {
-  perror(m);
-  exit(1);
+// Local source/sink buffers for the one-directional loop: `count` slots
+// `stride` bytes apart in one registration, used round-robin. A pool much
+// larger than the LLC keeps payloads cache-cold; `touch` rewrites each slot
+// with CPU stores before it is posted, like a producer filling it.
+struct TxPool {
+  char *base;
+  struct ibv_mr *mr;
+  uint64_t count;
+  size_t stride;
+  int touch;
+};
+
+// --credits: the server grants receive credits in zero-length
+// SEND_WITH_IMM messages (imm = count), and the client never has more
+// SEND/write_imm ops outstanding than it holds credits, so it cannot hit
+// RNR. The server sizes its grant batches so that at most CREDIT_RECVS
+// updates are ever in flight.
+struct Credits {
+  struct rdma_cm_id *id; // updates arrive on its receive CQ
+  uint64_t avail;
+  uint64_t stall_ns; // time spent with window room but no credits
+};
+
+// Fill the payload with a per-message byte so stale data cannot pass, then
+// stamp seq and CRC into the header. This is the producer cost the
+// --verify baseline pass is compared against.
+static void stamp_msg(char *p, size_t msg, uint64_t seq) {
+  struct VerifyHdr h = {VERIFY_MAGIC, 0, seq};
+  memset(p + sizeof(h), (int)(seq * 0x9d + 1) & 0xff, msg - sizeof(h));
+  h.crc = crc32c(crc32c(0, &h, sizeof(h)), p + sizeof(h), msg - sizeof(h));
+  memcpy(p, &h, sizeof(h));
+}
+
+static const char *verify_str(enum Verify v) {
+  return v == VERIFY_FULL ? "full" : (v == VERIFY_SAMPLE ? "sample" : "none");
+}
+
+static const char *qp_select_str(enum QpSelect s) {
+  return s == QP_ZIPF ? "zipf" : (s == QP_RANDOM ? "random" : "rr");
+}
+
+// Which QP the next op goes to. Random and zipf draw from a fixed-seed
+// xorshift so repeated runs spread ops the same way. zipf gives QP i a
+// share proportional to 1 / (i + 1) and searches a CDF built once per point.
+struct QpPick {
+  enum QpSelect sel;
+  int n;
+  uint64_t next, rng;
+  double *cdf;
+};
+
+static void qp_pick_init(struct QpPick *p, enum QpSelect sel, int n) {
+  *p = (struct QpPick){sel, n, 0, 0x9e3779b97f4a7c15ull, NULL};
+  if (sel != QP_ZIPF)
+    return;
+  p->cdf = malloc((size_t)n * sizeof(*p->cdf));
+  if (!p->cdf)
+    die("malloc");
+  double sum = 0;
+  for (int i = 0; i < n; ++i)
+    p->cdf[i] = sum += 1.0 / (i + 1);
+  for (int i = 0; i < n; ++i)
+    p->cdf[i] /= sum;
+}
+
+static inline int qp_pick(struct QpPick *p) {
+  if (p->sel == QP_RR || p->n == 1)
+    return (int)(p->next++ % (uint64_t)p->n);
+  p->rng ^= p->rng << 13;
+  p->rng ^= p->rng >> 7;
+  p->rng ^= p->rng << 17;
+  if (p->sel == QP_RANDOM)
+    return (int)(p->rng % (uint64_t)p->n);
+  double u = (p->rng >> 11) * 0x1.0p-53;
+  int lo = 0, hi = p->n - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (p->cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
 }
 
 static void usage(const char *p) {
   fprintf(stderr,
-          "Usage: %s <server_ip> <port> [--mode read|write|send] [--msg N] "
-          "[--iters N] [--window N]\n",
+          "Usage: %s <server_ip> <port> [--mode read|write|send|write_imm] "
+          "[--msg N] "
+          "[--iters N] [--window N] [--bidir] [--recv-depth N] "
+          "[--rd-atomic N] [--qps N] [--sweep-msg A:B:xF] "
+          "[--sweep-window A:B:xF] [--verify none|sample|full] "
+          "[--buffers N] [--buffer-stride S] [--touch] [--hugepages] "
+          "[--detect cq|poll] [--credits] [--timeout N] [--retry-cnt N] "
+          "[--rnr-retry N] [--min-rnr-timer N] "
+          "[--transport rdma|tcp|tcp-zerocopy|io_uring] [--hw-ts] "
+          "[--post-api legacy|ex] [--qp-select rr|random|zipf] "
+          "[--sweep-qps A:B:xF] [--chunk N] [--stripes K] "
+          "[--rate R[,R...]Mops|Gbps|%%] [--workload SPEC|FILE] "
+          "[--replay FILE] [--speed X]\n",
           p);
 }
 
+// Parse a sweep spec into `out`: "A:B:xF" (A, A*F, ... <= B), "A:B:+S"
+// (A, A+S, ... <= B) or a list "A,B,C". Returns the number of points.
+static int parse_sweep(const char *spec, uint64_t *out, int max) {
+  char *end;
+  uint64_t a = strtoull(spec, &end, 0);
+  if (*end == '\0' || *end == ',') {
+    int n = 0;
+    out[n++] = a;
+    while (*end == ',' && n < max) {
+      out[n++] = strtoull(end + 1, &end, 0);
+      if (!out[n - 1])
+        return 0;
+    }
+    return *end == '\0' && a > 0 ? n : 0;
+  }
+  if (*end != ':')
+    return 0;
+  uint64_t b = strtoull(end + 1, &end, 0);
+  if (*end != ':' || (end[1] != 'x' && end[1] != '+'))
+    return 0;
+  int geometric = end[1] == 'x';
+  uint64_t step = strtoull(end + 2, &end, 0);
+  if (*end != '\0' || a == 0 || b < a || (geometric ? step < 2 : step < 1))
+    return 0;
+  int n = 0;
+  for (uint64_t v = a; v <= b && n < max; v = geometric ? v * step : v + step)
+    out[n++] = v;
+  return n;
+}
+
+// Parse --rate: "R[,R...]" followed by one unit, Mops, Gbps or % (of the
+// closed-loop rate). Returns the number of rates, 0 on error.
+static int parse_rate(const char *spec, double *out, int max,
+                      enum RateUnit *unit) {
+  const char *p = spec;
+  char *end;
+  int n = 0;
+  for (;;) {
+    double v = strtod(p, &end);
+    if (end == p || !(v > 0) || n == max)
+      return 0;
+    out[n++] = v;
+    if (*end != ',')
+      break;
+    p = end + 1;
+  }
+  if (!strcmp(end, "Mops"))
+    *unit = RATE_MOPS;
+  else if (!strcmp(end, "Gbps"))
+    *unit = RATE_GBPS;
+  else if (!strcmp(end, "%"))
+    *unit = RATE_PCT;
+  else
+    return 0;
+  return n;
+}
+
+static void post_credit_recv(struct rdma_cm_id *id) {
+  struct ibv_recv_wr wr = {0}, *bad;
+  if (ibv_post_recv(id->qp, &wr, &bad))
+    die("post_recv");
+}
+
+// Collect any credit updates that have arrived.
+static void credits_poll(struct Credits *cr) {
+  struct ibv_wc wc[8];
+  int n = ibv_poll_cq(cr->id->recv_cq, 8, wc);
+  if (n < 0)
+    die("poll_cq");
+  for (int i = 0; i < n; ++i) {
+    if (wc[i].status || !(wc[i].wc_flags & IBV_WC_WITH_IMM)) {
+      fprintf(stderr, "bad credit update: status=%d(%s)\n", wc[i].status,
+              ibv_wc_status_str(wc[i].status));
+      exit(1);
+    }
+    cr->avail += ntohl(wc[i].imm_data);
+    post_credit_recv(cr->id);
+  }
+}
+
+// One measured point of the one-directional loop.
+struct RunCfg {
+  enum Mode mode;
+  enum Verify verify;
+  size_t msg;
+  uint64_t iters, window;
+  int tail_seq; // --detect poll: the last 8 bytes carry seq + 1
+  struct Credits *credits; // --credits, kept across points; NULL otherwise
+  struct ibv_qp_ex **qpx; // --post-api ex, per QP; NULL: ibv_post_send
+  enum QpSelect select; // how ops are spread over the QPs
+};
+
+static inline char *pool_slot(const struct TxPool *p, uint64_t i) {
+  return p->base + (i % p->count) * p->stride;
+}
+
+// --post-api ex: the same WR through the ibv_wr_* builders, which let the
+// provider write the WQE in place instead of parsing a struct ibv_send_wr.
+static inline void post_ex(struct ibv_qp_ex *x, const struct WrOp *op,
+                           const struct Info *info, uint64_t n,
+                           uint32_t lkey, int signaled) {
+  uint64_t addr = info->addr + op->offset;
+  ibv_wr_start(x);
+  x->wr_id = n;
+  x->wr_flags = signaled ? IBV_SEND_SIGNALED : 0;
+  if (op->mode == MODE_READ)
+    ibv_wr_rdma_read(x, info->rkey, addr);
+  else if (op->mode == MODE_WRITE)
+    ibv_wr_rdma_write(x, info->rkey, addr);
+  else if (op->mode == MODE_WRITE_IMM)
+    ibv_wr_rdma_write_imm(x, info->rkey, addr,
+                          htonl((uint32_t)op->offset));
+  else
+    ibv_wr_send(x);
+  ibv_wr_set_sge(x, lkey, (uintptr_t)op->src, op->len);
+  int rc = ibv_wr_complete(x);
+  if (rc) {
+    errno = rc;
+    die("ibv_wr_complete");
+  }
+}
+
+// The run_ops() hooks of the one-directional loop, closed or (--rate)
+// open: op i is due `gap` ns after op i - 1 and waits for a credit with
+// --credits, then takes slot i of the pool, filled as cfg->verify and
+// pool->touch say, and the QP cfg->select picks.
+struct Unidir {
+  const struct RunCfg *cfg;
+  const struct TxPool *pool;
+  const struct Info *info;
+  struct QpPick pick;
+  uint64_t remote_slots;
+  int rotate;
+  double gap;      // ns per op, 0 in a closed loop
+  uint64_t stall0; // when the credits ran out
+};
+
+static void unidir_init(struct Unidir *u, const struct RunCfg *cfg,
+                        const struct TxPool *pool, const struct Info *info,
+                        int qps, double gap) {
+  *u = (struct Unidir){cfg, pool, info, {0}, info->len / cfg->msg, 0, gap,
+                       0};
+  u->rotate = cfg->mode == MODE_WRITE_IMM ||
+              (cfg->mode == MODE_WRITE && cfg->tail_seq);
+  qp_pick_init(&u->pick, cfg->select, qps);
+}
+
+static int unidir_next(void *arg, uint64_t i, uint64_t now,
+                       struct WrOp *op) {
+  struct Unidir *u = arg;
+  const struct RunCfg *cfg = u->cfg;
+  size_t msg = cfg->msg;
+  uint64_t due = (uint64_t)(i * u->gap);
+  if (due > now)
+    return 1;
+  struct Credits *cr = cfg->credits;
+  if (cr) {
+    if (!cr->avail)
+      credits_poll(cr);
+    if (!cr->avail) {
+      if (!u->stall0)
+        u->stall0 = now_ns();
+      return 1;
+    }
+    if (u->stall0) {
+      cr->stall_ns += now_ns() - u->stall0;
+      u->stall0 = 0;
+    }
+    cr->avail--;
+  }
+  char *src = pool_slot(u->pool, i);
+  enum Verify verify = cfg->verify;
+  int stamped = verify == VERIFY_FULL ||
+                (verify == VERIFY_SAMPLE && i % VERIFY_SAMPLE_EVERY == 0);
+  if (stamped) // writes the whole message, so it also counts as a touch
+    stamp_msg(src, msg, i);
+  else if (u->pool->touch) // a repeated byte can never form VERIFY_MAGIC
+    memset(src, (int)(i & 0xff), msg);
+  else if (verify == VERIFY_SAMPLE)
+    memset(src, 0, sizeof(uint32_t)); // clear a stale magic
+  if (cfg->tail_seq) {
+    uint64_t seq = i + 1;
+    memcpy(src + msg - sizeof(seq), &seq, sizeof(seq));
+  }
+  *op = (struct WrOp){cfg->mode, qp_pick(&u->pick), (uint32_t)msg, src,
+                      u->rotate ? (i % u->remote_slots) * msg : 0, due};
+  return 0;
+}
+
+static void unidir_post(void *arg, uint64_t i, const struct WrOp *op,
+                        int signaled) {
+  struct Unidir *u = arg;
+  post_ex(u->cfg->qpx[op->qp], op, u->info, i, u->pool->mr->lkey,
+          signaled);
+}
+
+// Closed-loop, one-directional run: keep `window` ops in flight until
+// `iters` have completed, spreading them over qp[0..qps) as cfg->select
+// says and round-robin over the slots of `pool`. With verification or
+// tail sequence numbers the pool has at least `window` slots, so a slot is
+// only rewritten after its previous op completed. write_imm ops, and
+// writes for a polling server, rotate over the server's ring. With
+// credits, each op also needs one granted receive. Retry-exceeded
+// completions are counted rather than fatal: the QP is then in error, so
+// the run stops posting, drains the flushed ops and returns -1. Returns
+// the achieved Mops otherwise.
+static double run_unidir(struct ibv_qp **qp, int qps, struct ibv_cq *cq,
+                         const struct TxPool *pool, const struct Info *info,
+                         const struct RunCfg *cfg) {
+  struct Credits *cr = cfg->credits;
+  if (cr)
+    cr->stall_ns = 0;
+  struct Unidir u;
+  unidir_init(&u, cfg, pool, info, qps, 0);
+  struct Prof prof;
+  struct OpLoop l = {.qp = qp,
+                     .cq = cq,
+                     .remote = info,
+                     .lkey = pool->mr->lkey,
+                     .iters = cfg->iters,
+                     .window = cfg->window,
+                     .next = unidir_next,
+                     .post = cfg->qpx ? unidir_post : NULL,
+                     .arg = &u,
+                     .prof = &prof};
+  struct Stats st;
+  struct OpErrors e;
+  prof_start(&prof);
+  int rc = run_ops(&l, &st, &e);
+  prof_stop(&prof);
+  free(u.pick.cdf);
+  enum Mode mode = cfg->mode;
+  size_t msg = cfg->msg;
+  uint64_t window = cfg->window;
+  if (rc < 0) {
+    printf("[client] %s failed after %lu ops: rnr_retry_exc=%lu "
+           "retry_exc=%lu flushed=%lu (msg=%zu bytes, window=%lu)\n",
+           mode_str(mode), (unsigned long)st.ops, (unsigned long)e.rnr_exc,
+           (unsigned long)e.retry_exc, (unsigned long)e.flushed, msg,
+           (unsigned long)window);
+    return -1;
+  }
+
+  double sec = st.ns / 1e9;
+  double mops = stats_mops(&st);
+  printf("[client] %s done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, window=%lu, "
+         "qps=%d%s%s, verify=%s, post=%s)\n",
+         mode_str(mode), mops, stats_gibs(&st), msg, (unsigned long)window,
+         qps, qps > 1 ? "/" : "", qps > 1 ? qp_select_str(cfg->select) : "",
+         verify_str(cfg->verify), cfg->qpx ? "ex" : "legacy");
+  if (cr)
+    printf("[client] credit stalls: %.3f ms (%.1f%% of run)\n",
+           cr->stall_ns / 1e6, cr->stall_ns / 1e9 / sec * 100);
+  prof_report("client", &prof, cfg->iters);
+  return mops;
+}
+
+static int cmp_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report_lat(const char *what, int64_t *v, uint64_t n) {
+  qsort(v, n, sizeof(*v), cmp_i64);
+  printf("[client]   %-16s p50=%ld ns p99=%ld ns p99.9=%ld ns\n", what,
+         (long)v[n / 2], (long)v[n * 99 / 100], (long)v[n * 999 / 1000]);
+}
+
+// --hw-ts: one op in flight, each timed three ways: host post to host
+// poll, host post to the NIC's completion timestamp, and that timestamp to
+// the host poll. The last is the polling and software delay that a
+// CPU-side measurement folds into latency. When the device clock cannot be
+// placed on the host clock, the gaps between consecutive completions are
+// compared instead.
+struct Latency {
+  struct HwTs *h;
+  struct WrOp op;
+  uint64_t remote_slots;
+  uint64_t *post, *seen, *ts; // host and NIC clocks, by op
+};
+
+static int latency_next(void *arg, uint64_t i, uint64_t now,
+                        struct WrOp *op) {
+  struct Latency *t = arg;
+  (void)now;
+  *op = t->op;
+  if (op->mode == MODE_WRITE_IMM)
+    op->offset = (i % t->remote_slots) * op->len;
+  t->post[i] = hwts_host_ns(t->h);
+  return 0;
+}
+
+static int latency_poll(void *arg, int max, struct ibv_wc *wc) {
+  struct Latency *t = arg;
+  uint64_t ts;
+  (void)max;
+  hwts_poll(t->h, wc, &ts);
+  t->seen[wc->wr_id] = hwts_host_ns(t->h);
+  t->ts[wc->wr_id] = ts;
+  return 1;
+}
+
+static int run_latency(struct ibv_qp **qp, struct HwTs *h,
+                       const struct TxPool *pool, const struct Info *info,
+                       enum Mode mode, size_t msg, uint64_t iters) {
+  uint64_t *post = malloc(iters * sizeof(*post));
+  uint64_t *seen = malloc(iters * sizeof(*seen));
+  uint64_t *ts = malloc(iters * sizeof(*ts));
+  int64_t *v = malloc(iters * sizeof(*v));
+  if (!post || !seen || !ts || !v)
+    die("malloc");
+  struct Latency t = {h, {mode, 0, (uint32_t)msg, pool->base, 0, 0},
+                      info->len / msg, post, seen, ts};
+  struct OpLoop l = {.qp = qp,
+                     .cq = h->cq,
+                     .remote = info,
+                     .lkey = pool->mr->lkey,
+                     .iters = iters,
+                     .window = 1,
+                     .next = latency_next,
+                     .poll = latency_poll,
+                     .arg = &t};
+  struct Stats st;
+  struct OpErrors e;
+  hwts_sync(h, 0);
+  int rc = run_ops(&l, &st, &e);
+  hwts_sync(h, 1);
+
+  if (!rc) {
+    printf("[client] %s latency (msg=%zu bytes, one in flight, %lu ops):\n",
+           mode_str(mode), msg, (unsigned long)iters);
+    for (uint64_t i = 0; i < iters; ++i)
+      v[i] = (int64_t)(seen[i] - post[i]);
+    report_lat("host post->poll:", v, iters);
+  }
+  if (!rc && h->cqx && hwts_mapped(h)) {
+    for (uint64_t i = 0; i < iters; ++i)
+      v[i] = (int64_t)(hwts_to_host(h, ts[i]) - post[i]);
+    report_lat("post->NIC CQE:", v, iters);
+    for (uint64_t i = 0; i < iters; ++i)
+      v[i] = (int64_t)(seen[i] - hwts_to_host(h, ts[i]));
+    report_lat("NIC CQE->poll:", v, iters);
+  } else if (!rc && h->cqx && h->khz && iters > 1) {
+    for (uint64_t i = 1; i < iters; ++i)
+      v[i - 1] = (int64_t)hwts_ticks_to_ns(h, ts[i] - ts[i - 1]);
+    report_lat("NIC CQE gap:", v, iters - 1);
+    for (uint64_t i = 1; i < iters; ++i)
+      v[i - 1] = (int64_t)(seen[i] - seen[i - 1]);
+    report_lat("host poll gap:", v, iters - 1);
+  }
+  free(post);
+  free(seen);
+  free(ts);
+  free(v);
+  return rc;
+}
+
+// run_unidir() between two port counter snapshots of `id`'s port, so
+// every sweep point reports its own wire traffic and fabric events.
+static double run_point(struct rdma_cm_id *id, struct ibv_qp **qp, int qps,
+                        struct ibv_cq *cq, const struct TxPool *pool,
+                        const struct Info *info, const struct RunCfg *cfg) {
+  long long hw0[HW_COUNTERS], hw1[HW_COUNTERS];
+  hw_counters_read(id, hw0);
+  uint64_t t0 = now_ns();
+  double mops = run_unidir(qp, qps, cq, pool, info, cfg);
+  struct Stats st = {cfg->iters, cfg->iters * cfg->msg, now_ns() - t0};
+  hw_counters_read(id, hw1);
+  hw_counters_report("client", hw0, hw1, mops < 0 ? NULL : &st,
+                     cfg->mode == MODE_READ);
+  return mops;
+}
+
+// --rate: the open loop. Op i is due at t0 + i / rate whatever has
+// completed, as if a token bucket gained one token every 1 / rate. It is
+// posted once it is due and the window has room, and its latency runs
+// from when it was due, so time spent queued behind a full window counts
+// instead of being omitted. Fills `lat` (ns, by op) and returns the
+// achieved Mops.
+static double run_open_loop(struct ibv_qp **qp, int qps, struct ibv_cq *cq,
+                            const struct TxPool *pool,
+                            const struct Info *info, const struct RunCfg *cfg,
+                            double rate, uint64_t *lat) {
+  struct Unidir u;
+  unidir_init(&u, cfg, pool, info, qps, 1e9 / rate);
+  struct OpLoop l = {.qp = qp,
+                     .cq = cq,
+                     .remote = info,
+                     .lkey = pool->mr->lkey,
+                     .iters = cfg->iters,
+                     .window = cfg->window,
+                     .next = unidir_next,
+                     .arg = &u,
+                     .lat = lat};
+  struct Stats st;
+  run_ops(&l, &st, NULL);
+  free(u.pick.cdf);
+  return stats_mops(&st);
+}
+
+// --rate: one open-loop point per offered rate, printed as a table of
+// latency against offered load. Percentages are of the closed-loop rate,
+// measured first at the same --msg and --window. Returns -1 if that
+// measurement failed.
+static int run_rates(struct rdma_cm_id *id, struct ibv_qp **qp, int qps,
+                     struct ibv_cq *cq, const struct TxPool *pool,
+                     const struct Info *info, const struct RunCfg *cfg,
+                     const double *rates, int n, enum RateUnit unit) {
+  double cap = 0;
+  if (unit == RATE_PCT &&
+      (cap = run_point(id, qp, qps, cq, pool, info, cfg)) < 0)
+    return -1;
+  uint64_t iters = cfg->iters;
+  uint64_t *lat = malloc(iters * sizeof(*lat));
+  if (!lat)
+    die("malloc");
+  printf("[client] %s open loop (msg=%zu bytes, window=%lu, %lu ops per "
+         "point):\n",
+         mode_str(cfg->mode), cfg->msg, (unsigned long)cfg->window,
+         (unsigned long)iters);
+  printf("[client]   %6s %10s %10s %9s %9s %9s %9s\n", "load", "offered",
+         "achieved", "p50", "p99", "p99.9", "max");
+  for (int i = 0; i < n; ++i) {
+    double mops = unit == RATE_MOPS   ? rates[i]
+                  : unit == RATE_GBPS ? rates[i] * 1e3 / (8.0 * cfg->msg)
+                                      : rates[i] / 100 * cap;
+    double got =
+        run_open_loop(qp, qps, cq, pool, info, cfg, mops * 1e6, lat);
+    qsort(lat, iters, sizeof(*lat), cmp_u64);
+    char load[16] = "-";
+    if (unit == RATE_PCT)
+      snprintf(load, sizeof(load), "%.0f%%", rates[i]);
+    printf("[client]   %6s %5.3f Mops %5.3f Mops %6.2f us %6.2f us %6.2f us "
+           "%6.2f us\n",
+           load, mops, got, percentile(lat, iters, 0.5) / 1e3,
+           percentile(lat, iters, 0.99) / 1e3,
+           percentile(lat, iters, 0.999) / 1e3, lat[iters - 1] / 1e3);
+  }
+  free(lat);
+  return 0;
+}
+
+// A --mixed server: reads and writes must fit its whole buffer, and each
+// send or write_imm takes one of its --msg sized receives. It runs
+// without credits, so with any of those in the mix `window` must not
+// outrun the receives it keeps posted.
+static void check_mixed_server(const struct Info *info, uint64_t max_size,
+                               uint64_t max_recv, uint64_t window) {
+  if (max_size > info->len) {
+    fprintf(stderr, "server buffer is %u bytes, the largest op %lu; raise "
+                    "the server's --msg or --recv-depth\n",
+            info->len, (unsigned long)max_size);
+    exit(1);
+  }
+  if (!max_recv)
+    return;
+  if (!info->slot) {
+    fprintf(stderr, "server posts no receives; run it with --mixed on "
+                    "one QP\n");
+    exit(1);
+  }
+  if (max_recv > info->slot) {
+    fprintf(stderr, "server receives are %u bytes, the largest send or "
+                    "write_imm %lu; raise the server's --msg\n",
+            info->slot, (unsigned long)max_recv);
+    exit(1);
+  }
+  uint64_t depth = info->len / info->slot;
+  if (window > depth) {
+    fprintf(stderr, "--window %lu exceeds the server's %lu receives; lower "
+                    "it or raise the server's --recv-depth\n",
+            (unsigned long)window, (unsigned long)depth);
+    exit(1);
+  }
+}
+
+// --workload: `iters` ops drawn from the spec's classes, on one QP so
+// that small ops queue behind large ones as they would in production.
+// Closed arrivals keep `window` ops in flight. Open ones are due at the
+// spec's arrival times and, as with --rate, their latency runs from when
+// they were due. Reports the rate and latency of every class.
+struct WlRun {
+  struct Workload *wl;
+  const struct TxPool *pool;
+  uint8_t *cls; // by op
+  uint64_t bytes[WL_CLASSES];
+  uint64_t size, next_due; // of the next op
+  int c, open;
+};
+
+// Every op targets the start of the server's buffer: the mix, not the
+// addresses, is what this measures.
+static int workload_next(void *arg, uint64_t i, uint64_t now,
+                         struct WrOp *op) {
+  struct WlRun *r = arg;
+  if (r->open && r->next_due > now)
+    return 1;
+  *op = (struct WrOp){r->wl->cls[r->c].mode, 0, (uint32_t)r->size,
+                      pool_slot(r->pool, i), 0, r->open ? r->next_due : now};
+  r->cls[i] = (uint8_t)r->c;
+  r->bytes[r->c] += r->size;
+  r->c = wl_next(r->wl, &r->size);
+  if (r->open)
+    r->next_due = wl_arrival(r->wl, r->next_due);
+  return 0;
+}
+
+static void run_workload(struct ibv_qp **qp, struct ibv_cq *cq,
+                         const struct TxPool *pool, const struct Info *info,
+                         struct Workload *wl, uint64_t iters,
+                         uint64_t window) {
+  check_mixed_server(info, wl->max_size, wl->max_recv, window);
+  uint64_t *lat = malloc(iters * sizeof(*lat));
+  uint64_t *tmp = malloc(iters * sizeof(*tmp));
+  uint8_t *cls = malloc(iters);
+  if (!lat || !tmp || !cls)
+    die("malloc");
+  struct WlRun r = {wl, pool, cls, {0}, 0, 0, 0,
+                    wl->arrival != ARRIVAL_CLOSED};
+  r.c = wl_next(wl, &r.size);
+  struct OpLoop l = {.qp = qp,
+                     .cq = cq,
+                     .remote = info,
+                     .lkey = pool->mr->lkey,
+                     .iters = iters,
+                     .window = window,
+                     .next = workload_next,
+                     .arg = &r,
+                     .lat = lat};
+  struct Stats st;
+  run_ops(&l, &st, NULL);
+  double sec = st.ns / 1e9;
+
+  printf("[client] workload done: %.2f Mops, %.2f GiB/s (%lu ops, "
+         "window=%lu)\n",
+         stats_mops(&st), stats_gibs(&st), (unsigned long)iters,
+         (unsigned long)window);
+  printf("[client]   %-28s %6s %8s %8s %9s %9s %9s\n", "class", "share",
+         "Mops", "GiB/s", "p50", "p99", "p99.9");
+  for (int k = 0; k < wl->n; ++k) {
+    uint64_t m = 0;
+    for (uint64_t i = 0; i < iters; ++i)
+      if (cls[i] == k)
+        tmp[m++] = lat[i];
+    qsort(tmp, m, sizeof(*tmp), cmp_u64);
+    printf("[client]   %-28s %5.1f%% %8.3f %8.3f %6.2f us %6.2f us "
+           "%6.2f us\n",
+           wl->cls[k].name, 100.0 * m / iters, m / sec / 1e6,
+           r.bytes[k] / sec / (1024.0 * 1024.0 * 1024.0),
+           percentile(tmp, m, 0.5) / 1e3, percentile(tmp, m, 0.99) / 1e3,
+           percentile(tmp, m, 0.999) / 1e3);
+  }
+  free(lat);
+  free(tmp);
+  free(cls);
+}
+
+// --replay: reissue a trace. Op i is due at its timestamp divided by
+// `speed` (0: as soon as the window has room), on connection qp % qps,
+// at its offset folded into the server's buffer. As with --rate, latency
+// runs from when an op was due. The lag, how late each op was posted,
+// shows whether this client kept up with the trace's schedule.
+struct ReplayRun {
+  const struct Trace *tr;
+  const struct TxPool *pool;
+  const struct Info *info;
+  int qps;
+  double speed;
+  uint64_t *lag; // by op
+  uint64_t bytes[4], lag_max;
+};
+
+static int replay_next(void *arg, uint64_t i, uint64_t now,
+                       struct WrOp *op) {
+  struct ReplayRun *r = arg;
+  const struct TraceRec *rec = &r->tr->rec[i];
+  uint64_t at = r->speed > 0 ? (uint64_t)(rec->t_ns / r->speed) : now;
+  if (at > now)
+    return 1;
+  *op = (struct WrOp){(enum Mode)rec->mode, rec->qp % r->qps, rec->size,
+                      pool_slot(r->pool, i),
+                      rec->offset % (r->info->len - rec->size + 1), at};
+  r->lag[i] = now - at;
+  if (now - at > r->lag_max)
+    r->lag_max = now - at;
+  r->bytes[rec->mode] += rec->size;
+  return 0;
+}
+
+static void run_replay(struct ibv_qp **qp, int qps, struct ibv_cq *cq,
+                       const struct TxPool *pool, const struct Info *info,
+                       const struct Trace *tr, double speed,
+                       uint64_t window) {
+  check_mixed_server(info, tr->max_size, tr->max_recv, window);
+  uint64_t n = tr->n;
+  uint64_t *lat = malloc(n * sizeof(*lat));
+  uint64_t *tmp = malloc(n * sizeof(*tmp));
+  if (!lat || !tmp)
+    die("malloc");
+  struct ReplayRun r = {tr, pool, info, qps, speed, tmp, {0}, 0};
+  struct OpLoop l = {.qp = qp,
+                     .cq = cq,
+                     .remote = info,
+                     .lkey = pool->mr->lkey,
+                     .iters = n,
+                     .window = window,
+                     .next = replay_next,
+                     .arg = &r,
+                     .lat = lat};
+  struct Stats st;
+  run_ops(&l, &st, NULL);
+  double sec = st.ns / 1e9;
+
+  qsort(tmp, n, sizeof(*tmp), cmp_u64);
+  printf("[client] replay done: %.2f Mops, %.2f GiB/s (%lu ops in %.3f s, "
+         "speed=%g, window=%lu), lag p99=%.2f us max=%.2f us\n",
+         stats_mops(&st), stats_gibs(&st), (unsigned long)n, sec, speed,
+         (unsigned long)window, percentile(tmp, n, 0.99) / 1e3,
+         r.lag_max / 1e3);
+  printf("[client]   %-10s %6s %8s %8s %9s %9s %9s\n", "op", "share", "Mops",
+         "GiB/s", "p50", "p99", "p99.9");
+  for (int m = MODE_READ; m <= MODE_WRITE_IMM; ++m) {
+    uint64_t c = 0;
+    for (uint64_t i = 0; i < n; ++i)
+      if (tr->rec[i].mode == m)
+        tmp[c++] = lat[i];
+    if (!c)
+      continue;
+    qsort(tmp, c, sizeof(*tmp), cmp_u64);
+    printf("[client]   %-10s %5.1f%% %8.3f %8.3f %6.2f us %6.2f us "
+           "%6.2f us\n",
+           mode_str((enum Mode)m), 100.0 * c / n, c / sec / 1e6,
+           r.bytes[m] / sec / (1024.0 * 1024.0 * 1024.0),
+           percentile(tmp, c, 0.5) / 1e3, percentile(tmp, c, 0.99) / 1e3,
+           percentile(tmp, c, 0.999) / 1e3);
+  }
+  free(lat);
+  free(tmp);
+}
+
+// --chunk: `iters` back-to-back transfers of `len` bytes through
+// run_xfer(), each timed on its own, between two port counter snapshots
+// per rail. ids[r] is the first QP of rail r.
+static void run_chunked(struct rdma_cm_id **ids, struct XferRail *rails,
+                        int nrails, char *local, enum Mode mode, size_t len,
+                        uint64_t chunk, uint64_t window, uint64_t iters) {
+  uint64_t *ns = calloc(iters, sizeof(*ns));
+  if (!ns)
+    die("calloc");
+  struct Xfer x = {mode, len, chunk, window, local};
+  struct Stats total = {0};
+  long long hw0[RAILS_MAX][HW_COUNTERS], hw1[RAILS_MAX][HW_COUNTERS];
+  for (int r = 0; r < nrails; ++r) {
+    rails[r].bytes = 0;
+    hw_counters_read(ids[r], hw0[r]);
+  }
+  for (uint64_t i = 0; i < iters; ++i) {
+    struct Stats st;
+    run_xfer(rails, nrails, &x, &st);
+    ns[i] = st.ns;
+    total.ops += st.ops;
+    total.bytes += st.bytes;
+    total.ns += st.ns;
+  }
+  for (int r = 0; r < nrails; ++r)
+    hw_counters_read(ids[r], hw1[r]);
+  qsort(ns, iters, sizeof(*ns), cmp_u64);
+  printf("[client] %s done: %.2f GiB/s, transfer p50=%.3f ms max=%.3f ms "
+         "(msg=%zu bytes, chunk=%lu, stripes=%d, window=%lu per QP, "
+         "rails=%d)\n",
+         mode_str(mode), stats_gibs(&total), percentile(ns, iters, 0.5) / 1e6,
+         ns[iters - 1] / 1e6, len, (unsigned long)chunk, rails[0].nqp,
+         (unsigned long)window, nrails);
+  for (int r = 0; r < nrails; ++r) {
+    // Each rail's share of the same elapsed time, and its own port.
+    struct Stats st = {0, rails[r].bytes, total.ns};
+    char who[64];
+    snprintf(who, sizeof(who), "client %s",
+             ibv_get_device_name(ids[r]->verbs->device));
+    if (nrails > 1)
+      printf("[%s] rail %d: %.2f GiB/s (%.1f%% of bytes)\n", who, r,
+             stats_gibs(&st),
+             total.bytes ? 100.0 * rails[r].bytes / total.bytes : 0);
+    hw_counters_report(nrails > 1 ? who : "client", hw0[r], hw1[r], &st,
+                       mode == MODE_READ);
+  }
+  free(ns);
+}
+
 int main(int argc, char **argv) {
   if (argc < 3) {
     usage(argv[0]);
     return 1;
   }
 
-  const char *ip = argv[1];
+  // "ip1,ip2,...": one rail per address. rdma_cm picks each rail's
+  // device from the route to its address.
+  char *ips[RAILS_MAX], *save = NULL, *t = strtok_r(argv[1], ",", &save);
+  int nrails = 0;
+  for (; t && nrails < RAILS_MAX; t = strtok_r(NULL, ",", &save))
+    ips[nrails++] = t;
+  if (!nrails || t) {
+    fprintf(stderr, "<server_ip> takes 1-%d comma-separated addresses\n",
+            RAILS_MAX);
+    return 1;
+  }
+  const char *ip = ips[0];
   int port = atoi(argv[2]);
   enum Mode mode = MODE_READ;
   size_t msg = 4096;
   uint64_t iters = 100000;
   uint64_t window = 64;
+  int bidir = 0;
+  int recv_depth = 128;
+  int rd_atomic = 0;
+  int qps = 1;
+  enum Verify verify = VERIFY_NONE;
+  uint64_t nbufs = 0;
+  size_t stride = 0;
+  int touch = 0;
+  enum BufBackend backend = BUF_HOST;
+  int detect_poll = 0;
+  int credits = 0;
+  struct Timers timers = {-1, -1, -1, -1};
+  enum Transport transport = TRANSPORT_RDMA;
+  int hw_ts = 0;
+  int post_api_ex = 0;
+  enum QpSelect select = QP_RR;
+  uint64_t chunk = 0;
+  int stripes = 0, iters_set = 0;
+  double rates[SWEEP_MAX];
+  int n_rates = 0;
+  struct Workload wl;
+  int workload = 0;
+  struct Trace trace;
+  int replay = 0;
+  double speed = 1;
+  enum RateUnit rate_unit = RATE_MOPS;
+  uint64_t msgs[SWEEP_MAX], windows[SWEEP_MAX], qp_counts[SWEEP_MAX];
+  int n_msgs = 0, n_windows = 0, n_qps = 0;
 
   for (int i = 3; i < argc; ++i) {
     if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
-      if (!strcmp(argv[i + 1], "send"))
-        mode = MODE_SEND;
-      else if (!strcmp(argv[i + 1], "write"))
-        mode = MODE_WRITE;
-      else
-        mode = MODE_READ;
-      i++;
+      if (mode_parse(argv[++i], &mode)) {
+        usage(argv[0]);
+        return 1;
+      }
     } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
-      msg = strtoull(argv[++i], NULL, 0);
+      uint64_t v;
+      if (size_parse(argv[++i], &v)) {
+        usage(argv[0]);
+        return 1;
+      }
+      msg = v;
     } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
       iters = strtoull(argv[++i], NULL, 0);
+      iters_set = 1;
+    } else if (!strcmp(argv[i], "--chunk") && i + 1 < argc) {
+      if (size_parse(argv[++i], &chunk) || !chunk) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--stripes") && i + 1 < argc) {
+      stripes = atoi(argv[++i]);
     } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
       window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--bidir")) {
+      bidir = 1;
+    } else if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
+      recv_depth = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--rd-atomic") && i + 1 < argc) {
+      rd_atomic = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--qps") && i + 1 < argc) {
+      qps = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--verify") && i + 1 < argc) {
+      i++;
+      if (!strcmp(argv[i], "full"))
+        verify = VERIFY_FULL;
+      else if (!strcmp(argv[i], "sample"))
+        verify = VERIFY_SAMPLE;
+      else if (!strcmp(argv[i], "none"))
+        verify = VERIFY_NONE;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--buffers") && i + 1 < argc) {
+      nbufs = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--buffer-stride") && i + 1 < argc) {
+      stride = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--touch")) {
+      touch = 1;
+    } else if (!strcmp(argv[i], "--hugepages")) {
+      backend = BUF_HUGE;
+    } else if (!strcmp(argv[i], "--detect") && i + 1 < argc) {
+      i++;
+      detect_poll = !strcmp(argv[i], "poll");
+      if (!detect_poll && strcmp(argv[i], "cq")) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--credits")) {
+      credits = 1;
+    } else if (!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+      timers.timeout = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--retry-cnt") && i + 1 < argc) {
+      timers.retry_cnt = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--rnr-retry") && i + 1 < argc) {
+      timers.rnr_retry = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--min-rnr-timer") && i + 1 < argc) {
+      timers.min_rnr_timer = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--transport") && i + 1 < argc) {
+      if (transport_parse(argv[++i], &transport)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--hw-ts")) {
+      hw_ts = 1;
+    } else if (!strcmp(argv[i], "--post-api") && i + 1 < argc) {
+      i++;
+      if (!strcmp(argv[i], "ex"))
+        post_api_ex = 1;
+      else if (strcmp(argv[i], "legacy")) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--qp-select") && i + 1 < argc) {
+      i++;
+      if (!strcmp(argv[i], "random"))
+        select = QP_RANDOM;
+      else if (!strcmp(argv[i], "zipf"))
+        select = QP_ZIPF;
+      else if (strcmp(argv[i], "rr")) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--workload") && i + 1 < argc) {
+      if (wl_parse(&wl, argv[++i]))
+        return 1;
+      workload = 1;
+    } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+      if (trace_load(argv[++i], &trace))
+        return 1;
+      replay = 1;
+    } else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+      char *end;
+      speed = strtod(argv[++i], &end);
+      if (*end || speed < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+      if (!(n_rates = parse_rate(argv[++i], rates, SWEEP_MAX, &rate_unit))) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--sweep-qps") && i + 1 < argc) {
+      if (!(n_qps = parse_sweep(argv[++i], qp_counts, SWEEP_MAX))) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--sweep-msg") && i + 1 < argc) {
+      if (!(n_msgs = parse_sweep(argv[++i], msgs, SWEEP_MAX))) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--sweep-window") && i + 1 < argc) {
+      if (!(n_windows = parse_sweep(argv[++i], windows, SWEEP_MAX))) {
+        usage(argv[0]);
+        return 1;
+      }
     } else {
       usage(argv[0]);
       return 1;
     }
   }
+  // A workload brings its own ops and sizes; buffers are sized for its
+  // largest op.
+  if (workload) {
+    if (n_msgs || n_windows || n_qps || n_rates || qps != 1 || bidir ||
+        hw_ts || chunk || stripes || verify != VERIFY_NONE || detect_poll ||
+        credits || post_api_ex || touch || transport != TRANSPORT_RDMA) {
+      fprintf(stderr, "--workload runs on one QP and sets the ops and "
+                      "sizes itself; it does not combine with sweeps, "
+                      "--qps, --rate, --bidir, --hw-ts, --chunk, --verify, "
+                      "--detect, --credits, --post-api ex, --touch or "
+                      "--transport\n");
+      return 1;
+    }
+    if (wl.max_size > (1ull << 31)) {
+      fprintf(stderr, "workload sizes must be at most 2 GiB\n");
+      return 1;
+    }
+    msg = wl.max_size;
+    wl_print(&wl, "client");
+  }
+  // A trace brings its ops, sizes, offsets and timing. Its QP indices
+  // fold onto --qps connections; a server serves more than one only for
+  // reads and writes.
+  if (replay) {
+    if (workload || n_msgs || n_windows || n_qps || n_rates || bidir ||
+        hw_ts || chunk || stripes || verify != VERIFY_NONE || detect_poll ||
+        credits || post_api_ex || touch || transport != TRANSPORT_RDMA) {
+      fprintf(stderr, "--replay sets the ops and sizes itself; it does not "
+                      "combine with --workload, sweeps, --rate, --bidir, "
+                      "--hw-ts, --chunk, --verify, --detect, --credits, "
+                      "--post-api ex, --touch or --transport\n");
+      return 1;
+    }
+    if (trace.two_sided && qps > 1) {
+      fprintf(stderr, "the trace sends; replay it with --qps 1\n");
+      return 1;
+    }
+    msg = trace.max_size;
+    trace_print(&trace, "client");
+    if (trace.nqp != qps)
+      printf("[client] trace uses %d QPs, replaying on %d\n", trace.nqp,
+             qps);
+  } else if (speed != 1) {
+    fprintf(stderr, "--speed needs --replay\n");
+    return 1;
+  }
+  // Without a sweep the single --msg/--window pair is a one-point sweep.
+  // Buffers, QP and CQ are sized for the largest point so every point runs
+  // over the same connection and registration.
+  if (!n_msgs)
+    msgs[n_msgs++] = msg;
+  // --hw-ts times one op at a time.
+  if (hw_ts && (n_windows || n_qps || bidir || qps != 1 ||
+                verify != VERIFY_NONE || detect_poll || credits ||
+                transport != TRANSPORT_RDMA)) {
+    fprintf(stderr, "--hw-ts runs one op in flight on one QP; it does not "
+                    "combine with --sweep-window, --sweep-qps, --bidir, "
+                    "--qps, --verify, --detect, --credits or --transport\n");
+    return 1;
+  }
+  if (hw_ts)
+    window = 1;
+  if (post_api_ex && (bidir || hw_ts || transport != TRANSPORT_RDMA)) {
+    fprintf(stderr, "--post-api ex applies to the one-directional RDMA "
+                    "loop\n");
+    return 1;
+  }
+  if (!n_windows)
+    windows[n_windows++] = window;
+  // --chunk turns each of --iters ops into one --msg transfer, split into
+  // --chunk WRs over --stripes QPs with --window chunks in flight per QP.
+  if (chunk || stripes) {
+    // run_xfer() never posts to a QP with no window.
+    int zero_window = 0;
+    for (int w = 0; w < n_windows; ++w)
+      zero_window |= !windows[w];
+    if (!chunk || stripes < 0 || (mode != MODE_READ && mode != MODE_WRITE) ||
+        zero_window || bidir || qps != 1 || n_qps || n_msgs > 1 ||
+        verify != VERIFY_NONE || detect_poll || credits || hw_ts ||
+        post_api_ex || nbufs > 1 || stride || touch ||
+        transport != TRANSPORT_RDMA || chunk > msgs[0] ||
+        chunk > (1ull << 31)) {
+      fprintf(stderr, "--chunk needs --mode read or write, --window >= 1 "
+                      "and one --msg no smaller than the chunk (at most "
+                      "2 GiB); use --stripes instead of --qps, and no "
+                      "--bidir, --sweep-msg, --sweep-qps, --verify, "
+                      "--detect, --credits, --hw-ts, --post-api ex, "
+                      "--buffers, --buffer-stride, --touch or "
+                      "--transport\n");
+      return 1;
+    }
+    // --stripes QPs on each rail.
+    qps = (stripes ? stripes : 1) * nrails;
+    if (!iters_set)
+      iters = 10;
+  }
+  // The open loop runs one --msg/--window point at each rate.
+  if (n_rates && (n_msgs > 1 || n_windows > 1 || n_qps || bidir || hw_ts ||
+                  chunk || verify != VERIFY_NONE || detect_poll || credits ||
+                  post_api_ex || transport != TRANSPORT_RDMA)) {
+    fprintf(stderr, "--rate runs one --msg/--window point; it does not "
+                    "combine with sweeps, --bidir, --hw-ts, --chunk, "
+                    "--verify, --detect, --credits, --post-api ex or "
+                    "--transport\n");
+    return 1;
+  }
+  if (nrails > 1 && !chunk) {
+    fprintf(stderr, "several server addresses (rails) need --chunk\n");
+    return 1;
+  }
+  // The largest QP count is connected once; each point uses a prefix.
+  if (!n_qps)
+    qp_counts[n_qps++] = (uint64_t)(qps > 0 ? qps : 0);
+  for (int i = 0; i < n_qps; ++i)
+    if (qp_counts[i] > (uint64_t)qps)
+      qps = qp_counts[i] > INT32_MAX ? INT32_MAX : (int)qp_counts[i];
+  msg = window = 0;
+  for (int i = 0; i < n_msgs; ++i)
+    if (msgs[i] > msg)
+      msg = msgs[i];
+  for (int i = 0; i < n_windows; ++i)
+    if (windows[i] > window)
+      window = windows[i];
+  if (bidir && (n_msgs > 1 || n_windows > 1 || n_qps > 1)) {
+    fprintf(stderr, "--bidir does not support sweeps\n");
+    return 1;
+  }
+  // The socket baselines run one plain point: no verbs-only options.
+  if (transport != TRANSPORT_RDMA) {
+    if (bidir || qps != 1 || verify != VERIFY_NONE || detect_poll ||
+        credits || nbufs > 1 || touch || backend != BUF_HOST ||
+        n_msgs > 1 || n_windows > 1 || n_qps > 1 || !msg || !window ||
+        !iters) {
+      fprintf(stderr, "--transport %s runs one --msg/--window point without "
+                      "--bidir, --qps, --verify, --detect, --credits, "
+                      "--buffers, --touch or --hugepages\n",
+              transport_str(transport));
+      return 1;
+    }
+    struct SockRun run = {transport, mode, msg, iters, window};
+    return sock_run_client(ip, port, &run);
+  }
+  if (bidir && (msg < sizeof(struct BidirStats) || recv_depth < 1)) {
+    fprintf(stderr, "--bidir needs --msg >= %zu and --recv-depth >= 1\n",
+            sizeof(struct BidirStats));
+    return 1;
+  }
+  if (qps < 1 ||
+      (qps > 1 && (bidir || mode == MODE_SEND || mode == MODE_WRITE_IMM))) {
+    fprintf(stderr, "--qps N>1 is only supported for read/write without "
+                    "--bidir\n");
+    return 1;
+  }
+  if (bidir && mode == MODE_WRITE_IMM) {
+    fprintf(stderr, "--bidir supports read, write and send\n");
+    return 1;
+  }
+  if (verify != VERIFY_NONE) {
+    if (bidir || (mode != MODE_SEND && mode != MODE_WRITE_IMM)) {
+      fprintf(stderr, "--verify needs --mode send or write_imm\n");
+      return 1;
+    }
+    for (int i = 0; i < n_msgs; ++i)
+      if (msgs[i] < sizeof(struct VerifyHdr)) {
+        fprintf(stderr, "--verify needs --msg >= %zu\n",
+                sizeof(struct VerifyHdr));
+        return 1;
+      }
+    printf("[client] verify=%s crc32c=%s\n", verify_str(verify),
+           crc32c_select());
+  }
+  if (detect_poll &&
+      (mode != MODE_WRITE || bidir || qps > 1 || n_msgs > 1 ||
+       n_windows > 1 || msg < sizeof(uint64_t) || msg % sizeof(uint64_t))) {
+    fprintf(stderr, "--detect poll needs --mode write on one QP, no sweep, "
+                    "and --msg a multiple of 8\n");
+    return 1;
+  }
+  if (credits && (bidir || (mode != MODE_SEND && mode != MODE_WRITE_IMM))) {
+    fprintf(stderr, "--credits needs --mode send or write_imm\n");
+    return 1;
+  }
+  // Verification and tail sequence numbers need a private slot per
+  // in-flight op.
+  int per_op_slots = verify != VERIFY_NONE || detect_poll;
+  if (!nbufs)
+    nbufs = per_op_slots ? window : 1;
+  if (!stride)
+    stride = msg;
+  if (stride < msg || (per_op_slots && nbufs < window) ||
+      (bidir && (nbufs > 1 || touch))) {
+    fprintf(stderr, "--buffer-stride must be >= --msg, --verify and "
+                    "--detect poll need --buffers >= --window, and --bidir "
+                    "uses its own buffers\n");
+    return 1;
+  }
+
+  if (timers.timeout > 31 || timers.retry_cnt > 7 || timers.rnr_retry > 7 ||
+      timers.min_rnr_timer > 31) {
+    fprintf(stderr, "--timeout and --min-rnr-timer take 0-31, --retry-cnt "
+                    "and --rnr-retry 0-7\n");
+    return 1;
+  }
 
   struct rdma_event_channel *ec = rdma_create_event_channel();
-  struct rdma_cm_id *id;
   struct rdma_cm_event *e;
-  if (rdma_create_id(ec, &id, NULL, RDMA_PS_TCP))
-    die("create_id");
-
-  struct addrinfo *res;
-  char ps[16];
-  snprintf(ps, sizeof(ps), "%d", port);
-  if (getaddrinfo(ip, ps, NULL, &res))
-    die("getaddrinfo");
-
-  if (rdma_resolve_addr(id, NULL, res->ai_addr, 2000))
-    die("resolve_addr");
-  if (rdma_get_cm_event(ec, &e))
-    die("event1");
-  rdma_ack_cm_event(e);
-  if (rdma_resolve_route(id, 2000))
-    die("resolve_route");
-  if (rdma_get_cm_event(ec, &e))
-    die("event2");
-  rdma_ack_cm_event(e);
 
   struct ibv_qp_init_attr qa = {0};
   qa.qp_type = IBV_QPT_RC;
   qa.cap.max_send_wr = (uint32_t)(window + 32);
-  qa.cap.max_recv_wr = 4;
+  qa.cap.max_recv_wr = bidir ? (uint32_t)recv_depth + 16 : CREDIT_RECVS + 4;
+  // Many-QP runs are read/write only and receive nothing, so their QPs get
+  // a minimal receive queue and all of them share one CQ instead of each
+  // getting a private receive CQ and channel from librdmacm.
+  if (qps > 1)
+    qa.cap.max_recv_wr = 1;
   qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
   qa.sq_sig_all = 0;
-  if (rdma_create_qp(id, id->pd, &qa))
-    die("create_qp");
 
+  // In --bidir mode the client is also a target: buf holds recv_depth
+  // receive slots (slot 0 is exposed to the server) plus a TX slot, and is
+  // registered and pre-posted before connecting so the server can start
+  // immediately.
+  size_t buf_len = bidir ? msg * ((size_t)recv_depth + 1) : nbufs * stride;
+  char *buf = NULL;
+  struct ibv_mr *mr = NULL;
+  struct ibv_cq *cq = NULL;
+  struct HwTs hts;
+  struct Info info, mine;
   struct rdma_conn_param p = {0};
-  p.initiator_depth = 16;
-  p.responder_resources = 16;
-
-  if (rdma_connect(id, &p))
-    die("connect");
+  struct rdma_cm_id **ids = calloc((size_t)qps, sizeof(*ids));
+  struct ibv_qp_ex **qpx = calloc((size_t)qps, sizeof(*qpx));
+  struct XferRail rails[RAILS_MAX] = {0};
+  struct Buf rail_buf[RAILS_MAX] = {0};
+  if (!ids || !qpx)
+    die("calloc");
 
-  if (rdma_get_cm_event(ec, &e))
-    die("event3");
-  struct Info info;
-  memcpy(&info, e->param.conn.private_data, sizeof(info));
-  rdma_ack_cm_event(e);
-  if (info.len < msg) {
-    fprintf(stderr, "server buffer too small (%u < %zu)\n", info.len, msg);
-    return 1;
-  }
-
-  char *buf = NULL;
-  if (posix_memalign((void **)&buf, 4096, msg))
-    die("alloc");
-  memset(buf, 0xab, msg);
-
-  int access = IBV_ACCESS_LOCAL_WRITE;
-  struct ibv_mr *mr = ibv_reg_mr(id->pd, buf, msg, access);
-  if (!mr)
-    die("reg_mr");
-
-  uint64_t posted = 0, done = 0;
-  struct ibv_wc wc[32];
-  struct timespec ts0, ts1;
-  clock_gettime(CLOCK_MONOTONIC, &ts0);
-
-  while (done < iters) {
-    while (posted - done < window && posted < iters) {
-      struct ibv_sge s = {
-          .addr = (uintptr_t)buf, .length = (uint32_t)msg, .lkey = mr->lkey};
-      struct ibv_send_wr wr = {0}, *bad = NULL;
-      wr.wr_id = posted;
-      wr.sg_list = &s;
-      wr.num_sge = 1;
-      wr.send_flags = IBV_SEND_SIGNALED;
-
-      if (mode == MODE_READ) {
-        wr.opcode = IBV_WR_RDMA_READ;
-        wr.wr.rdma.remote_addr = info.addr;
-        wr.wr.rdma.rkey = info.rkey;
-      } else if (mode == MODE_WRITE) {
-        wr.opcode = IBV_WR_RDMA_WRITE;
-        wr.wr.rdma.remote_addr = info.addr;
-        wr.wr.rdma.rkey = info.rkey;
+  // All QPs of a rail share one send CQ and, through librdmacm's
+  // per-device PD, one registration of the buffer: rail 0 allocates it and
+  // the others wrap it. QP q is on rail q % nrails; rail 0's CQ and MR are
+  // the `cq` and `mr` used everywhere else.
+  uint64_t conn0 = now_ns();
+  for (int q = 0; q < qps; ++q) {
+    int r = q % nrails;
+    struct rdma_cm_id *id = rb_resolve(ec, ips[r], port, AF_UNSPEC);
+    ids[q] = id;
+    if (q == 0) {
+      rd_atomic_limits(id->verbs, rd_atomic, &p.initiator_depth,
+                       &p.responder_resources);
+      timers_set_param(&p, &timers);
+    }
+    if (q < nrails) {
+      if (hw_ts) {
+        hwts_create_cq(&hts, id->verbs, (int)window + 32, "client");
+        rails[r].cq = hts.cq;
+      } else {
+        // A chunked transfer's window is per QP.
+        uint64_t cqe =
+            (chunk ? window * (uint64_t)(qps / nrails) : window) + 32;
+        rails[r].cq = ibv_create_cq(id->verbs, (int)cqe, NULL, NULL, 0);
+      }
+      if (!rails[r].cq)
+        die("create_cq");
+      int access = IBV_ACCESS_LOCAL_WRITE;
+      if (bidir)
+        access |= IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+      if (r == 0) {
+        buf_alloc(&rail_buf[0], id->pd, buf_len, access, backend);
+        buf = rail_buf[0].base;
+        memset(buf, 0xab, buf_len);
       } else {
-        wr.opcode = IBV_WR_SEND;
+        buf_wrap(&rail_buf[r], id->pd, buf, buf_len, access);
+      }
+      rails[r].lkey = rail_buf[r].mr->lkey;
+      if (q == 0) {
+        cq = rails[0].cq;
+        mr = rail_buf[0].mr;
+        // len is our receive ring, which caps the server's bidir window.
+        mine = (struct Info){(uint64_t)buf, mr->rkey,
+                             (uint32_t)(msg * (size_t)recv_depth),
+                             (uint32_t)msg};
+        if (bidir) {
+          p.private_data = &mine;
+          p.private_data_len = sizeof(mine);
+        }
       }
+    }
 
-      if (ibv_post_send(id->qp, &wr, &bad))
-        die("post_send");
-      posted++;
+    qa.send_cq = rails[r].cq;
+    if (qps > 1)
+      qa.recv_cq = rails[r].cq;
+    if (post_api_ex) {
+      // The ibv_wr_* builders need a QP created with the opcodes they
+      // will use.
+      struct ibv_qp_init_attr_ex qx = {0};
+      qx.qp_type = qa.qp_type;
+      qx.send_cq = qa.send_cq;
+      qx.recv_cq = qa.recv_cq;
+      qx.cap = qa.cap;
+      qx.sq_sig_all = qa.sq_sig_all;
+      qx.pd = id->pd;
+      qx.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+      qx.send_ops_flags =
+          IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_RDMA_WRITE |
+          IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM | IBV_QP_EX_WITH_SEND;
+      if (rdma_create_qp_ex(id, &qx))
+        die("create_qp_ex (no ibv_wr_* support? try --post-api legacy)");
+      qpx[q] = ibv_qp_to_qp_ex(id->qp);
+    } else if (rdma_create_qp(id, id->pd, &qa)) {
+      die("create_qp");
     }
+    if (bidir)
+      for (int i = 0; i < recv_depth; ++i)
+        post_recv_slot(id, buf, mr, msg, i);
+    if (credits)
+      for (int i = 0; i < CREDIT_RECVS; ++i)
+        post_credit_recv(id);
 
-    int n = ibv_poll_cq(id->send_cq, 32, wc);
-    if (n < 0)
-      die("poll_cq");
-    for (int i = 0; i < n; ++i) {
-      if (wc[i].status) {
-        printf("RDMA error: wr_id=%lu status=%d(%s) vendor_err=0x%x\n",
-               wc[i].wr_id, wc[i].status, ibv_wc_status_str(wc[i].status),
-               wc[i].vendor_err);
-        die("wc");
-      }
-      done++;
+    timers_set_id(id, &timers);
+    if (rdma_connect(id, &p))
+      die("connect");
+    if (rdma_get_cm_event(ec, &e))
+      die("event3");
+    if (e->event != RDMA_CM_EVENT_ESTABLISHED) {
+      fprintf(stderr, "connect %d failed: %s\n", q, rdma_event_str(e->event));
+      return 1;
+    }
+    // The server registers its buffer once per device, so each rail
+    // gets its own rkey.
+    memcpy(&rails[r].remote, e->param.conn.private_data, sizeof(info));
+    rdma_ack_cm_event(e);
+  }
+  info = rails[0].remote;
+  // A chunked transfer wraps over the server's buffer; it only needs to
+  // hold one chunk.
+  for (int r = 0; r < nrails; ++r)
+    if (rails[r].remote.len < (chunk ? chunk : msg)) {
+      fprintf(stderr, "server buffer too small (%u < %zu)\n",
+              rails[r].remote.len, (size_t)(chunk ? chunk : msg));
+      return 1;
     }
+  for (int r = 0; r < nrails; ++r) {
+    rails[r].nqp = qps / nrails;
+    rails[r].qp = calloc((size_t)rails[r].nqp, sizeof(*rails[r].qp));
+    if (!rails[r].qp)
+      die("calloc");
+    for (int q = r; q < qps; q += nrails)
+      rails[r].qp[q / nrails] = ids[q]->qp;
+    if (nrails > 1)
+      printf("[client] rail %d: %s via %s, %d QPs\n", r, ips[r],
+             ibv_get_device_name(ids[r]->verbs->device), rails[r].nqp);
+  }
+
+  // Only --chunk runs more than one rail, so elsewhere rail 0 holds every
+  // QP.
+  struct ibv_qp **qp = rails[0].qp;
+  if (qps > 1)
+    printf("[client] %d QPs connected in %.1f s\n", qps,
+           (now_ns() - conn0) / 1e9);
+
+  uint8_t rd_init = report_rd_atomic(ids[0]->qp, "client");
+  for (int q = 0; q < qps; ++q)
+    timers_set_qp(ids[q]->qp, &timers, q ? NULL : "client");
+  if (mode == MODE_READ && chunk && window > rd_init)
+    printf("[client] note: window=%lu chunks per QP exceeds %u outstanding "
+           "READs\n",
+           (unsigned long)window, rd_init);
+  else if (mode == MODE_READ && window > (uint64_t)rd_init * qps)
+    printf("[client] note: window=%lu exceeds %d QP(s) x %u outstanding "
+           "READs; try --qps %lu\n",
+           (unsigned long)window, qps, rd_init,
+           (unsigned long)((window + rd_init - 1) / rd_init));
+
+  struct TxPool pool = {buf, mr, nbufs, stride, touch};
+  if (nbufs > 1 || touch || backend != BUF_HOST)
+    printf("[client] buffers: %lu x %zu bytes (%.1f MiB)%s%s\n",
+           (unsigned long)nbufs, stride, buf_len / (1024.0 * 1024.0),
+           rail_buf[0].backend == BUF_HUGE ? " on hugepages" : "",
+           touch ? ", touched before post" : "");
+
+  // The server grants its whole receive ring right after accepting.
+  struct Credits cr = {ids[0], 0, 0};
+  if (credits) {
+    while (!cr.avail)
+      credits_poll(&cr);
+    printf("[client] credits: %lu initial\n", (unsigned long)cr.avail);
   }
 
-  clock_gettime(CLOCK_MONOTONIC, &ts1);
-  double sec = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
-  double mops = iters / sec / 1e6;
-  double bw = (iters * msg) / sec / (1024.0 * 1024.0 * 1024.0);
-  const char *mstr =
-      mode == MODE_READ ? "read" : (mode == MODE_WRITE ? "write" : "send");
-  printf(
-      "[client] %s done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, window=%lu)\n",
-      mstr, mops, bw, msg, (unsigned long)window);
+  long long hw0[HW_COUNTERS], hw1[HW_COUNTERS];
+  if (bidir)
+    hw_counters_read(ids[0], hw0);
+  struct CpuUsage cpu;
+  cpu_usage_start(&cpu);
+  // A point that ran out of retries leaves its QP in error, so it ends the
+  // sweep.
+  int failed = 0;
+  if (bidir)
+    run_bidir(ids[0], cq, mode, buf, mr, msg, recv_depth, iters, window,
+              &info, "client");
+  else if (chunk)
+    for (int w = 0; w < n_windows; ++w)
+      run_chunked(ids, rails, nrails, buf, mode, msg, chunk, windows[w],
+                  iters);
+  else if (workload)
+    run_workload(qp, cq, &pool, &info, &wl, iters, windows[0]);
+  else if (replay)
+    run_replay(qp, qps, cq, &pool, &info, &trace, speed, windows[0]);
+  else if (n_rates) {
+    struct RunCfg cfg = {mode, VERIFY_NONE, msgs[0], iters, windows[0], 0,
+                         NULL, NULL, select};
+    failed = run_rates(ids[0], qp, qps, cq, &pool, &info, &cfg, rates,
+                       n_rates, rate_unit) < 0;
+  } else if (hw_ts)
+    for (int m = 0; m < n_msgs && !failed; ++m)
+      failed =
+          run_latency(qp, &hts, &pool, &info, mode, msgs[m], iters) < 0;
+  else
+    for (int m = 0; m < n_msgs && !failed; ++m)
+      for (int w = 0; w < n_windows && !failed; ++w) {
+        double curve[SWEEP_MAX];
+        int k;
+        for (k = 0; k < n_qps; ++k) {
+          // Verified points run twice, so the checksum cost shows up as
+          // the gap between the two records.
+          struct RunCfg cfg = {mode, VERIFY_NONE, msgs[m], iters, windows[w],
+                               detect_poll, credits ? &cr : NULL,
+                               post_api_ex ? qpx : NULL, select};
+          int nq = (int)qp_counts[k];
+          double base =
+              run_point(ids[0], qp, nq, cq, &pool, &info, &cfg);
+          if (base < 0) {
+            failed = 1;
+            break;
+          }
+          curve[k] = base;
+          if (verify == VERIFY_NONE)
+            continue;
+          cfg.verify = verify;
+          double v = run_point(ids[0], qp, nq, cq, &pool, &info, &cfg);
+          if (v < 0) {
+            failed = 1;
+            break;
+          }
+          printf("[client] verify=%s overhead: %.1f%% Mops\n",
+                 verify_str(verify), base > 0 ? (1 - v / base) * 100 : 0);
+        }
+        // The QP-count sweep as one line per (msg, window): QPs=Mops.
+        if (n_qps > 1 && k > 0) {
+          printf("[client] Mops vs QPs (msg=%zu bytes, window=%lu, "
+                 "select=%s):",
+                 (size_t)msgs[m], (unsigned long)windows[w],
+                 qp_select_str(select));
+          for (int i = 0; i < k; ++i)
+            printf(" %lu=%.2f", (unsigned long)qp_counts[i], curve[i]);
+          printf("\n");
+        }
+      }
+  cpu_usage_stop(&cpu);
+  // Both directions share the port, so a --bidir run gets no app/wire.
+  if (bidir) {
+    hw_counters_read(ids[0], hw1);
+    hw_counters_report("client", hw0, hw1, NULL, 0);
+  }
+  // Comparable with a --transport run only for one plain point.
+  if (!failed && !bidir && !hw_ts && verify == VERIFY_NONE && n_msgs == 1 &&
+      n_windows == 1 && n_qps == 1 && !n_rates && !workload && !replay)
+    cpu_usage_report("client", &cpu, iters * msg);
 
-  rdma_disconnect(id);
-  ibv_dereg_mr(mr);
-  free(buf);
-  rdma_destroy_qp(id);
-  rdma_destroy_id(id);
+  for (int q = 0; q < qps; ++q)
+    rdma_disconnect(ids[q]);
+  // The wrapped registrations go before rail 0 frees the memory.
+  for (int r = nrails - 1; r >= 0; --r)
+    buf_free(&rail_buf[r]);
+  if (replay)
+    free(trace.rec);
+  for (int q = 0; q < qps; ++q) {
+    rdma_destroy_qp(ids[q]);
+    rdma_destroy_id(ids[q]);
+  }
+  for (int r = 0; r < nrails; ++r) {
+    ibv_destroy_cq(rails[r].cq);
+    free(rails[r].qp);
+  }
+  free(ids);
+  free(qpx);
   rdma_destroy_event_channel(ec);
-  freeaddrinfo(res);
-  return 0;
+  return failed;
 }
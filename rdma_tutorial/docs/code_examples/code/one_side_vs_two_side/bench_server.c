@@ -1,32 +1,133 @@
-// gcc bench_server.c -o bench_server -lrdmacm -libverbs
+// gcc -O3 bench_server.c ../librdmabench/*.c -o bench_server -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
 #include <arpa/inet.h>
-#include <infiniband/verbs.h>
-#include <rdma/rdma_cma.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
 
-struct Info {
-  uint64_t addr;
-  uint32_t rkey, len;
-} __attribute__((packed));
+struct VerifyStats {
+  uint64_t checked, bad, unstamped, last_seq;
+};
 
-enum Mode { MODE_READ, MODE_WRITE, MODE_SEND };
-
-static void die(const char *m) {
-  perror(m);
-  exit(1);
+// Check one received message. Unstamped messages (the client's baseline
+// pass, or the ones --verify sample skips) are only counted. The magic is
+// cleared afterwards so a slot that is never rewritten cannot pass twice.
+static void verify_msg(struct VerifyStats *vs, char *p, uint32_t len) {
+  struct VerifyHdr h = {0};
+  if (len >= sizeof(h))
+    memcpy(&h, p, sizeof(h));
+  if (h.magic != VERIFY_MAGIC) {
+    vs->unstamped++;
+    return;
+  }
+  uint32_t got = h.crc;
+  h.crc = 0;
+  uint32_t want = crc32c(crc32c(0, &h, sizeof(h)), p + sizeof(h),
+                         len - sizeof(h));
+  // Sequence numbers restart at 0 with every client run.
+  int ordered = !vs->checked || h.seq == 0 || h.seq > vs->last_seq;
+  if (got != want || !ordered) {
+    if (vs->bad < 8)
+      fprintf(stderr,
+              "[server] verify: bad message seq=%lu len=%u crc=%08x "
+              "want=%08x%s\n",
+              (unsigned long)h.seq, len, got, want,
+              ordered ? "" : " (out of order)");
+    vs->bad++;
+  }
+  vs->checked++;
+  vs->last_seq = h.seq;
+  memset(p, 0, sizeof(h.magic));
 }
 
 static void usage(const char *p) {
   fprintf(stderr,
-          "Usage: %s <port> [--mode read|write|send] [--msg N] [--iters N] "
-          "[--recv-depth N]\n",
+          "Usage: %s <port> [--mode read|write|send|write_imm] [--msg N] "
+          "[--iters N] "
+          "[--recv-depth N] [--bidir] [--window N] [--rd-atomic N] [--qps N] "
+          "[--sweep] [--verify] [--detect cq|poll] [--credits] "
+          "[--credit-batch N] [--timeout N] [--retry-cnt N] [--rnr-retry N] "
+          "[--min-rnr-timer N] [--mixed] [--hugepages] "
+          "[--transport rdma|tcp|tcp-zerocopy|io_uring]\n",
           p);
 }
 
+// Where a receive completion's data landed: the posted slot for SEND, or
+// the ring offset carried in the immediate for RDMA WRITE_WITH_IMM.
+static char *recv_data(char *buf, size_t msg, const struct ibv_wc *wc) {
+  if (wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM)
+    return buf + ntohl(wc->imm_data);
+  return buf + (size_t)wc->wr_id * msg;
+}
+
+// --detect poll: spin on the last 8 bytes of each ring slot until the
+// client's sequence number for it shows up, and timestamp when each WRITE
+// becomes visible -- what a FaRM-style receiver does instead of taking a
+// write_imm completion. A slot already overwritten by a later lap of the
+// ring is counted as lapped. Returns 1 if the client disconnected first.
+static int run_detect_poll(struct rdma_event_channel *ec, const char *buf,
+                           size_t msg, int recv_depth, uint64_t iters) {
+  uint64_t *t = malloc(iters * sizeof(*t));
+  if (!t)
+    die("malloc");
+  int flags = fcntl(ec->fd, F_GETFL);
+  if (fcntl(ec->fd, F_SETFL, flags | O_NONBLOCK))
+    die("fcntl");
+  printf("[server] polling for %lu writes...\n", (unsigned long)iters);
+
+  uint64_t seen = 0, lapped = 0, spins = 0;
+  int disconnected = 0;
+  struct rdma_cm_event *e;
+  struct timespec ts;
+  for (uint64_t k = 1; k <= iters && !disconnected;) {
+    const uint64_t *tail =
+        (const uint64_t *)(buf + ((k - 1) % (uint64_t)recv_depth) * msg +
+                           msg - sizeof(uint64_t));
+    uint64_t v = __atomic_load_n(tail, __ATOMIC_ACQUIRE);
+    if (v < k) {
+      // Only look at the CM channel once in a while, so the spin stays on
+      // the buffer.
+      if (++spins % (1u << 20) == 0 && !rdma_get_cm_event(ec, &e)) {
+        disconnected = e->event == RDMA_CM_EVENT_DISCONNECTED;
+        rdma_ack_cm_event(e);
+      }
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (v == k)
+      t[seen++] = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    else
+      lapped++;
+    k++;
+  }
+  if (fcntl(ec->fd, F_SETFL, flags))
+    die("fcntl");
+
+  if (seen < 2) {
+    printf("[server] poll detect: %lu visible, %lu lapped\n",
+           (unsigned long)seen, (unsigned long)lapped);
+    free(t);
+    return disconnected;
+  }
+  double sec = (t[seen - 1] - t[0]) / 1e9;
+  double mops = (seen - 1) / sec / 1e6;
+  double bw = ((seen - 1) * msg) / sec / (1024.0 * 1024.0 * 1024.0);
+  // Gaps between consecutive detections, in place of the timestamps.
+  for (uint64_t i = 0; i + 1 < seen; ++i)
+    t[i] = t[i + 1] - t[i];
+  qsort(t, seen - 1, sizeof(*t), cmp_u64);
+  printf("[server] poll detect: %.2f Mops, %.2f GiB/s visible (%lu writes, "
+         "%lu lapped), gap p50=%lu ns p99=%lu ns\n",
+         mops, bw, (unsigned long)seen, (unsigned long)lapped,
+         (unsigned long)t[(seen - 1) / 2],
+         (unsigned long)t[(seen - 1) * 99 / 100]);
+  free(t);
+  return disconnected;
+}
+
 int main(int argc, char **argv) {
   if (argc < 2) {
     usage(argv[0]);
@@ -37,149 +138,417 @@ int main(int argc, char **argv) {
   size_t msg = 4096;
   uint64_t iters = 100000;
   int recv_depth = 128;
+  uint64_t window = 64;
+  int bidir = 0;
+  int rd_atomic = 0;
+  int qps = 1;
+  int sweep = 0;
+  int verify = 0;
+  int detect_poll = 0;
+  int credits = 0;
+  int credit_batch = 0;
+  int mixed = 0;
+  enum BufBackend backend = BUF_HOST;
+  struct Timers timers = {-1, -1, -1, -1};
+  enum Transport transport = TRANSPORT_RDMA;
   int port = atoi(argv[1]);
 
   for (int i = 2; i < argc; ++i) {
     if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
-      if (!strcmp(argv[i + 1], "send"))
-        mode = MODE_SEND;
-      else if (!strcmp(argv[i + 1], "write"))
-        mode = MODE_WRITE;
-      else
-        mode = MODE_READ;
-      i++;
+      if (mode_parse(argv[++i], &mode)) {
+        usage(argv[0]);
+        return 1;
+      }
     } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
-      msg = strtoull(argv[++i], NULL, 0);
+      uint64_t v;
+      if (size_parse(argv[++i], &v)) {
+        usage(argv[0]);
+        return 1;
+      }
+      msg = v;
     } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
       iters = strtoull(argv[++i], NULL, 0);
     } else if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
       recv_depth = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+      window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--bidir")) {
+      bidir = 1;
+    } else if (!strcmp(argv[i], "--rd-atomic") && i + 1 < argc) {
+      rd_atomic = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--qps") && i + 1 < argc) {
+      qps = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--sweep")) {
+      sweep = 1;
+    } else if (!strcmp(argv[i], "--verify")) {
+      verify = 1;
+    } else if (!strcmp(argv[i], "--detect") && i + 1 < argc) {
+      i++;
+      detect_poll = !strcmp(argv[i], "poll");
+      if (!detect_poll && strcmp(argv[i], "cq")) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--credits")) {
+      credits = 1;
+    } else if (!strcmp(argv[i], "--hugepages")) {
+      backend = BUF_HUGE;
+    } else if (!strcmp(argv[i], "--mixed")) {
+      mixed = 1;
+    } else if (!strcmp(argv[i], "--credit-batch") && i + 1 < argc) {
+      credit_batch = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+      timers.timeout = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--retry-cnt") && i + 1 < argc) {
+      timers.retry_cnt = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--rnr-retry") && i + 1 < argc) {
+      timers.rnr_retry = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--min-rnr-timer") && i + 1 < argc) {
+      timers.min_rnr_timer = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--transport") && i + 1 < argc) {
+      if (transport_parse(argv[++i], &transport)) {
+        usage(argv[0]);
+        return 1;
+      }
     } else {
       usage(argv[0]);
       return 1;
     }
   }
+  // The socket baselines run one plain point: no verbs-only options.
+  if (transport != TRANSPORT_RDMA) {
+    if (bidir || qps != 1 || sweep || verify || detect_poll || credits ||
+        mixed || backend != BUF_HOST || !msg) {
+      fprintf(stderr, "--transport %s does not support --bidir, --qps, "
+                      "--sweep, --verify, --detect, --credits, --mixed or "
+                      "--hugepages\n",
+              transport_str(transport));
+      return 1;
+    }
+    struct SockRun run = {transport, mode, msg, iters, window};
+    return sock_run_server(port, &run);
+  }
+  if (bidir && msg < sizeof(struct BidirStats)) {
+    fprintf(stderr, "--bidir needs --msg >= %zu\n", sizeof(struct BidirStats));
+    return 1;
+  }
+  // Info.len, the region the client may target, is 32 bits.
+  if (recv_depth > 0 && msg > UINT32_MAX / (uint64_t)recv_depth) {
+    fprintf(stderr, "--msg x --recv-depth must stay below 4 GiB\n");
+    return 1;
+  }
+  // Many --mixed QPs only respond to reads and writes.
+  int two_sided =
+      mode == MODE_SEND || mode == MODE_WRITE_IMM || (mixed && qps == 1);
+  if (qps < 1 || (qps > 1 && (bidir || two_sided))) {
+    fprintf(stderr, "--qps N>1 is only supported for read/write without "
+                    "--bidir\n");
+    return 1;
+  }
+  if (bidir && mode == MODE_WRITE_IMM) {
+    fprintf(stderr, "--bidir supports read, write and send\n");
+    return 1;
+  }
+  if (detect_poll && (mode != MODE_WRITE || bidir || qps > 1 ||
+                      msg < sizeof(uint64_t) || msg % sizeof(uint64_t))) {
+    fprintf(stderr, "--detect poll needs --mode write on one QP and --msg "
+                    "a multiple of 8\n");
+    return 1;
+  }
+  if (credits) {
+    if (!two_sided || bidir || recv_depth < 1) {
+      fprintf(stderr, "--credits needs --mode send or write_imm\n");
+      return 1;
+    }
+    // Every update in flight carries at least one batch, so this keeps the
+    // client's CREDIT_RECVS receives from running out.
+    int min_batch = (recv_depth + CREDIT_RECVS - 1) / CREDIT_RECVS;
+    if (credit_batch <= 0)
+      credit_batch = recv_depth / 8;
+    if (credit_batch < min_batch)
+      credit_batch = min_batch;
+    if (credit_batch > recv_depth)
+      credit_batch = recv_depth;
+    printf("[server] credits on, %d receives granted per update\n",
+           credit_batch);
+  }
+  if (mixed) {
+    if (bidir || verify || credits || detect_poll || recv_depth < 1) {
+      fprintf(stderr, "--mixed does not combine with --bidir, --verify, "
+                      "--credits or --detect\n");
+      return 1;
+    }
+    // A --workload or --replay client may read, write and send on the same
+    // QP, and its op count is not known up front.
+    sweep = 1;
+  }
+  if (verify) {
+    if (!two_sided || bidir) {
+      fprintf(stderr, "--verify needs --mode send or write_imm\n");
+      return 1;
+    }
+    // A verifying client sends an unverified baseline pass first, so the
+    // message count is not known up front.
+    sweep = 1;
+    printf("[server] verify on, crc32c=%s\n", crc32c_select());
+  }
+
+  if (timers.timeout > 31 || timers.retry_cnt > 7 || timers.rnr_retry > 7 ||
+      timers.min_rnr_timer > 31) {
+    fprintf(stderr, "--timeout and --min-rnr-timer take 0-31, --retry-cnt "
+                    "and --rnr-retry 0-7\n");
+    return 1;
+  }
 
   struct rdma_event_channel *ec = rdma_create_event_channel();
-  struct rdma_cm_id *lid, *id;
+  struct rdma_cm_id *lid = rb_listen(ec, NULL, port, qps), *id;
   struct rdma_cm_event *e;
-  struct sockaddr_in a = {0};
-  a.sin_family = AF_INET;
-  a.sin_port = htons(port);
-
-  if (rdma_create_id(ec, &lid, NULL, RDMA_PS_TCP))
-    die("create_id");
-  if (rdma_bind_addr(lid, (struct sockaddr *)&a))
-    die("bind");
-  if (rdma_listen(lid, 1))
-    die("listen");
-  printf("[server] listening on %d (mode=%s msg=%zu iters=%lu)\n", port,
-         mode == MODE_READ ? "read" : (mode == MODE_WRITE ? "write" : "send"),
-         msg, (unsigned long)iters);
-
-  if (rdma_get_cm_event(ec, &e))
-    die("get_event");
-  id = e->id;
-  rdma_ack_cm_event(e);
-
-  struct ibv_qp_init_attr qa = {0};
-  qa.qp_type = IBV_QPT_RC;
-  qa.cap.max_send_wr = recv_depth + 16;
-  qa.cap.max_recv_wr = recv_depth + 16;
-  qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
-  qa.sq_sig_all = 0;
-  if (rdma_create_qp(id, id->pd, &qa))
-    die("create_qp");
-
-  size_t buf_len = msg * recv_depth;
+  printf("[server] listening on %d (mode=%s msg=%zu iters=%lu%s)\n", port,
+         mixed ? "mixed" : mode_str(mode), msg, (unsigned long)iters,
+         bidir ? " bidir" : "");
+
+  // In --bidir mode one extra msg slot after the receive ring is our own TX
+  // source, so outgoing traffic never aliases a posted receive.
+  size_t buf_len = msg * ((size_t)recv_depth + (bidir ? 1 : 0));
   char *buf = NULL;
-  if (posix_memalign((void **)&buf, 4096, buf_len))
-    die("alloc");
-  memset(buf, 0, buf_len);
-
-  int access = IBV_ACCESS_LOCAL_WRITE;
-  if (mode == MODE_READ)
-    access |= IBV_ACCESS_REMOTE_READ;
-  if (mode == MODE_WRITE)
-    access |= IBV_ACCESS_REMOTE_WRITE;
-  struct ibv_mr *mr = ibv_reg_mr(id->pd, buf, buf_len, access);
-  if (!mr)
-    die("reg_mr");
-  // For SEND mode, pre-post recv WRs *before* we accept the connection,
-  // so the RQ is ready when the client starts sending.
-  if (mode == MODE_SEND) {
-    struct ibv_recv_wr *bad;
-    for (int i = 0; i < recv_depth; ++i) {
-      struct ibv_sge s = {.addr = (uintptr_t)(buf + (size_t)i * msg),
-                          .length = (uint32_t)msg,
-                          .lkey = mr->lkey};
-      struct ibv_recv_wr wr = {
-          .wr_id = (uint64_t)i, .sg_list = &s, .num_sge = 1};
-      if (ibv_post_recv(id->qp, &wr, &bad))
-        die("post_recv");
-    }
-  }
-
-  struct Info info = {(uint64_t)buf, mr->rkey, (uint32_t)msg};
-  struct rdma_conn_param p = {0};
-  p.private_data = &info;
-  p.private_data_len = sizeof(info);
-
-  p.responder_resources = 16;
-  p.initiator_depth = 16;
-
-  if (rdma_accept(id, &p))
-    die("accept");
-
-  if (rdma_get_cm_event(ec, &e))
-    die("event2");
-  rdma_ack_cm_event(e);
-
-  if (mode == MODE_SEND) {
-    struct ibv_recv_wr *bad; // 这里只用于后面的 repost
-
-    uint64_t done = 0;
+  struct ibv_mr *mr = NULL;
+  struct Info info, peer = {0};
+  uint8_t rd_init = 0, rd_resp = 0;
+  // Connections may arrive on different devices (a multi-rail client):
+  // the first device allocates the buffer and the others wrap it, so each
+  // has its own registration, and many-QP runs get one shared CQ per
+  // device.
+  struct {
+    struct ibv_context *verbs;
+    struct Buf buf;
+    struct ibv_cq *cq;
+  } devs[RAILS_MAX];
+  int ndevs = 0;
+  struct rdma_cm_id **ids = calloc((size_t)qps, sizeof(*ids));
+  if (!ids)
+    die("calloc");
+
+  // Accept --qps connections from the same client; they all get the same
+  // buffer, allocated on the first request.
+  int accepted = 0, established = 0;
+  while (established < qps) {
+    if (rdma_get_cm_event(ec, &e))
+      die("get_event");
+    if (e->event == RDMA_CM_EVENT_ESTABLISHED) {
+      established++;
+      rdma_ack_cm_event(e);
+      continue;
+    }
+    if (e->event != RDMA_CM_EVENT_CONNECT_REQUEST || accepted == qps) {
+      fprintf(stderr, "unexpected event %s\n", rdma_event_str(e->event));
+      rdma_ack_cm_event(e);
+      continue;
+    }
+    id = e->id;
+    // A --bidir client advertises its own target buffer in the request.
+    if (bidir) {
+      if (!e->param.conn.private_data ||
+          e->param.conn.private_data_len < sizeof(peer)) {
+        fprintf(stderr, "client did not advertise a buffer; run it with "
+                        "--bidir too\n");
+        return 1;
+      }
+      memcpy(&peer, e->param.conn.private_data, sizeof(peer));
+    }
+    uint8_t peer_init = e->param.conn.initiator_depth;
+    uint8_t peer_resp = e->param.conn.responder_resources;
+    rdma_ack_cm_event(e);
+
+    struct ibv_qp_init_attr qa = {0};
+    qa.qp_type = IBV_QPT_RC;
+    uint64_t send_depth = (uint64_t)recv_depth;
+    if (bidir && window > send_depth)
+      send_depth = window;
+    qa.cap.max_send_wr = (uint32_t)send_depth + 16;
+    qa.cap.max_recv_wr = recv_depth + 16;
+    qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
+    qa.sq_sig_all = 0;
+    // --qps N>1 is one-sided: these QPs only respond, so they get minimal
+    // queues and one shared CQ, and thousands of them stay cheap to create.
+    if (accepted == 0) {
+      rd_atomic_limits(id->verbs, rd_atomic, &rd_init, &rd_resp);
+    }
+    int d = 0;
+    while (d < ndevs && devs[d].verbs != id->verbs)
+      d++;
+    if (d == ndevs) {
+      if (ndevs == RAILS_MAX) {
+        fprintf(stderr, "more than %d devices\n", RAILS_MAX);
+        return 1;
+      }
+      int access = IBV_ACCESS_LOCAL_WRITE;
+      if (mode == MODE_READ || bidir || mixed)
+        access |= IBV_ACCESS_REMOTE_READ;
+      if (mode == MODE_WRITE || mode == MODE_WRITE_IMM || bidir || mixed)
+        access |= IBV_ACCESS_REMOTE_WRITE;
+      devs[d].verbs = id->verbs;
+      if (d == 0) {
+        buf_alloc(&devs[0].buf, id->pd, buf_len, access, backend);
+        buf = devs[0].buf.base;
+        if (devs[0].buf.backend == BUF_HUGE)
+          printf("[server] buffer: %.1f MiB on hugepages\n",
+                 buf_len / (1024.0 * 1024.0));
+      } else {
+        buf_wrap(&devs[d].buf, id->pd, buf, buf_len, access);
+      }
+      devs[d].cq = NULL;
+      ndevs++;
+      if (d > 0)
+        printf("[server] rail %d: %s\n", d,
+               ibv_get_device_name(id->verbs->device));
+    }
+    if (qps > 1) {
+      if (!devs[d].cq)
+        devs[d].cq = ibv_create_cq(id->verbs, 16, NULL, NULL, 0);
+      if (!devs[d].cq)
+        die("create_cq");
+      qa.send_cq = qa.recv_cq = devs[d].cq;
+      qa.cap.max_send_wr = qa.cap.max_recv_wr = 1;
+    }
+    if (rdma_create_qp(id, id->pd, &qa))
+      die("create_qp");
+    // len is the whole receive ring, which write_imm clients (and writes
+    // to a --detect poll server) rotate over; slot is one receive.
+    mr = devs[d].buf.mr;
+    info = (struct Info){(uint64_t)buf, mr->rkey,
+                         (uint32_t)(msg * (size_t)recv_depth),
+                         two_sided || bidir ? (uint32_t)msg : 0};
+    // For SEND mode, pre-post recv WRs *before* we accept the connection,
+    // so the RQ is ready when the client starts sending. --bidir always
+    // needs them for the closing stats exchange.
+    if (two_sided || bidir) {
+      for (int i = 0; i < recv_depth; ++i)
+        post_recv_slot(id, buf, mr, msg, i);
+    }
+
+    struct rdma_conn_param p = {0};
+    p.private_data = &info;
+    p.private_data_len = sizeof(info);
+    // Our READ responder resources only matter up to the depth the client
+    // initiates, and vice versa.
+    p.responder_resources = rd_resp < peer_init ? rd_resp : peer_init;
+    p.initiator_depth = rd_init < peer_resp ? rd_init : peer_resp;
+    timers_set_param(&p, &timers);
+    timers_set_id(id, &timers);
+
+    if (rdma_accept(id, &p))
+      die("accept");
+    ids[accepted++] = id;
+  }
+  id = ids[0];
+  report_rd_atomic(id->qp, "server");
+  for (int q = 0; q < qps; ++q)
+    timers_set_qp(ids[q]->qp, &timers, q ? NULL : "server");
+  long long hw0[HW_COUNTERS], hw1[HW_COUNTERS];
+  hw_counters_read(id, hw0);
+  struct CpuUsage cpu;
+  cpu_usage_start(&cpu);
+  // The whole preposted ring is the client's initial credit.
+  int ungranted = 0;
+  if (credits)
+    grant_credits(id, (uint32_t)recv_depth);
+
+  if (bidir) {
+    run_bidir(id, id->send_cq, mode, buf, mr, msg, recv_depth, iters, window,
+              &peer, "server");
+    // Let the client disconnect once it has our stats, so the ack for its
+    // own stats message is never raced by a teardown from this side.
+    if (rdma_get_cm_event(ec, &e))
+      die("wait_disconnect");
+    rdma_ack_cm_event(e);
+  } else if (detect_poll) {
+    if (!run_detect_poll(ec, buf, msg, recv_depth, iters)) {
+      if (rdma_get_cm_event(ec, &e))
+        die("wait_disconnect");
+      rdma_ack_cm_event(e);
+    }
+  } else if (two_sided && sweep) {
+    // A sweeping client sends a different number of messages per point, so
+    // keep receiving (into --msg sized slots, the sweep's largest size) until
+    // it disconnects. The CM channel is checked only when the CQ is idle.
+    printf("[server] receiving %s until disconnect...\n",
+           mixed ? "workload" : "sweep");
+    if (fcntl(ec->fd, F_SETFL, fcntl(ec->fd, F_GETFL) | O_NONBLOCK))
+      die("fcntl");
+    uint64_t done = 0, bytes = 0;
+    struct VerifyStats vs = {0};
     struct ibv_wc wc[32];
-    struct timespec ts0, ts1;
-    clock_gettime(CLOCK_MONOTONIC, &ts0);
-    while (done < iters) {
-      int n = ibv_poll_cq(id->recv_cq, 32, wc);
-      if (n < 0)
-        die("poll_cq");
+    for (;;) {
+      int n = poll_cq_ok(id->recv_cq, 32, wc);
+      if (n == 0 && !rdma_get_cm_event(ec, &e)) {
+        enum rdma_cm_event_type ev = e->event;
+        rdma_ack_cm_event(e);
+        if (ev == RDMA_CM_EVENT_DISCONNECTED)
+          break;
+      }
       for (int i = 0; i < n; ++i) {
-        if (wc[i].status)
-          die("wc");
         done++;
-        int slot = (int)wc[i].wr_id;
-        struct ibv_sge s = {.addr = (uintptr_t)(buf + (size_t)slot * msg),
-                            .length = (uint32_t)msg,
-                            .lkey = mr->lkey};
-        struct ibv_recv_wr wr = {
-            .wr_id = (uint64_t)slot, .sg_list = &s, .num_sge = 1};
-        if (ibv_post_recv(id->qp, &wr, &bad))
-          die("repost_recv");
+        bytes += wc[i].byte_len;
+        if (verify)
+          verify_msg(&vs, recv_data(buf, msg, &wc[i]), wc[i].byte_len);
+        post_recv_slot(id, buf, mr, msg, (int)wc[i].wr_id);
+        if (credits && ++ungranted == credit_batch) {
+          grant_credits(id, (uint32_t)ungranted);
+          ungranted = 0;
+        }
       }
     }
-    clock_gettime(CLOCK_MONOTONIC, &ts1);
-    double sec = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
-    double mops = iters / sec / 1e6;
-    double bw = (iters * msg) / sec / (1024.0 * 1024.0 * 1024.0);
-    printf("[server] recv done: %.2f Mops, %.2f GiB/s\n", mops, bw);
+    printf("[server] sweep done: %lu messages, %.2f GiB received\n",
+           (unsigned long)done, bytes / (1024.0 * 1024.0 * 1024.0));
+    if (verify)
+      printf("[server] verify: %lu checked, %lu bad, %lu unstamped\n",
+             (unsigned long)vs.checked, (unsigned long)vs.bad,
+             (unsigned long)vs.unstamped);
+  } else if (two_sided) {
+    struct Stats st;
+    // Two-sided runs have one QP, so one device.
+    run_recv_loop(id, &devs[0].buf, msg, iters, credits ? credit_batch : 0,
+                  &st);
+    printf("[server] recv done: %.2f Mops, %.2f GiB/s\n", stats_mops(&st),
+           stats_gibs(&st));
   } else {
     printf("[server] ready for client RDMA %s, waiting for disconnect...\n",
-           mode == MODE_READ ? "READ" : "WRITE");
-    if (rdma_get_cm_event(ec, &e))
-      die("wait_disconnect");
-    if (e->event != RDMA_CM_EVENT_DISCONNECTED)
-      fprintf(stderr, "unexpected event %d\n", e->event);
-    rdma_ack_cm_event(e);
+           mixed ? "READ/WRITE" : mode == MODE_READ ? "READ" : "WRITE");
+    for (int q = 0; q < qps; ++q) {
+      if (rdma_get_cm_event(ec, &e))
+        die("wait_disconnect");
+      if (e->event != RDMA_CM_EVENT_DISCONNECTED)
+        fprintf(stderr, "unexpected event %d\n", e->event);
+      rdma_ack_cm_event(e);
+    }
   }
 
-  rdma_disconnect(id);
-  ibv_dereg_mr(mr);
-  free(buf);
-  rdma_destroy_qp(id);
-  rdma_destroy_id(id);
+  cpu_usage_stop(&cpu);
+  hw_counters_read(id, hw1);
+  // A single run moved iters * msg bytes (READ: out of this port) between
+  // the snapshots; the span includes waiting for the disconnect.
+  int single = !bidir && !sweep && !detect_poll;
+  struct Stats st = {iters, iters * msg, cpu.wall_ns};
+  hw_counters_report("server", hw0, hw1, single ? &st : NULL,
+                     mode != MODE_READ);
+  // The one-sided server only waits; its share is what RDMA saves the
+  // target compared with --transport tcp.
+  if (single)
+    cpu_usage_report("server", &cpu, iters * msg);
+
+  for (int q = 0; q < qps; ++q)
+    rdma_disconnect(ids[q]);
+  // The wrapped registrations go before device 0 frees the memory.
+  for (int d = ndevs - 1; d >= 0; --d)
+    buf_free(&devs[d].buf);
+  for (int q = 0; q < qps; ++q) {
+    rdma_destroy_qp(ids[q]);
+    rdma_destroy_id(ids[q]);
+  }
+  for (int d = 0; d < ndevs; ++d)
+    if (devs[d].cq)
+      ibv_destroy_cq(devs[d].cq);
+  free(ids);
   rdma_destroy_id(lid);
   rdma_destroy_event_channel(ec);
   return 0;
@@ -1,29 +1,13 @@
-#include <arpa/inet.h>
-#include <infiniband/verbs.h>
-#include <rdma/rdma_cma.h>
+// gcc -O3 bench_server_broadcom.c ../librdmabench/*.c -o bench_server_broadcom -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <unistd.h>
-#include <netdb.h> // for getnameinfo, to print IPv6 address
-
-struct Info {
-  uint64_t addr;
-  uint32_t rkey, len;
-} __attribute__((packed));
-
-enum Mode { MODE_READ, MODE_WRITE, MODE_SEND };
-
-static void die(const char *m) {
-  perror(m);
-  exit(1);
-}
 
 static void usage(const char *p) {
   fprintf(stderr,
           "Usage: %s <port> [--mode read|write|send] [--msg N] [--iters N] "
-          "[--recv-depth N]\n",
+          "[--recv-depth N] [--addr IP]\n",
           p);
 }
 
@@ -38,66 +22,37 @@ int main(int argc, char **argv) {
   uint64_t iters = 100000;
   int recv_depth = 128;
   int port = atoi(argv[1]);
+  // The Broadcom port on the test server; it only has an IPv6 address.
+  const char *addr = "fd93:16d3:59b6:12e:7ec2:55ff:febd:dc76";
 
   for (int i = 2; i < argc; ++i) {
     if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
-      if (!strcmp(argv[i + 1], "send"))
-        mode = MODE_SEND;
-      else if (!strcmp(argv[i + 1], "write"))
-        mode = MODE_WRITE;
-      else
-        mode = MODE_READ;
-      i++;
+      if (mode_parse(argv[++i], &mode) || mode == MODE_WRITE_IMM) {
+        usage(argv[0]);
+        return 1;
+      }
     } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
       msg = strtoull(argv[++i], NULL, 0);
     } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
       iters = strtoull(argv[++i], NULL, 0);
     } else if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
       recv_depth = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--addr") && i + 1 < argc) {
+      addr = argv[++i];
     } else {
       usage(argv[0]);
       return 1;
     }
   }
 
-  const char *broadcom_ip_str = "fd93:16d3:59b6:12e:7ec2:55ff:febd:dc76"; 
-  
   struct rdma_event_channel *ec = rdma_create_event_channel();
-  struct rdma_cm_id *lid, *id;
-  struct rdma_cm_event *e;
-  
-  struct sockaddr_in6 a = {0};
-  a.sin6_family = AF_INET6;
-  a.sin6_port = htons(port);
+  struct rdma_cm_id *lid = rb_listen(ec, addr, port, 1);
+  printf("[server] listening on [%s]:%d (mode=%s msg=%zu iters=%lu)\n", addr,
+         port, mode_str(mode), msg, (unsigned long)iters);
 
- 
-  if (inet_pton(AF_INET6, broadcom_ip_str, &a.sin6_addr) <= 0)
-    die("inet_pton failed to set broadcom IPv6 address");
-
-  if (rdma_create_id(ec, &lid, NULL, RDMA_PS_TCP))
-    die("create_id");
-  
-  if (rdma_bind_addr(lid, (struct sockaddr *)&a))
-    die("bind");
-  if (rdma_listen(lid, 1))
-    die("listen");
-  
-  char host_str[NI_MAXHOST];
-  if (getnameinfo((struct sockaddr *)&a, sizeof(a), 
-                  host_str, sizeof(host_str), 
-                  NULL, 0, NI_NUMERICHOST) != 0) {
-      strcpy(host_str, broadcom_ip_str);
-  }
-  
-  printf("[server] listening on [%s]:%d (mode=%s msg=%zu iters=%lu)\n", 
-         host_str, port,
-         mode == MODE_READ ? "read" : (mode == MODE_WRITE ? "write" : "send"),
-         msg, (unsigned long)iters);
-
-  if (rdma_get_cm_event(ec, &e))
-    die("get_event");
-  id = e->id;
-  rdma_ack_cm_event(e);
+  // Accepted with our READ depths capped by what the client asked for.
+  struct rdma_conn_param p = {0};
+  struct rdma_cm_id *id = rb_expect_request(ec, 0, &p);
 
   struct ibv_qp_init_attr qa = {0};
   qa.qp_type = IBV_QPT_RC;
@@ -105,96 +60,45 @@ int main(int argc, char **argv) {
   qa.cap.max_recv_wr = recv_depth + 16;
   qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
   qa.sq_sig_all = 0;
-  if (rdma_create_qp(id, id->pd, &qa)) 
+  if (rdma_create_qp(id, id->pd, &qa))
     die("create_qp");
 
-  size_t buf_len = msg * recv_depth;
-  char *buf = NULL;
-  if (posix_memalign((void **)&buf, 4096, buf_len))
-    die("alloc");
-  memset(buf, 0, buf_len);
-
   int access = IBV_ACCESS_LOCAL_WRITE;
   if (mode == MODE_READ)
     access |= IBV_ACCESS_REMOTE_READ;
   if (mode == MODE_WRITE)
     access |= IBV_ACCESS_REMOTE_WRITE;
-  struct ibv_mr *mr = ibv_reg_mr(id->pd, buf, buf_len, access);
-  if (!mr)
-    die("reg_mr");
+  struct Buf buf;
+  buf_alloc(&buf, id->pd, msg * recv_depth, access, BUF_HOST);
   // For SEND mode, pre-post recv WRs *before* we accept the connection,
   // so the RQ is ready when the client starts sending.
-  if (mode == MODE_SEND) {
-    struct ibv_recv_wr *bad;
-    for (int i = 0; i < recv_depth; ++i) {
-      struct ibv_sge s = {.addr = (uintptr_t)(buf + (size_t)i * msg),
-                          .length = (uint32_t)msg,
-                          .lkey = mr->lkey};
-      struct ibv_recv_wr wr = {
-          .wr_id = (uint64_t)i, .sg_list = &s, .num_sge = 1};
-      if (ibv_post_recv(id->qp, &wr, &bad))
-        die("post_recv");
-    }
-  }
+  if (mode == MODE_SEND)
+    for (int i = 0; i < recv_depth; ++i)
+      post_recv_slot(id, buf.base, buf.mr, msg, i);
 
-  struct Info info = {(uint64_t)buf, mr->rkey, (uint32_t)msg};
-  struct rdma_conn_param p = {0};
+  struct Info info = {(uint64_t)buf.base, buf.mr->rkey, (uint32_t)msg,
+                      (uint32_t)msg};
   p.private_data = &info;
   p.private_data_len = sizeof(info);
 
-  p.responder_resources = 16;
-  p.initiator_depth = 16;
-
   if (rdma_accept(id, &p))
     die("accept");
 
-  if (rdma_get_cm_event(ec, &e))
-    die("event2");
-  rdma_ack_cm_event(e);
+  rb_expect(ec, RDMA_CM_EVENT_ESTABLISHED, NULL, 0);
 
   if (mode == MODE_SEND) {
-    struct ibv_recv_wr *bad; 
-
-    uint64_t done = 0;
-    struct ibv_wc wc[32];
-    struct timespec ts0, ts1;
-    clock_gettime(CLOCK_MONOTONIC, &ts0);
-    while (done < iters) {
-      int n = ibv_poll_cq(id->recv_cq, 32, wc);
-      if (n < 0)
-        die("poll_cq");
-      for (int i = 0; i < n; ++i) {
-        if (wc[i].status)
-          die("wc");
-        done++;
-        int slot = (int)wc[i].wr_id;
-        struct ibv_sge s = {.addr = (uintptr_t)(buf + (size_t)slot * msg),
-                            .length = (uint32_t)msg,
-                            .lkey = mr->lkey};
-        struct ibv_recv_wr wr = {
-            .wr_id = (uint64_t)slot, .sg_list = &s, .num_sge = 1};
-        if (ibv_post_recv(id->qp, &wr, &bad))
-          die("repost_recv");
-      }
-    }
-    clock_gettime(CLOCK_MONOTONIC, &ts1);
-    double sec = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
-    double mops = iters / sec / 1e6;
-    double bw = (iters * msg) / sec / (1024.0 * 1024.0 * 1024.0);
-    printf("[server] recv done: %.2f Mops, %.2f GiB/s\n", mops, bw);
+    struct Stats st;
+    run_recv_loop(id, &buf, msg, iters, 0, &st);
+    printf("[server] recv done: %.2f Mops, %.2f GiB/s\n", stats_mops(&st),
+           stats_gibs(&st));
   } else {
     printf("[server] ready for client RDMA %s, waiting for disconnect...\n",
            mode == MODE_READ ? "READ" : "WRITE");
-    if (rdma_get_cm_event(ec, &e))
-      die("wait_disconnect");
-    if (e->event != RDMA_CM_EVENT_DISCONNECTED)
-      fprintf(stderr, "unexpected event %d\n", e->event);
-    rdma_ack_cm_event(e);
+    rb_expect(ec, RDMA_CM_EVENT_DISCONNECTED, NULL, 0);
   }
 
   rdma_disconnect(id);
-  ibv_dereg_mr(mr);
-  free(buf);
+  buf_free(&buf);
   rdma_destroy_qp(id);
   rdma_destroy_id(id);
   rdma_destroy_id(lid);
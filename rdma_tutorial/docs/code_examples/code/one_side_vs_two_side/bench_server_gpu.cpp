@@ -1,20 +1,9 @@
-// hipcc bench_server_gpu.c -o bench_server_gpu -lrdmacm -libverbs
-#include <arpa/inet.h>
+// hipcc -O3 bench_server_gpu.cpp ../librdmabench/*.c -o bench_server_gpu -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
 #include <hip/hip_runtime.h>
-#include <infiniband/verbs.h>
-#include <rdma/rdma_cma.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <unistd.h>
-
-struct Info {
-  uint64_t addr;
-  uint32_t rkey, len;
-} __attribute__((packed));
-
-enum Mode { MODE_READ, MODE_WRITE, MODE_SEND };
 
 #define HIP_CHECK(cmd)                                                         \
   do {                                                                         \
@@ -26,11 +15,6 @@ enum Mode { MODE_READ, MODE_WRITE, MODE_SEND };
     }                                                                          \
   } while (0)
 
-static void die(const char *m) {
-  perror(m);
-  exit(1);
-}
-
 static void usage(const char *p) {
   fprintf(stderr,
           "Usage: %s <port> [--mode read|write|send] [--msg N] [--iters N] "
@@ -53,13 +37,10 @@ int main(int argc, char **argv) {
 
   for (int i = 2; i < argc; ++i) {
     if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
-      if (!strcmp(argv[i + 1], "send"))
-        mode = MODE_SEND;
-      else if (!strcmp(argv[i + 1], "write"))
-        mode = MODE_WRITE;
-      else
-        mode = MODE_READ;
-      i++;
+      if (mode_parse(argv[++i], &mode) || mode == MODE_WRITE_IMM) {
+        usage(argv[0]);
+        return 1;
+      }
     } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
       msg = strtoull(argv[++i], NULL, 0);
     } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
@@ -77,28 +58,15 @@ int main(int argc, char **argv) {
   HIP_CHECK(hipSetDevice(gpu));
 
   struct rdma_event_channel *ec = rdma_create_event_channel();
-  struct rdma_cm_id *lid, *id;
-  struct rdma_cm_event *e;
-  struct sockaddr_in a = {0};
-  a.sin_family = AF_INET;
-  a.sin_port = htons(port);
-
-  if (rdma_create_id(ec, &lid, NULL, RDMA_PS_TCP))
-    die("create_id");
-  if (rdma_bind_addr(lid, (struct sockaddr *)&a))
-    die("bind");
-  if (rdma_listen(lid, 1))
-    die("listen");
+  struct rdma_cm_id *lid = rb_listen(ec, NULL, port, 1);
   printf("[server] listening on %d (mode=%s msg=%zu iters=%lu gpu=%d)\n", port,
-         mode == MODE_READ ? "read" : (mode == MODE_WRITE ? "write" : "send"),
-         msg, (unsigned long)iters, gpu);
+         mode_str(mode), msg, (unsigned long)iters, gpu);
 
-  if (rdma_get_cm_event(ec, &e))
-    die("get_event");
-  id = e->id;
-  rdma_ack_cm_event(e);
+  // Accepted with our READ depths capped by what the client asked for.
+  struct rdma_conn_param p = {};
+  struct rdma_cm_id *id = rb_expect_request(ec, 0, &p);
 
-  struct ibv_qp_init_attr qa = {0};
+  struct ibv_qp_init_attr qa = {};
   qa.qp_type = IBV_QPT_RC;
   qa.cap.max_send_wr = recv_depth + 16;
   qa.cap.max_recv_wr = recv_depth + 16;
@@ -107,92 +75,47 @@ int main(int argc, char **argv) {
   if (rdma_create_qp(id, id->pd, &qa))
     die("create_qp");
 
-  size_t buf_len = msg * recv_depth;
-  void *buf = NULL;
-  HIP_CHECK(hipMalloc(&buf, buf_len));
-  HIP_CHECK(hipMemset(buf, 0, buf_len));
+  size_t buf_len = msg * (size_t)recv_depth;
+  void *gbuf = NULL;
+  HIP_CHECK(hipMalloc(&gbuf, buf_len));
+  HIP_CHECK(hipMemset(gbuf, 0, buf_len));
 
   int access = IBV_ACCESS_LOCAL_WRITE;
   if (mode == MODE_READ)
     access |= IBV_ACCESS_REMOTE_READ;
   if (mode == MODE_WRITE)
     access |= IBV_ACCESS_REMOTE_WRITE;
-  struct ibv_mr *mr = ibv_reg_mr(id->pd, buf, buf_len, access);
-  if (!mr)
-    die("reg_mr");
+  struct Buf buf;
+  buf_wrap(&buf, id->pd, gbuf, buf_len, access);
 
-  if (mode == MODE_SEND) {
-    struct ibv_recv_wr *bad;
-    for (int i = 0; i < recv_depth; ++i) {
-      struct ibv_sge s = {.addr = (uintptr_t)((char *)buf + (size_t)i * msg),
-                          .length = (uint32_t)msg,
-                          .lkey = mr->lkey};
-      struct ibv_recv_wr wr = {
-          .wr_id = (uint64_t)i, .sg_list = &s, .num_sge = 1};
-      if (ibv_post_recv(id->qp, &wr, &bad))
-        die("post_recv");
-    }
-  }
+  if (mode == MODE_SEND)
+    for (int i = 0; i < recv_depth; ++i)
+      post_recv_slot(id, buf.base, buf.mr, msg, i);
 
-  struct Info info = {(uint64_t)buf, mr->rkey, (uint32_t)msg};
-  struct rdma_conn_param p = {0};
+  struct Info info = {(uint64_t)buf.base, buf.mr->rkey, (uint32_t)msg,
+                      (uint32_t)msg};
   p.private_data = &info;
   p.private_data_len = sizeof(info);
-  p.responder_resources = 16;
-  p.initiator_depth = 16;
-
   if (rdma_accept(id, &p))
     die("accept");
 
-  if (rdma_get_cm_event(ec, &e))
-    die("event2");
-  rdma_ack_cm_event(e);
+  rb_expect(ec, RDMA_CM_EVENT_ESTABLISHED, NULL, 0);
 
   if (mode == MODE_SEND) {
-    struct ibv_recv_wr *bad;
-    uint64_t done = 0;
-    struct ibv_wc wc[32];
-    struct timespec ts0, ts1;
-    clock_gettime(CLOCK_MONOTONIC, &ts0);
-    while (done < iters) {
-      int n = ibv_poll_cq(id->recv_cq, 32, wc);
-      if (n < 0)
-        die("poll_cq");
-      for (int i = 0; i < n; ++i) {
-        if (wc[i].status)
-          die("wc");
-        done++;
-        int slot = (int)wc[i].wr_id;
-        struct ibv_sge s = {
-            .addr = (uintptr_t)((char *)buf + (size_t)slot * msg),
-            .length = (uint32_t)msg,
-            .lkey = mr->lkey};
-        struct ibv_recv_wr wr = {
-            .wr_id = (uint64_t)slot, .sg_list = &s, .num_sge = 1};
-        if (ibv_post_recv(id->qp, &wr, &bad))
-          die("repost_recv");
-      }
-    }
-    clock_gettime(CLOCK_MONOTONIC, &ts1);
-    double sec =
-        (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
-    double mops = iters / sec / 1e6;
-    double bw = (iters * msg) / sec / (1024.0 * 1024.0 * 1024.0);
-    printf("[server] GPU recv done: %.2f Mops, %.2f GiB/s\n", mops, bw);
+    struct Stats st;
+    run_recv_loop(id, &buf, msg, iters, 0, &st);
+    printf("[server] GPU recv done: %.2f Mops, %.2f GiB/s\n",
+           stats_mops(&st), stats_gibs(&st));
   } else {
     printf("[server] GPU buffer ready for client RDMA %s, waiting for "
            "disconnect...\n",
            mode == MODE_READ ? "READ" : "WRITE");
-    if (rdma_get_cm_event(ec, &e))
-      die("wait_disconnect");
-    if (e->event != RDMA_CM_EVENT_DISCONNECTED)
-      fprintf(stderr, "unexpected event %d\n", e->event);
-    rdma_ack_cm_event(e);
+    rb_expect(ec, RDMA_CM_EVENT_DISCONNECTED, NULL, 0);
   }
 
   rdma_disconnect(id);
-  ibv_dereg_mr(mr);
-  HIP_CHECK(hipFree(buf));
+  buf_free(&buf);
+  HIP_CHECK(hipFree(gbuf));
   rdma_destroy_qp(id);
   rdma_destroy_id(id);
   rdma_destroy_id(lid);
@@ -0,0 +1,175 @@
+// gcc -O3 trace_convert.c ../librdmabench/*.c -o trace_convert -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Converts an op log to the binary trace bench_client --replay reads, and
+// back. The CSV has one op per line:
+//
+//   time_us,op,size,offset,qp
+//
+// time_us may be absolute (e.g. since the epoch) and have up to three
+// decimals; the trace starts at the earliest op. op is read, write, send
+// or write_imm, size takes K/M/G suffixes. A first line that is not an op
+// is taken as the header; blank lines and lines starting with '#' are
+// skipped. Any other line that does not parse is an error.
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <in.csv> <out.trace>\n"
+          "       %s --dump <in.trace>\n",
+          p, p);
+}
+
+// "123" or "123.456" microseconds, as ns.
+static int parse_us(const char *s, uint64_t *ns) {
+  char *end;
+  uint64_t us = strtoull(s, &end, 10);
+  if (end == s || *s == '-' || us > UINT64_MAX / 1000)
+    return -1;
+  uint64_t frac = 0;
+  if (*end == '.') {
+    int digits = 0;
+    for (end++; *end >= '0' && *end <= '9'; end++)
+      if (digits++ < 3)
+        frac = frac * 10 + (uint64_t)(*end - '0');
+    for (; digits < 3; digits++)
+      frac *= 10;
+  }
+  if (*end)
+    return -1;
+  *ns = us * 1000 + frac;
+  return 0;
+}
+
+// One CSV line. Returns 1 for an op, 0 for a blank or comment line, -1 if
+// it does not parse.
+static int parse_line(char *line, struct TraceRec *r) {
+  line[strcspn(line, "\r\n")] = '\0';
+  char *f[6], *save = NULL;
+  int n = 0;
+  for (char *t = strtok_r(line, ", \t", &save); t && n < 6;
+       t = strtok_r(NULL, ", \t", &save))
+    f[n++] = t;
+  if (!n || f[0][0] == '#')
+    return 0;
+  enum Mode mode;
+  uint64_t t, size, off, qp;
+  char *end;
+  if (n != 5 || parse_us(f[0], &t) || mode_parse(f[1], &mode) ||
+      size_parse(f[2], &size) || !size || size > (1u << 31) ||
+      size_parse(f[3], &off))
+    return -1;
+  qp = strtoull(f[4], &end, 10);
+  if (end == f[4] || *end || qp > UINT16_MAX)
+    return -1;
+  r->t_ns = t;
+  r->offset = off;
+  r->size = (uint32_t)size;
+  r->qp = (uint16_t)qp;
+  r->mode = (uint8_t)mode;
+  r->pad = 0;
+  return 1;
+}
+
+// Op logs merged from several threads are nearly sorted; ties keep their
+// line order.
+struct Entry {
+  struct TraceRec r;
+  uint64_t line;
+};
+
+static int cmp_entry(const void *a, const void *b) {
+  const struct Entry *x = a, *y = b;
+  if (x->r.t_ns != y->r.t_ns)
+    return x->r.t_ns < y->r.t_ns ? -1 : 1;
+  return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static int convert(const char *in, const char *out) {
+  FILE *f = fopen(in, "r");
+  if (!f) {
+    perror(in);
+    return 1;
+  }
+  struct Entry *e = NULL;
+  uint64_t n = 0, cap = 0, line_no = 0;
+  int sorted = 1;
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    line_no++;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 1 << 16;
+      if (!(e = realloc(e, cap * sizeof(*e))))
+        die("realloc");
+    }
+    int rc = parse_line(line, &e[n].r);
+    if (rc < 0 && line_no == 1)
+      continue; // the header
+    if (rc < 0) {
+      fprintf(stderr, "%s:%lu: expected time_us,op,size,offset,qp\n", in,
+              (unsigned long)line_no);
+      fclose(f);
+      return 1;
+    }
+    if (!rc)
+      continue;
+    e[n].line = line_no;
+    if (n && e[n].r.t_ns < e[n - 1].r.t_ns)
+      sorted = 0;
+    n++;
+  }
+  fclose(f);
+  if (!n) {
+    fprintf(stderr, "%s: no ops\n", in);
+    return 1;
+  }
+  if (!sorted)
+    qsort(e, n, sizeof(*e), cmp_entry);
+
+  struct TraceRec *rec = malloc(n * sizeof(*rec));
+  if (!rec)
+    die("malloc");
+  uint64_t t0 = e[0].r.t_ns;
+  for (uint64_t i = 0; i < n; ++i) {
+    rec[i] = e[i].r;
+    rec[i].t_ns -= t0;
+  }
+  free(e);
+  if (trace_save(out, rec, n))
+    return 1;
+  free(rec);
+
+  struct Trace t;
+  if (trace_load(out, &t))
+    return 1;
+  trace_print(&t, "trace_convert");
+  free(t.rec);
+  return 0;
+}
+
+static int dump(const char *in) {
+  struct Trace t;
+  if (trace_load(in, &t))
+    return 1;
+  printf("time_us,op,size,offset,qp\n");
+  for (uint64_t i = 0; i < t.n; ++i) {
+    const struct TraceRec *r = &t.rec[i];
+    printf("%lu.%03lu,%s,%u,%lu,%u\n", (unsigned long)(r->t_ns / 1000),
+           (unsigned long)(r->t_ns % 1000), mode_str((enum Mode)r->mode),
+           r->size, (unsigned long)r->offset, r->qp);
+  }
+  free(t.rec);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!strcmp(argv[1], "--dump"))
+    return dump(argv[2]);
+  return convert(argv[1], argv[2]);
+}
@@ -0,0 +1,425 @@
+// gcc kv_client.c ../librdmabench/*.c -o kv_client -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Must match kv_server.c.
+struct TableInfo {
+  uint64_t addr; // TableHdr, then the buckets
+  uint32_t rkey;
+  uint32_t buckets;
+  uint32_t slot_size; // bytes per slot, SlotHdr included
+  uint32_t value_len;
+  uint32_t recv_depth; // PUTs the client may have outstanding
+} __attribute__((packed));
+
+#define BUCKET_SLOTS 4
+#define TABLE_HDR 64
+
+struct SlotHdr {
+  uint64_t version; // odd while the server rewrites the slot
+  uint64_t key;     // 0: empty
+  uint32_t len, crc;
+} __attribute__((packed));
+
+enum { KV_PUT = 1 };
+enum { KV_OK = 0, KV_FULL = 1 };
+
+struct KvReq {
+  uint32_t op, tag;
+  uint64_t key;
+} __attribute__((packed));
+
+struct KvResp {
+  uint32_t status, tag;
+  uint64_t version;
+} __attribute__((packed));
+
+// A GET is two READs, one per candidate bucket. If it misses, it is
+// re-issued as a CHECK that also reads the table's move counter before and
+// after the buckets: a miss only counts if no cuckoo displacement was in
+// progress or happened in between. READs on one QP are executed in order.
+enum OpKind { OP_GET, OP_CHECK, OP_PUT };
+
+// One window slot. Its part of the local buffer holds
+// [moves][bucket 1][bucket 2][moves] for GETs and the request for PUTs.
+struct Op {
+  enum OpKind kind;
+  uint64_t key;
+  uint64_t t0;
+  char *buf;
+};
+
+struct KvStats {
+  uint64_t gets, hits, misses, torn, checks, puts, full;
+};
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static uint32_t bucket_of(uint64_t key, int which, uint32_t buckets) {
+  return (uint32_t)(mix64(which ? key ^ 0x9e3779b97f4a7c15ull : key) %
+                    buckets);
+}
+
+static uint64_t rng_next(uint64_t *s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545f4914f6cdd1dull;
+}
+
+static double rng_double(uint64_t *s) {
+  return (rng_next(s) >> 11) * 0x1.0p-53;
+}
+
+// YCSB's zipfian generator (Gray et al., "Quickly generating billion-record
+// synthetic databases"): rank 0 is the most popular. Ranks are scrambled
+// into keys so the hot keys do not share buckets.
+struct Zipf {
+  uint64_t n;
+  double theta, alpha, zetan, eta;
+};
+
+static void zipf_init(struct Zipf *z, uint64_t n, double theta) {
+  z->n = n;
+  z->theta = theta;
+  if (theta <= 0)
+    return;
+  double zeta2 = 1 + pow(0.5, theta);
+  z->zetan = 0;
+  for (uint64_t i = 1; i <= n; ++i)
+    z->zetan += 1 / pow((double)i, theta);
+  z->alpha = 1 / (1 - theta);
+  z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_key(const struct Zipf *z, uint64_t *rng) {
+  uint64_t rank;
+  if (z->theta <= 0) {
+    rank = rng_next(rng) % z->n;
+  } else {
+    double u = rng_double(rng), uz = u * z->zetan;
+    if (uz < 1)
+      rank = 0;
+    else if (uz < 1 + pow(0.5, z->theta))
+      rank = 1;
+    else
+      rank = (uint64_t)(z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+    if (rank >= z->n)
+      rank = z->n - 1;
+  }
+  return 1 + mix64(rank) % z->n;
+}
+
+static void report_latency(const char *what, uint64_t *lat, uint64_t n) {
+  if (!n)
+    return;
+  qsort(lat, n, sizeof(*lat), cmp_u64);
+  printf("[client] %s latency: p50=%.2f us p99=%.2f us p99.9=%.2f us\n", what,
+         lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3, lat[n * 999 / 1000] / 1e3);
+}
+
+// Look for `key` in the 2 * BUCKET_SLOTS slots just read. Returns 1 on a
+// hit, 0 on a miss and -1 if the matching slot was caught mid-update.
+static int find_key(const char *buckets, const struct TableInfo *ti,
+                    uint64_t key) {
+  for (int i = 0; i < 2 * BUCKET_SLOTS; ++i) {
+    const char *slot = buckets + (size_t)i * ti->slot_size;
+    struct SlotHdr h;
+    memcpy(&h, slot, sizeof(h));
+    if (h.key != key)
+      continue;
+    if ((h.version & 1) || h.len > ti->value_len)
+      return -1;
+    uint32_t got = h.crc;
+    h.crc = 0;
+    if (crc32c(crc32c(0, &h, sizeof(h)), slot + sizeof(h), h.len) != got)
+      return -1;
+    return 1;
+  }
+  return 0;
+}
+
+static void post_read(struct rdma_cm_id *id, struct ibv_mr *mr, char *dst,
+                      uint32_t len, const struct TableInfo *ti,
+                      uint64_t offset, uint64_t wr_id, int signaled) {
+  struct ibv_sge s = {.addr = (uintptr_t)dst, .length = len,
+                      .lkey = mr->lkey};
+  struct ibv_send_wr wr = {0}, *bad;
+  wr.wr_id = wr_id;
+  wr.sg_list = &s;
+  wr.num_sge = 1;
+  wr.opcode = IBV_WR_RDMA_READ;
+  wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+  wr.wr.rdma.remote_addr = ti->addr + offset;
+  wr.wr.rdma.rkey = ti->rkey;
+  if (ibv_post_send(id->qp, &wr, &bad))
+    die("post_read");
+}
+
+// Post the READs for a GET or CHECK; only the last one is signaled.
+static void issue_get(struct rdma_cm_id *id, struct ibv_mr *mr,
+                      const struct TableInfo *ti, struct Op *op,
+                      uint64_t slot) {
+  uint32_t bucket_len = BUCKET_SLOTS * ti->slot_size;
+  char *b = op->buf + sizeof(uint64_t);
+  int check = op->kind == OP_CHECK;
+  if (check)
+    post_read(id, mr, op->buf, sizeof(uint64_t), ti, 0, slot, 0);
+  for (int w = 0; w < 2; ++w) {
+    uint64_t off = TABLE_HDR + (uint64_t)bucket_of(op->key, w, ti->buckets) *
+                                   bucket_len;
+    post_read(id, mr, b + (size_t)w * bucket_len, bucket_len, ti, off, slot,
+              !check && w == 1);
+  }
+  if (check)
+    post_read(id, mr, b + 2 * (size_t)bucket_len, sizeof(uint64_t), ti, 0,
+              slot, 1);
+}
+
+static void issue_put(struct rdma_cm_id *id, struct ibv_mr *mr,
+                      const struct TableInfo *ti, struct Op *op,
+                      uint64_t slot, uint64_t seq) {
+  struct KvReq *req = (struct KvReq *)op->buf;
+  req->op = KV_PUT;
+  req->tag = (uint32_t)slot;
+  req->key = op->key;
+  memset(req + 1, (int)((op->key + seq) & 0xff), ti->value_len);
+  struct ibv_sge s = {.addr = (uintptr_t)req,
+                      .length = (uint32_t)sizeof(*req) + ti->value_len,
+                      .lkey = mr->lkey};
+  struct ibv_send_wr wr = {0}, *bad;
+  wr.wr_id = slot;
+  wr.sg_list = &s;
+  wr.num_sge = 1;
+  wr.opcode = IBV_WR_SEND;
+  wr.send_flags = IBV_SEND_SIGNALED;
+  if (ibv_post_send(id->qp, &wr, &bad))
+    die("post_send");
+}
+
+static void post_resp_recv(struct rdma_cm_id *id, struct ibv_mr *mr,
+                           struct KvResp *resp, uint64_t i) {
+  struct ibv_sge s = {.addr = (uintptr_t)resp, .length = sizeof(*resp),
+                      .lkey = mr->lkey};
+  struct ibv_recv_wr wr = {.wr_id = i, .sg_list = &s, .num_sge = 1}, *bad;
+  if (ibv_post_recv(id->qp, &wr, &bad))
+    die("post_recv");
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <server_ip> <port> [--workload a|b|c] [--keys N] "
+          "[--zipf THETA] [--ops N] [--window N] [--seed N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *ip = argv[1];
+  int port = atoi(argv[2]);
+  char workload = 'a';
+  uint64_t keys = 1000000;
+  double theta = 0.99;
+  uint64_t ops = 1000000;
+  uint64_t window = 16;
+  uint64_t seed = 1;
+
+  for (int i = 3; i < argc; ++i) {
+    if (!strcmp(argv[i], "--workload") && i + 1 < argc) {
+      workload = argv[++i][0];
+    } else if (!strcmp(argv[i], "--keys") && i + 1 < argc) {
+      keys = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--zipf") && i + 1 < argc) {
+      theta = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--ops") && i + 1 < argc) {
+      ops = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+      window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 0);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  // YCSB core workloads: A is update heavy, B read mostly, C read only.
+  int read_pct = workload == 'c' ? 100 : workload == 'b' ? 95 : 50;
+  if ((workload != 'a' && workload != 'b' && workload != 'c') || !keys ||
+      !window || theta >= 1) {
+    fprintf(stderr, "--workload takes a, b or c; --keys and --window must be "
+                    ">= 1 and --zipf < 1\n");
+    return 1;
+  }
+  printf("[client] crc32c=%s\n", crc32c_select());
+  struct Zipf z;
+  zipf_init(&z, keys, theta);
+  uint64_t rng = seed ? seed : 1;
+
+  struct rdma_event_channel *ec = rdma_create_event_channel();
+  struct rdma_cm_id *id = rb_resolve(ec, ip, port, AF_UNSPEC);
+
+  // Per op at most one stale PUT completion plus four READs in flight.
+  struct ibv_cq *cq = ibv_create_cq(id->verbs, (int)(window * 6 + 32), NULL,
+                                    NULL, 0);
+  if (!cq)
+    die("create_cq");
+  struct ibv_qp_init_attr qa = {0};
+  qa.qp_type = IBV_QPT_RC;
+  qa.send_cq = qa.recv_cq = cq;
+  qa.cap.max_send_wr = (uint32_t)(window * 5 + 16);
+  qa.cap.max_recv_wr = (uint32_t)(window + 16);
+  qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
+  qa.sq_sig_all = 0;
+  if (rdma_create_qp(id, id->pd, &qa))
+    die("create_qp");
+
+  struct rdma_conn_param p = {0};
+  rd_atomic_limits(id->verbs, 0, &p.initiator_depth, &p.responder_resources);
+  if (rdma_connect(id, &p))
+    die("connect");
+  struct TableInfo ti;
+  rb_expect(ec, RDMA_CM_EVENT_ESTABLISHED, &ti, sizeof(ti));
+  if (read_pct < 100 && window > ti.recv_depth) {
+    fprintf(stderr, "--window %lu exceeds the server's --recv-depth %u\n",
+            (unsigned long)window, ti.recv_depth);
+    return 1;
+  }
+  printf("[client] table: %u buckets x %d slots x %u bytes, value=%u bytes\n",
+         ti.buckets, BUCKET_SLOTS, ti.slot_size, ti.value_len);
+
+  size_t bucket_len = (size_t)BUCKET_SLOTS * ti.slot_size;
+  size_t get_len = 2 * bucket_len + 2 * sizeof(uint64_t);
+  size_t put_len = sizeof(struct KvReq) + ti.value_len;
+  size_t stride = ((get_len > put_len ? get_len : put_len) + 63) & ~63ul;
+  size_t buf_len = window * stride + window * sizeof(struct KvResp);
+  char *buf;
+  if (posix_memalign((void **)&buf, 4096, buf_len))
+    die("alloc");
+  memset(buf, 0, buf_len);
+  struct ibv_mr *mr = ibv_reg_mr(id->pd, buf, buf_len, IBV_ACCESS_LOCAL_WRITE);
+  if (!mr)
+    die("reg_mr");
+  struct KvResp *resps = (struct KvResp *)(buf + window * stride);
+  for (uint64_t i = 0; i < window; ++i)
+    post_resp_recv(id, mr, &resps[i], i);
+
+  struct Op *op = calloc(window, sizeof(*op));
+  uint64_t *lat_get = malloc(ops * sizeof(uint64_t));
+  uint64_t *lat_put = malloc(ops * sizeof(uint64_t));
+  if (!op || !lat_get || !lat_put)
+    die("malloc");
+  struct KvStats st = {0};
+  uint64_t issued = 0, done = 0;
+
+  uint64_t t0 = now_ns();
+  for (uint64_t i = 0; i < window && issued < ops; ++i, ++issued) {
+    op[i].buf = buf + i * stride;
+    op[i].key = zipf_key(&z, &rng);
+    op[i].t0 = now_ns();
+    op[i].kind = (int)(rng_next(&rng) % 100) < read_pct ? OP_GET : OP_PUT;
+    if (op[i].kind == OP_PUT)
+      issue_put(id, mr, &ti, &op[i], i, issued);
+    else
+      issue_get(id, mr, &ti, &op[i], i);
+  }
+
+  struct ibv_wc wc[32];
+  while (done < ops) {
+    int n = poll_cq_ok(cq, 32, wc);
+    for (int k = 0; k < n; ++k) {
+      // The reply, not the request's send completion, finishes a PUT.
+      if (wc[k].opcode == IBV_WC_SEND)
+        continue;
+      uint64_t i;
+      if (wc[k].opcode == IBV_WC_RECV) {
+        struct KvResp *r = &resps[wc[k].wr_id];
+        i = r->tag;
+        if (r->status != KV_OK)
+          st.full++;
+        post_resp_recv(id, mr, r, wc[k].wr_id);
+        lat_put[st.puts++] = now_ns() - op[i].t0;
+      } else {
+        i = wc[k].wr_id;
+        char *b = op[i].buf + sizeof(uint64_t);
+        int found = find_key(b, &ti, op[i].key);
+        if (found < 0) {
+          st.torn++;
+          op[i].kind = OP_GET;
+          issue_get(id, mr, &ti, &op[i], i);
+          continue;
+        }
+        if (!found && op[i].kind == OP_GET) {
+          st.checks++;
+          op[i].kind = OP_CHECK;
+          issue_get(id, mr, &ti, &op[i], i);
+          continue;
+        }
+        if (!found) {
+          uint64_t m0, m1;
+          memcpy(&m0, op[i].buf, sizeof(m0));
+          memcpy(&m1, b + 2 * bucket_len, sizeof(m1));
+          if ((m0 & 1) || m0 != m1) {
+            st.torn++;
+            issue_get(id, mr, &ti, &op[i], i);
+            continue;
+          }
+          st.misses++;
+        } else {
+          st.hits++;
+        }
+        lat_get[st.gets++] = now_ns() - op[i].t0;
+      }
+      done++;
+      if (issued < ops) {
+        op[i].key = zipf_key(&z, &rng);
+        op[i].t0 = now_ns();
+        op[i].kind = (int)(rng_next(&rng) % 100) < read_pct ? OP_GET : OP_PUT;
+        if (op[i].kind == OP_PUT)
+          issue_put(id, mr, &ti, &op[i], i, issued);
+        else
+          issue_get(id, mr, &ti, &op[i], i);
+        issued++;
+      }
+    }
+  }
+  double sec = (now_ns() - t0) / 1e9;
+
+  printf("[client] ycsb-%c done: %.2f Mops (ops=%lu, keys=%lu, zipf=%.2f, "
+         "window=%lu)\n",
+         workload, ops / sec / 1e6, (unsigned long)ops, (unsigned long)keys,
+         theta, (unsigned long)window);
+  printf("[client] get: %lu (%.2f Mops, %lu hits, %lu misses, %lu torn "
+         "retries, %lu miss checks)\n",
+         (unsigned long)st.gets, st.gets / sec / 1e6, (unsigned long)st.hits,
+         (unsigned long)st.misses, (unsigned long)st.torn,
+         (unsigned long)st.checks);
+  printf("[client] put: %lu (%.2f Mops, %lu failed)\n", (unsigned long)st.puts,
+         st.puts / sec / 1e6, (unsigned long)st.full);
+  report_latency("get", lat_get, st.gets);
+  report_latency("put", lat_put, st.puts);
+
+  rdma_disconnect(id);
+  ibv_dereg_mr(mr);
+  free(buf);
+  free(op);
+  free(lat_get);
+  free(lat_put);
+  rdma_destroy_qp(id);
+  ibv_destroy_cq(cq);
+  rdma_destroy_id(id);
+  rdma_destroy_event_channel(ec);
+  return 0;
+}
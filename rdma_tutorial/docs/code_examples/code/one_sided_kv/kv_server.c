@@ -0,0 +1,380 @@
+// gcc kv_server.c ../librdmabench/*.c -o kv_server -lrdmacm -libverbs -lm
+#include "../librdmabench/rdma_bench.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Sent to the client as connect private data: everything it needs to find
+// a key's buckets with RDMA READ.
+struct TableInfo {
+  uint64_t addr; // TableHdr, then the buckets
+  uint32_t rkey;
+  uint32_t buckets;
+  uint32_t slot_size; // bytes per slot, SlotHdr included
+  uint32_t value_len;
+  uint32_t recv_depth; // PUTs the client may have outstanding
+} __attribute__((packed));
+
+#define BUCKET_SLOTS 4
+#define TABLE_HDR 64 // buckets start one cache line into the table
+#define MAX_PATH 64  // longest cuckoo displacement path tried
+
+// At the start of the table. `moves` is odd while entries are being
+// displaced along a cuckoo path, during which a key may briefly sit in
+// neither of the buckets a client has already read.
+struct TableHdr {
+  uint64_t moves;
+} __attribute__((packed));
+
+// Slot header, followed by value_len bytes. `version` is odd while the
+// slot is being rewritten; `crc` (computed with crc = 0) covers the header
+// and value, so a READ that races a rewrite fails the check.
+struct SlotHdr {
+  uint64_t version;
+  uint64_t key; // 0: empty
+  uint32_t len, crc;
+} __attribute__((packed));
+
+enum { KV_PUT = 1 };
+enum { KV_OK = 0, KV_FULL = 1 };
+
+// PUT request (SEND), followed by value_len bytes; the reply echoes `tag`.
+struct KvReq {
+  uint32_t op, tag;
+  uint64_t key;
+} __attribute__((packed));
+
+struct KvResp {
+  uint32_t status, tag;
+  uint64_t version;
+} __attribute__((packed));
+
+struct Table {
+  char *base;
+  uint32_t buckets, slot_size, value_len;
+  uint64_t rng;
+  uint64_t inserts, updates, full, moved;
+};
+
+// The two candidate buckets of a key; the client computes the same.
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static uint32_t bucket_of(uint64_t key, int which, uint32_t buckets) {
+  return (uint32_t)(mix64(which ? key ^ 0x9e3779b97f4a7c15ull : key) %
+                    buckets);
+}
+
+static struct SlotHdr *slot_at(const struct Table *t, uint32_t b, int s) {
+  return (struct SlotHdr *)(t->base + TABLE_HDR +
+                            ((size_t)b * BUCKET_SLOTS + s) * t->slot_size);
+}
+
+// Rewrite a slot seqlock-style: odd version, contents and CRC, then the
+// next even version. Returns the new version.
+static uint64_t slot_write(struct SlotHdr *h, uint64_t key, const void *val,
+                           uint32_t len) {
+  uint64_t v = h->version | 1;
+  __atomic_store_n(&h->version, v, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  char *p = (char *)(h + 1);
+  memmove(p, val, len);
+  h->key = key;
+  h->len = len;
+  struct SlotHdr n = {v + 1, key, len, 0};
+  h->crc = crc32c(crc32c(0, &n, sizeof(n)), p, len);
+  __atomic_store_n(&h->version, v + 1, __ATOMIC_RELEASE);
+  return v + 1;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545f4914f6cdd1dull;
+}
+
+static int on_path(uint32_t (*path)[2], int n, uint32_t b, int s) {
+  for (int i = 0; i < n; ++i)
+    if (path[i][0] == b && (int)path[i][1] == s)
+      return 1;
+  return 0;
+}
+
+// Update `key` in place, or insert it into a free slot of either bucket.
+// When both are full, random-walk a cuckoo path to a free slot and move
+// the entries on it one step back, starting from the free end, so every
+// displaced key is always present in at least one of its buckets. Returns
+// the new version, or 0 if no path was found.
+static uint64_t table_put(struct Table *t, uint64_t key, const void *val,
+                          uint32_t len) {
+  uint32_t b[2] = {bucket_of(key, 0, t->buckets),
+                   bucket_of(key, 1, t->buckets)};
+  struct SlotHdr *free_slot = NULL;
+  for (int i = 0; i < 2; ++i)
+    for (int s = 0; s < BUCKET_SLOTS; ++s) {
+      struct SlotHdr *h = slot_at(t, b[i], s);
+      if (h->key == key) {
+        t->updates++;
+        return slot_write(h, key, val, len);
+      }
+      if (!h->key && !free_slot)
+        free_slot = h;
+    }
+  if (free_slot) {
+    t->inserts++;
+    return slot_write(free_slot, key, val, len);
+  }
+
+  uint32_t path[MAX_PATH][2];
+  int n = 0;
+  uint32_t cur = b[rng_next(&t->rng) & 1];
+  while (n < MAX_PATH - 1) {
+    int s = (int)(rng_next(&t->rng) % BUCKET_SLOTS), tries = 0;
+    while (on_path(path, n, cur, s) && ++tries < BUCKET_SLOTS)
+      s = (s + 1) % BUCKET_SLOTS;
+    if (tries == BUCKET_SLOTS)
+      break;
+    path[n][0] = cur;
+    path[n][1] = (uint32_t)s;
+    n++;
+    uint64_t victim = slot_at(t, cur, s)->key;
+    uint32_t alt = bucket_of(victim, 0, t->buckets);
+    if (alt == cur)
+      alt = bucket_of(victim, 1, t->buckets);
+    for (int s2 = 0; s2 < BUCKET_SLOTS; ++s2)
+      if (!slot_at(t, alt, s2)->key) {
+        path[n][0] = alt;
+        path[n][1] = (uint32_t)s2;
+        n++;
+        goto found;
+      }
+    cur = alt;
+  }
+  t->full++;
+  return 0;
+
+found:;
+  struct TableHdr *th = (struct TableHdr *)t->base;
+  __atomic_store_n(&th->moves, th->moves + 1, __ATOMIC_RELEASE);
+  for (int i = n - 1; i > 0; --i) {
+    struct SlotHdr *src = slot_at(t, path[i - 1][0], (int)path[i - 1][1]);
+    slot_write(slot_at(t, path[i][0], (int)path[i][1]), src->key, src + 1,
+               src->len);
+  }
+  __atomic_store_n(&th->moves, th->moves + 1, __ATOMIC_RELEASE);
+  t->moved += (uint64_t)(n - 1);
+  t->inserts++;
+  return slot_write(slot_at(t, path[0][0], (int)path[0][1]), key, val, len);
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <port> [--keys N] [--value N] [--buckets N] "
+          "[--recv-depth N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int port = atoi(argv[1]);
+  uint64_t keys = 1000000;
+  uint32_t value_len = 64;
+  uint64_t buckets = 0;
+  int recv_depth = 128;
+
+  for (int i = 2; i < argc; ++i) {
+    if (!strcmp(argv[i], "--keys") && i + 1 < argc) {
+      keys = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--value") && i + 1 < argc) {
+      value_len = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--buckets") && i + 1 < argc) {
+      buckets = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
+      recv_depth = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  // Default to an 80% load factor after the preload.
+  if (!buckets)
+    buckets = keys * 5 / (4 * BUCKET_SLOTS) + 1;
+  if (buckets > UINT32_MAX || value_len < 1 || recv_depth < 1) {
+    fprintf(stderr, "--buckets must fit 32 bits, --value and --recv-depth "
+                    "must be >= 1\n");
+    return 1;
+  }
+  printf("[server] crc32c=%s\n", crc32c_select());
+
+  struct Table t = {0};
+  t.buckets = (uint32_t)buckets;
+  t.value_len = value_len;
+  t.slot_size = (uint32_t)((sizeof(struct SlotHdr) + value_len + 63) & ~63ul);
+  t.rng = 0x853c49e6748fea9bull;
+  size_t table_len =
+      TABLE_HDR + (size_t)t.buckets * BUCKET_SLOTS * t.slot_size;
+  if (posix_memalign((void **)&t.base, 4096, table_len))
+    die("alloc");
+  memset(t.base, 0, table_len);
+
+  // Preload keys 1..N; key k's value is value_len copies of byte k.
+  char *val = malloc(value_len);
+  if (!val)
+    die("malloc");
+  struct timespec ts0, ts1;
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (uint64_t k = 1; k <= keys; ++k) {
+    memset(val, (int)(k & 0xff), value_len);
+    if (!table_put(&t, k, val, value_len)) {
+      fprintf(stderr, "table full after %lu keys; raise --buckets\n",
+              (unsigned long)(k - 1));
+      return 1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  double sec = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+  printf("[server] loaded %lu keys in %.2f s: %u buckets x %d slots x %u "
+         "bytes (%.1f MiB, load %.1f%%, %lu moves)\n",
+         (unsigned long)keys, sec, t.buckets, BUCKET_SLOTS, t.slot_size,
+         table_len / (1024.0 * 1024.0),
+         100.0 * keys / ((double)t.buckets * BUCKET_SLOTS),
+         (unsigned long)t.moved);
+  t.inserts = t.moved = 0;
+
+  struct rdma_event_channel *ec = rdma_create_event_channel();
+  struct rdma_cm_event *e;
+  struct rdma_cm_id *lid = rb_listen(ec, NULL, port, 1);
+  printf("[server] listening on %d ...\n", port);
+
+  // The client keeps as many READs outstanding as both devices allow.
+  struct rdma_conn_param p = {0};
+  struct rdma_cm_id *id = rb_expect_request(ec, 0, &p);
+
+  struct ibv_qp_init_attr qa = {0};
+  qa.qp_type = IBV_QPT_RC;
+  qa.cap.max_send_wr = (uint32_t)recv_depth + 16;
+  qa.cap.max_recv_wr = (uint32_t)recv_depth + 16;
+  qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
+  qa.sq_sig_all = 0;
+  if (rdma_create_qp(id, id->pd, &qa))
+    die("create_qp");
+
+  // GETs never reach this CPU: the table only needs remote READ access.
+  struct ibv_mr *tmr = ibv_reg_mr(id->pd, t.base, table_len,
+                                  IBV_ACCESS_LOCAL_WRITE |
+                                      IBV_ACCESS_REMOTE_READ);
+  if (!tmr)
+    die("reg_mr table");
+
+  // PUT requests land in recv_depth slots; reply i goes out of resp slot i.
+  size_t req_len = sizeof(struct KvReq) + value_len;
+  size_t msg_len = (size_t)recv_depth * (req_len + sizeof(struct KvResp));
+  char *msgs = malloc(msg_len);
+  if (!msgs)
+    die("malloc");
+  struct KvResp *resps = (struct KvResp *)(msgs + (size_t)recv_depth * req_len);
+  struct ibv_mr *mmr =
+      ibv_reg_mr(id->pd, msgs, msg_len, IBV_ACCESS_LOCAL_WRITE);
+  if (!mmr)
+    die("reg_mr msgs");
+  for (int i = 0; i < recv_depth; ++i)
+    post_recv_slot(id, msgs, mmr, req_len, i);
+
+  struct TableInfo info = {(uint64_t)t.base, tmr->rkey, t.buckets,
+                           t.slot_size, value_len, (uint32_t)recv_depth};
+  p.private_data = &info;
+  p.private_data_len = sizeof(info);
+  if (rdma_accept(id, &p))
+    die("accept");
+  rb_expect(ec, RDMA_CM_EVENT_ESTABLISHED, NULL, 0);
+  printf("[server] client connected (READ depth %u), serving PUTs until "
+         "disconnect...\n",
+         p.responder_resources);
+
+  // Serve PUTs until the client disconnects. The CM channel is checked
+  // only when the CQ is idle.
+  if (fcntl(ec->fd, F_SETFL, fcntl(ec->fd, F_GETFL) | O_NONBLOCK))
+    die("fcntl");
+  uint64_t puts = 0;
+  struct ibv_wc wc[32];
+  for (;;) {
+    int n = ibv_poll_cq(id->recv_cq, 32, wc);
+    if (n < 0)
+      die("poll_cq");
+    if (n == 0 && !rdma_get_cm_event(ec, &e)) {
+      enum rdma_cm_event_type ev = e->event;
+      rdma_ack_cm_event(e);
+      if (ev == RDMA_CM_EVENT_DISCONNECTED)
+        break;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (wc[i].status == IBV_WC_WR_FLUSH_ERR)
+        continue;
+      if (wc[i].status)
+        wc_die(&wc[i]);
+      int slot = (int)wc[i].wr_id;
+      struct KvReq *req = (struct KvReq *)(msgs + (size_t)slot * req_len);
+      struct KvResp *resp = &resps[slot];
+      resp->tag = req->tag;
+      resp->version = 0;
+      resp->status = KV_FULL;
+      if (wc[i].byte_len >= sizeof(*req) && req->op == KV_PUT && req->key &&
+          wc[i].byte_len - sizeof(*req) <= value_len) {
+        resp->version = table_put(&t, req->key, req + 1,
+                                  wc[i].byte_len - (uint32_t)sizeof(*req));
+        if (resp->version)
+          resp->status = KV_OK;
+      }
+      puts++;
+      post_recv_slot(id, msgs, mmr, req_len, slot);
+
+      struct ibv_sge s = {.addr = (uintptr_t)resp,
+                          .length = sizeof(*resp),
+                          .lkey = mmr->lkey};
+      struct ibv_send_wr wr = {0}, *bad;
+      wr.wr_id = (uint64_t)slot;
+      wr.sg_list = &s;
+      wr.num_sge = 1;
+      wr.opcode = IBV_WR_SEND;
+      wr.send_flags = IBV_SEND_SIGNALED;
+      if (ibv_post_send(id->qp, &wr, &bad))
+        die("post_send");
+    }
+    // Reply completions only free send queue entries.
+    n = ibv_poll_cq(id->send_cq, 32, wc);
+    if (n < 0)
+      die("poll_cq");
+    for (int i = 0; i < n; ++i)
+      if (wc[i].status && wc[i].status != IBV_WC_WR_FLUSH_ERR)
+        wc_die(&wc[i]);
+  }
+  printf("[server] %lu PUTs: %lu updates, %lu inserts, %lu full, %lu moves\n",
+         (unsigned long)puts, (unsigned long)t.updates,
+         (unsigned long)t.inserts, (unsigned long)t.full,
+         (unsigned long)t.moved);
+
+  rdma_disconnect(id);
+  ibv_dereg_mr(mmr);
+  ibv_dereg_mr(tmr);
+  free(msgs);
+  free(val);
+  free(t.base);
+  rdma_destroy_qp(id);
+  rdma_destroy_id(id);
+  rdma_destroy_id(lid);
+  rdma_destroy_event_channel(ec);
+  return 0;
+}
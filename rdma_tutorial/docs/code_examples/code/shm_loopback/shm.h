@@ -0,0 +1,152 @@
+// shm.h: a software loopback "NIC" shared by shm_server.c and shm_client.c.
+// Both processes map one memfd region holding the server's buffer, the
+// client's buffer and two single-producer/single-consumer rings:
+//
+// - sq: work requests, client -> server. The server process plays the NIC
+//   and the responder: it executes each request with a memcpy between the
+//   two buffers.
+// - cq: completions for signaled requests, server -> client.
+//
+// No verbs device is involved, so the rates are an upper bound on what the
+// software around a NIC can sustain on this host.
+#ifndef SHM_H
+#define SHM_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_RING 4096 // slots per ring (power of two); caps --window
+#define SHM_LINE 64
+
+enum ShmOp { SHM_READ, SHM_WRITE, SHM_SEND, SHM_WRITE_IMM };
+
+#define SHM_SIGNALED 1u
+
+// One ring slot: a work request on sq, or a completion on cq (wr_id, op,
+// len and status).
+struct ShmEntry {
+  uint64_t wr_id;
+  uint64_t remote_off; // target in the server buffer; unused by SEND
+  uint32_t op, len, flags, status;
+};
+
+enum ShmStatus { SHM_OK, SHM_BAD_OP, SHM_BAD_RANGE };
+
+// head is only written by the consumer and tail only by the producer; each
+// sits on its own cache line so the two sides do not share one.
+struct ShmRing {
+  _Alignas(SHM_LINE) _Atomic uint64_t head;
+  _Alignas(SHM_LINE) _Atomic uint64_t tail;
+  _Alignas(SHM_LINE) struct ShmEntry e[SHM_RING];
+};
+
+// The start of the region. The client sets `closed` once its last
+// completion is in; the server drains sq and exits.
+struct ShmHdr {
+  _Alignas(SHM_LINE) uint64_t server_off, server_len;
+  uint64_t client_off, client_len;
+  _Alignas(SHM_LINE) _Atomic uint32_t closed;
+  _Alignas(SHM_LINE) struct ShmRing sq, cq;
+};
+
+// Sent with the memfd over the control socket, in place of the connect
+// private data the RDMA pair exchanges.
+struct ShmInfo {
+  uint64_t region_len;
+  uint32_t mode, msg;
+} __attribute__((packed));
+
+// Each side's view of a ring: the peer's index is re-read only when the
+// cached copy says the ring looks full (producer) or empty (consumer).
+struct ShmQ {
+  struct ShmRing *r;
+  uint64_t cached;
+};
+
+static inline void shm_die(const char *m) {
+  perror(m);
+  exit(1);
+}
+
+static inline uint64_t shm_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline const char *shm_mode_str(uint32_t mode) {
+  static const char *const names[] = {"read", "write", "send", "write_imm"};
+  return mode <= SHM_WRITE_IMM ? names[mode] : "?";
+}
+
+static inline int shm_mode_parse(const char *s, uint32_t *mode) {
+  for (uint32_t m = SHM_READ; m <= SHM_WRITE_IMM; ++m)
+    if (!strcmp(s, shm_mode_str(m))) {
+      *mode = m;
+      return 0;
+    }
+  return -1;
+}
+
+// Producer side. Fails (returns 0) when the ring is full.
+static inline int shm_push(struct ShmQ *q, const struct ShmEntry *e) {
+  struct ShmRing *r = q->r;
+  uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  if (t - q->cached == SHM_RING) {
+    q->cached = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (t - q->cached == SHM_RING)
+      return 0;
+  }
+  r->e[t & (SHM_RING - 1)] = *e;
+  atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+  return 1;
+}
+
+// Consumer side: copy out up to `max` entries and retire them with one
+// store to head. Returns how many were taken.
+static inline int shm_pop(struct ShmQ *q, struct ShmEntry *out, int max) {
+  struct ShmRing *r = q->r;
+  uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (q->cached == h) {
+    q->cached = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (q->cached == h)
+      return 0;
+  }
+  int n = 0;
+  while (n < max && h + n != q->cached) {
+    out[n] = r->e[(h + n) & (SHM_RING - 1)];
+    n++;
+  }
+  atomic_store_explicit(&r->head, h + n, memory_order_release);
+  return n;
+}
+
+// Called on every empty poll. Each side normally spins on its own core;
+// yielding now and then keeps the pair moving when they share one (CI
+// runners), at no cost when nothing else wants the CPU.
+static inline void shm_relax(uint64_t *idle) {
+  if (++*idle % 256 == 0)
+    sched_yield();
+}
+
+// The control socket lives in the abstract namespace, keyed by port, so
+// nothing is left behind in the filesystem.
+static inline socklen_t shm_addr(struct sockaddr_un *a, int port) {
+  memset(a, 0, sizeof(*a));
+  a->sun_family = AF_UNIX;
+  int n = snprintf(a->sun_path + 1, sizeof(a->sun_path) - 1,
+                   "rdma_bench_shm_%d", port);
+  return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+#endif
@@ -0,0 +1,145 @@
+// gcc -O3 shm_client.c -o shm_client
+#include "shm.h"
+#include <sys/mman.h>
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <port> [--mode read|write|send|write_imm] [--msg N] "
+          "[--iters N] [--window N] [--signal-every N]\n",
+          p);
+}
+
+static int recv_fd(int c, struct ShmInfo *info) {
+  struct iovec iov = {info, sizeof(*info)};
+  char ctl[CMSG_SPACE(sizeof(int))];
+  struct msghdr mh = {0};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctl;
+  mh.msg_controllen = sizeof(ctl);
+  if (recvmsg(c, &mh, 0) != (ssize_t)sizeof(*info))
+    shm_die("recvmsg");
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  if (!cm || cm->cmsg_type != SCM_RIGHTS) {
+    fprintf(stderr, "server sent no memfd\n");
+    exit(1);
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int port = atoi(argv[1]);
+  uint32_t mode = SHM_READ;
+  size_t msg = 4096;
+  uint64_t iters = 100000;
+  uint64_t window = 64;
+  uint64_t every = 1;
+
+  for (int i = 2; i < argc; ++i) {
+    if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
+      if (shm_mode_parse(argv[++i], &mode)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
+      msg = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
+      iters = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+      window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--signal-every") && i + 1 < argc) {
+      every = strtoull(argv[++i], NULL, 0);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!window || window > SHM_RING || !every || !iters) {
+    fprintf(stderr, "--window must be 1-%d; --iters and --signal-every "
+                    "must be positive\n",
+            SHM_RING);
+    return 1;
+  }
+  // The server only pushes a cq entry for a SHM_SIGNALED request, and
+  // `done` only moves on one, so a longer interval would stall the loop.
+  if (every > window) {
+    fprintf(stderr, "--signal-every must not exceed --window\n");
+    return 1;
+  }
+
+  struct sockaddr_un a;
+  socklen_t alen = shm_addr(&a, port);
+  int c = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (c < 0 || connect(c, (struct sockaddr *)&a, alen))
+    shm_die("connect");
+  struct ShmInfo info;
+  int fd = recv_fd(c, &info);
+  if (info.mode != mode) {
+    fprintf(stderr, "server runs --mode %s\n", shm_mode_str(info.mode));
+    return 1;
+  }
+  if (info.msg < msg) {
+    fprintf(stderr, "server buffer too small (%u < %zu)\n", info.msg, msg);
+    return 1;
+  }
+  char *base = mmap(NULL, info.region_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    shm_die("mmap");
+  struct ShmHdr *h = (struct ShmHdr *)base;
+  memset(base + h->client_off, 0xab, msg);
+  uint64_t slots = h->server_len / info.msg;
+
+  // The same closed loop as run_closed_loop() in librdmabench: `window`
+  // requests in flight, every `every`-th one signaled, and a completion
+  // for wr_id i retiring everything up to i.
+  struct ShmQ sq = {&h->sq, 0}, cq = {&h->cq, 0};
+  struct ShmEntry wr = {.op = mode, .len = (uint32_t)msg};
+  struct ShmEntry wc[32];
+  uint64_t posted = 0, done = 0, idle = 0;
+  uint64_t t0 = shm_now_ns();
+  while (done < iters) {
+    while (posted - done < window && posted < iters) {
+      wr.wr_id = posted;
+      wr.flags =
+          (posted + 1) % every == 0 || posted + 1 == iters ? SHM_SIGNALED : 0;
+      // write_imm rotates over the server's receive ring like bench_client.
+      wr.remote_off = mode == SHM_WRITE_IMM ? (posted % slots) * info.msg : 0;
+      if (!shm_push(&sq, &wr))
+        break;
+      posted++;
+    }
+    int n = shm_pop(&cq, wc, 32);
+    if (!n)
+      shm_relax(&idle);
+    for (int i = 0; i < n; ++i) {
+      if (wc[i].status != SHM_OK) {
+        printf("shm error: wr_id=%lu status=%u\n", (unsigned long)wc[i].wr_id,
+               wc[i].status);
+        exit(1);
+      }
+      done = wc[i].wr_id + 1;
+    }
+  }
+  uint64_t ns = shm_now_ns() - t0;
+
+  double sec = ns / 1e9;
+  double mops = iters / sec / 1e6;
+  double bw = (iters * msg) / sec / (1024.0 * 1024.0 * 1024.0);
+  printf(
+      "[client] %s done: %.2f Mops, %.2f GiB/s (msg=%zu bytes, window=%lu)\n",
+      shm_mode_str(mode), mops, bw, msg, (unsigned long)window);
+
+  atomic_store_explicit(&h->closed, 1, memory_order_release);
+  munmap(base, info.region_len);
+  close(fd);
+  close(c);
+  return 0;
+}
@@ -0,0 +1,176 @@
+// gcc -O3 shm_server.c -o shm_server
+#include "shm.h"
+#include <sys/mman.h>
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <port> [--mode read|write|send|write_imm] [--msg N] "
+          "[--iters N] [--recv-depth N]\n",
+          p);
+}
+
+// Hand the client the region's memfd (SCM_RIGHTS) together with its layout.
+static void send_fd(int c, int fd, const struct ShmInfo *info) {
+  struct iovec iov = {(void *)info, sizeof(*info)};
+  char ctl[CMSG_SPACE(sizeof(int))] = {0};
+  struct msghdr mh = {0};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctl;
+  mh.msg_controllen = sizeof(ctl);
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+  if (sendmsg(c, &mh, 0) != (ssize_t)sizeof(*info))
+    shm_die("sendmsg");
+}
+
+static size_t page_up(size_t n) { return (n + 4095) & ~(size_t)4095; }
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint32_t mode = SHM_READ;
+  size_t msg = 4096;
+  uint64_t iters = 100000;
+  int recv_depth = 128;
+  int port = atoi(argv[1]);
+
+  for (int i = 2; i < argc; ++i) {
+    if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
+      if (shm_mode_parse(argv[++i], &mode)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--msg") && i + 1 < argc) {
+      msg = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
+      iters = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--recv-depth") && i + 1 < argc) {
+      recv_depth = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!msg || msg > UINT32_MAX || recv_depth < 1) {
+    fprintf(stderr, "--msg and --recv-depth must be positive\n");
+    return 1;
+  }
+  int two_sided = mode == SHM_SEND || mode == SHM_WRITE_IMM;
+
+  // Header and rings, then recv_depth slots for the server (the receive
+  // ring, or the READ/WRITE target), then one message for the client.
+  size_t server_off = page_up(sizeof(struct ShmHdr));
+  size_t server_len = msg * (size_t)recv_depth;
+  size_t client_off = page_up(server_off + server_len);
+  size_t region_len = page_up(client_off + msg);
+
+  int fd = memfd_create("rdma_bench_shm", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, (off_t)region_len))
+    shm_die("memfd");
+  char *base = mmap(NULL, region_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  if (base == MAP_FAILED)
+    shm_die("mmap");
+  struct ShmHdr *h = (struct ShmHdr *)base;
+  h->server_off = server_off;
+  h->server_len = server_len;
+  h->client_off = client_off;
+  h->client_len = msg;
+  char *sbuf = base + server_off, *cbuf = base + client_off;
+
+  struct sockaddr_un a;
+  socklen_t alen = shm_addr(&a, port);
+  int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ls < 0 || bind(ls, (struct sockaddr *)&a, alen) || listen(ls, 1))
+    shm_die("listen");
+  printf("[server] listening on shm %d (mode=%s msg=%zu iters=%lu)\n", port,
+         shm_mode_str(mode), msg, (unsigned long)iters);
+
+  int c = accept(ls, NULL, NULL);
+  if (c < 0)
+    shm_die("accept");
+  struct ShmInfo info = {region_len, mode, (uint32_t)msg};
+  send_fd(c, fd, &info);
+  if (!two_sided)
+    printf("[server] ready for client %s, waiting for disconnect...\n",
+           mode == SHM_READ ? "READ" : "WRITE");
+
+  // The "NIC" loop: take requests in batches, move the bytes, and post a
+  // completion for each signaled one. SENDs consume the receive slots in
+  // order, as a posted receive ring would.
+  struct ShmQ sq = {&h->sq, 0}, cq = {&h->cq, 0};
+  struct ShmEntry batch[32];
+  uint64_t executed = 0, received = 0, t0 = 0, t1 = 0, idle = 0;
+  for (;;) {
+    int n = shm_pop(&sq, batch, 32);
+    if (!n) {
+      if (atomic_load_explicit(&h->closed, memory_order_acquire))
+        break;
+      shm_relax(&idle);
+      // A client that exits without closing (an error, Ctrl-C) shows up
+      // as EOF on the control socket.
+      char x;
+      if (idle % 4096 == 0 && recv(c, &x, 1, MSG_DONTWAIT) == 0)
+        break;
+      continue;
+    }
+    uint64_t before = received;
+    if (!received)
+      t0 = shm_now_ns();
+    for (int i = 0; i < n; ++i) {
+      struct ShmEntry *e = &batch[i];
+      uint32_t status = SHM_OK;
+      if (e->op > SHM_WRITE_IMM)
+        status = SHM_BAD_OP;
+      else if (e->len > msg ||
+               (e->op != SHM_SEND && e->remote_off + e->len > server_len))
+        status = SHM_BAD_RANGE;
+      else if (e->op == SHM_READ)
+        memcpy(cbuf, sbuf + e->remote_off, e->len);
+      else if (e->op == SHM_WRITE)
+        memcpy(sbuf + e->remote_off, cbuf, e->len);
+      else {
+        size_t off = e->op == SHM_SEND
+                         ? (size_t)(received % (uint64_t)recv_depth) * msg
+                         : e->remote_off;
+        memcpy(sbuf + off, cbuf, e->len);
+        received++;
+      }
+      executed++;
+      if (!(e->flags & SHM_SIGNALED) && status == SHM_OK)
+        continue;
+      struct ShmEntry wc = {.wr_id = e->wr_id, .op = e->op, .len = e->len,
+                            .status = status};
+      while (!shm_push(&cq, &wc))
+        ;
+    }
+    // Receive timing is per batch, so the clock stays off the per-op path.
+    if (received != before)
+      t1 = shm_now_ns();
+  }
+
+  if (two_sided) {
+    double sec = (t1 - t0) / 1e9;
+    double mops = sec > 0 ? received / sec / 1e6 : 0;
+    double bw =
+        sec > 0 ? received * msg / sec / (1024.0 * 1024.0 * 1024.0) : 0;
+    printf("[server] recv done: %.2f Mops, %.2f GiB/s (%lu of %lu)\n", mops,
+           bw, (unsigned long)received, (unsigned long)iters);
+  } else {
+    printf("[server] client closed after %lu requests\n",
+           (unsigned long)executed);
+  }
+
+  close(c);
+  close(ls);
+  munmap(base, region_len);
+  close(fd);
+  return 0;
+}
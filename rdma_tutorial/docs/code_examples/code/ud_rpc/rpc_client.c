@@ -0,0 +1,260 @@
+// gcc rpc_client.c ../librdmabench/verbs.c -o rpc_client -libverbs -lpthread
+#include "ud_rpc.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum { RPC_ECHO = 1, RPC_SIZED = 2 };
+
+// One outstanding RPC. The tag is the slot index plus a generation, so a
+// late response to a retransmitted request is recognised and dropped.
+struct Pending {
+  uint64_t t_first, t_sent;
+  uint32_t gen;
+  int busy;
+};
+
+struct Client {
+  pthread_t th;
+  struct RpcEp ep;
+  struct ibv_ah *ah;
+  uint32_t qpn; // server worker this thread talks to
+  uint64_t window, iters, timeout_ns;
+  size_t req, resp;
+  struct Pending *slot;
+  uint64_t issued, done, stale, retransmits;
+  uint64_t *lat;
+};
+
+// Queue the request for window slot `i`; the caller rings the doorbell.
+static void send_request(struct Client *c, uint32_t i) {
+  struct Pending *p = &c->slot[i];
+  char *payload = rpc_tx_reserve(&c->ep);
+  uint32_t want = (uint32_t)c->resp;
+  memset(payload, (int)(i & 0xff), c->req);
+  memcpy(payload, &want, sizeof(want));
+  p->gen++;
+  p->t_sent = now_ns();
+  rpc_tx_commit(&c->ep, c->ah, c->qpn, RPC_SIZED, 0,
+                i | (p->gen & 0xffff) << 16, c->req);
+}
+
+static void on_response(void *arg, uint32_t tag, const void *resp,
+                        size_t len) {
+  (void)resp;
+  (void)len;
+  struct Client *c = arg;
+  uint32_t i = tag & 0xffff;
+  struct Pending *p = &c->slot[i];
+  if (i >= c->window || !p->busy || (uint16_t)p->gen != tag >> 16) {
+    c->stale++;
+    return;
+  }
+  uint64_t now = now_ns();
+  c->lat[c->done++] = now - p->t_first;
+  if (c->issued < c->iters) {
+    c->issued++;
+    p->t_first = now;
+    send_request(c, i);
+  } else {
+    p->busy = 0;
+  }
+}
+
+static void *client_main(void *arg) {
+  struct Client *c = arg;
+  c->ep.cont = on_response;
+  c->ep.cont_arg = c;
+  for (uint32_t i = 0; i < c->window && c->issued < c->iters; ++i) {
+    c->slot[i].busy = 1;
+    c->slot[i].t_first = now_ns();
+    c->issued++;
+    send_request(c, i);
+  }
+  rpc_flush(&c->ep);
+
+  uint64_t next_check = now_ns() + c->timeout_ns;
+  while (c->done < c->iters) {
+    rpc_poll(&c->ep);
+    // UD drops silently (e.g. when a receive ring overflows), so resend
+    // anything that has waited longer than the timeout.
+    uint64_t now = now_ns();
+    if (now < next_check)
+      continue;
+    for (uint32_t i = 0; i < c->window; ++i)
+      if (c->slot[i].busy && now - c->slot[i].t_sent > c->timeout_ns) {
+        c->retransmits++;
+        send_request(c, i);
+      }
+    rpc_flush(&c->ep);
+    next_check = now + c->timeout_ns / 4;
+  }
+  return NULL;
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <server_ip> <tcp_port> [--threads N] [--window N] "
+          "[--iters N] [--req N] [--resp N] [--timeout-us N] [--dev NAME] "
+          "[--port N] [--gid-index N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *ip = argv[1];
+  const char *tcp_port = argv[2];
+  int threads = 1;
+  uint64_t window = 16;
+  uint64_t iters = 1000000;
+  size_t req = 32, resp = 32;
+  uint64_t timeout_us = 1000;
+  const char *dev = NULL;
+  uint8_t port = 1;
+  int gid_index = 3;
+
+  for (int i = 3; i < argc; ++i) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+      window = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--iters") && i + 1 < argc) {
+      iters = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--req") && i + 1 < argc) {
+      req = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--resp") && i + 1 < argc) {
+      resp = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--timeout-us") && i + 1 < argc) {
+      timeout_us = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--dev") && i + 1 < argc) {
+      dev = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = (uint8_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gid-index") && i + 1 < argc) {
+      gid_index = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (req < sizeof(uint32_t))
+    req = sizeof(uint32_t);
+  if (threads < 1 || !window || window > 0xffff || !iters || !timeout_us) {
+    fprintf(stderr, "--threads, --iters and --timeout-us must be >= 1, "
+                    "--window 1-65535\n");
+    return 1;
+  }
+
+  // Fetch the server's worker QPNs and address over TCP.
+  struct addrinfo hints = {0}, *res;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(ip, tcp_port, &hints, &res))
+    die("getaddrinfo");
+  int s = socket(res->ai_family, SOCK_STREAM, 0);
+  if (s < 0 || connect(s, res->ai_addr, res->ai_addrlen))
+    die("connect");
+  struct RpcHello hello;
+  size_t got = 0;
+  while (got < sizeof(hello)) {
+    ssize_t r = read(s, (char *)&hello + got, sizeof(hello) - got);
+    if (r <= 0)
+      die("read hello");
+    got += (size_t)r;
+  }
+  close(s);
+  freeaddrinfo(res);
+  if (!hello.workers || hello.workers > RPC_MAX_WORKERS) {
+    fprintf(stderr, "bad hello from server\n");
+    return 1;
+  }
+
+  struct ibv_context *ctx = open_device(dev);
+  struct ibv_pd *pd = ibv_alloc_pd(ctx);
+  if (!pd)
+    die("alloc_pd");
+  struct Client *c = calloc((size_t)threads, sizeof(*c));
+  if (!c)
+    die("calloc");
+
+  // Thread t talks to server worker t mod workers, through its own QP.
+  uint32_t tx_slots = (uint32_t)window * 2 + 64;
+  for (int t = 0; t < threads; ++t) {
+    struct Client *k = &c[t];
+    rpc_ep_init(&k->ep, ctx, pd, port, (uint32_t)window + 64, tx_slots);
+    uint32_t mtu = hello.mtu < k->ep.mtu ? hello.mtu : k->ep.mtu;
+    size_t max = mtu - sizeof(struct RpcHdr);
+    if (req > max || resp > max) {
+      fprintf(stderr, "--req and --resp must fit %zu bytes (path MTU %u)\n",
+              max, mtu);
+      return 1;
+    }
+    struct ibv_ah_attr aa = {0};
+    aa.dlid = hello.lid;
+    aa.port_num = port;
+    if (gid_index >= 0) {
+      aa.is_global = 1;
+      memcpy(aa.grh.dgid.raw, hello.gid, sizeof(hello.gid));
+      aa.grh.sgid_index = (uint8_t)gid_index;
+      aa.grh.hop_limit = 64;
+    }
+    k->ah = ibv_create_ah(pd, &aa);
+    if (!k->ah)
+      die("create_ah");
+    k->qpn = hello.qpn[t % hello.workers];
+    k->window = window;
+    k->iters = iters;
+    k->timeout_ns = timeout_us * 1000;
+    k->req = req;
+    k->resp = resp;
+    k->slot = calloc(window, sizeof(*k->slot));
+    k->lat = malloc(iters * sizeof(*k->lat));
+    if (!k->slot || !k->lat)
+      die("malloc");
+  }
+
+  uint64_t t0 = now_ns();
+  for (int t = 0; t < threads; ++t)
+    if (pthread_create(&c[t].th, NULL, client_main, &c[t]))
+      die("pthread_create");
+  for (int t = 0; t < threads; ++t)
+    pthread_join(c[t].th, NULL);
+  double sec = (now_ns() - t0) / 1e9;
+
+  uint64_t total = (uint64_t)threads * iters, retransmits = 0, stale = 0;
+  uint64_t *lat = malloc(total * sizeof(*lat));
+  if (!lat)
+    die("malloc");
+  for (int t = 0; t < threads; ++t) {
+    memcpy(lat + (uint64_t)t * iters, c[t].lat, iters * sizeof(*lat));
+    retransmits += c[t].retransmits;
+    stale += c[t].stale;
+  }
+  qsort(lat, total, sizeof(*lat), cmp_u64);
+  printf("[client] rpc done: %.2f Mrps (threads=%d, window=%lu, req=%zu, "
+         "resp=%zu, workers=%u)\n",
+         total / sec / 1e6, threads, (unsigned long)window, req, resp,
+         hello.workers);
+  printf("[client] latency: p50=%.2f us p99=%.2f us p99.9=%.2f us, "
+         "%lu retransmits, %lu stale responses\n",
+         lat[total / 2] / 1e3, lat[total * 99 / 100] / 1e3,
+         lat[total * 999 / 1000] / 1e3, (unsigned long)retransmits,
+         (unsigned long)stale);
+
+  for (int t = 0; t < threads; ++t) {
+    ibv_destroy_ah(c[t].ah);
+    rpc_ep_destroy(&c[t].ep);
+    free(c[t].slot);
+    free(c[t].lat);
+  }
+  free(lat);
+  free(c);
+  ibv_dealloc_pd(pd);
+  ibv_close_device(ctx);
+  return 0;
+}
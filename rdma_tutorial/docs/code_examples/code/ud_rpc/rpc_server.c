@@ -0,0 +1,193 @@
+// gcc rpc_server.c ../librdmabench/verbs.c -o rpc_server -libverbs -lpthread
+#include "ud_rpc.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Request types this server handles.
+enum { RPC_ECHO = 1, RPC_SIZED = 2 };
+
+struct Worker {
+  pthread_t th;
+  struct RpcEp ep;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+// RPC_ECHO: the response is the request.
+static size_t handle_echo(void *arg, const void *req, size_t len, void *resp,
+                          size_t max) {
+  (void)arg;
+  if (len > max)
+    len = max;
+  memcpy(resp, req, len);
+  return len;
+}
+
+// RPC_SIZED: the request starts with the response length the caller wants.
+static size_t handle_sized(void *arg, const void *req, size_t len, void *resp,
+                           size_t max) {
+  (void)arg;
+  uint32_t want = 0;
+  if (len >= sizeof(want))
+    memcpy(&want, req, sizeof(want));
+  if (want > max)
+    want = (uint32_t)max;
+  memset(resp, 0x5a, want);
+  return want;
+}
+
+static void *worker_main(void *p) {
+  struct Worker *w = p;
+  while (!stop)
+    rpc_poll(&w->ep);
+  return NULL;
+}
+
+static void usage(const char *p) {
+  fprintf(stderr,
+          "Usage: %s <tcp_port> [--threads N] [--ring N] [--dev NAME] "
+          "[--port N] [--gid-index N]\n",
+          p);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int tcp_port = atoi(argv[1]);
+  int threads = 1;
+  uint32_t ring = 4096;
+  const char *dev = NULL;
+  uint8_t port = 1;
+  int gid_index = 3; // RoCE v2 global GID, as in the UD examples
+
+  for (int i = 2; i < argc; ++i) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--ring") && i + 1 < argc) {
+      ring = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--dev") && i + 1 < argc) {
+      dev = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = (uint8_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gid-index") && i + 1 < argc) {
+      gid_index = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (threads < 1 || threads > RPC_MAX_WORKERS || ring < 64) {
+    fprintf(stderr, "--threads must be 1-%d and --ring >= 64\n",
+            RPC_MAX_WORKERS);
+    return 1;
+  }
+
+  struct ibv_context *ctx = open_device(dev);
+  struct ibv_pd *pd = ibv_alloc_pd(ctx);
+  if (!pd)
+    die("alloc_pd");
+
+  // One UD QP per worker; responses leave from the QP that got the request.
+  struct RpcHello hello = {0};
+  struct Worker *w = calloc((size_t)threads, sizeof(*w));
+  if (!w)
+    die("calloc");
+  for (int t = 0; t < threads; ++t) {
+    rpc_ep_init(&w[t].ep, ctx, pd, port, ring, 1024);
+    rpc_register(&w[t].ep, RPC_ECHO, handle_echo, NULL);
+    rpc_register(&w[t].ep, RPC_SIZED, handle_sized, NULL);
+    hello.qpn[t] = w[t].ep.qp->qp_num;
+  }
+  struct ibv_port_attr pa;
+  if (ibv_query_port(ctx, port, &pa))
+    die("query_port");
+  union ibv_gid gid = {0};
+  if (gid_index >= 0 && ibv_query_gid(ctx, port, gid_index, &gid))
+    die("query_gid");
+  hello.workers = (uint32_t)threads;
+  hello.mtu = w[0].ep.mtu;
+  hello.lid = pa.lid;
+  memcpy(hello.gid, gid.raw, sizeof(hello.gid));
+
+  struct sigaction sa = {0};
+  sa.sa_handler = on_signal; // no SA_RESTART: accept() returns on Ctrl-C
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  for (int t = 0; t < threads; ++t)
+    if (pthread_create(&w[t].th, NULL, worker_main, &w[t]))
+      die("pthread_create");
+
+  // Clients fetch the worker QPNs and our address over TCP, then talk to
+  // the workers over UD only.
+  int ls = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in a = {0};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(tcp_port);
+  if (ls < 0 || bind(ls, (struct sockaddr *)&a, sizeof(a)) ||
+      listen(ls, 64))
+    die("listen");
+  printf("[server] %d worker(s), ring=%u, mtu=%u, listening on tcp %d "
+         "(Ctrl-C to stop)\n",
+         threads, ring, hello.mtu, tcp_port);
+
+  double t_last = now_ns() / 1e9;
+  uint64_t last = 0;
+  while (!stop) {
+    // Wake up once a second to print the request rate.
+    struct timeval tv = {1, 0};
+    setsockopt(ls, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int c = accept(ls, NULL, NULL);
+    if (c >= 0) {
+      if (write(c, &hello, sizeof(hello)) != (ssize_t)sizeof(hello))
+        perror("write hello");
+      close(c);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      die("accept");
+    }
+    double now = now_ns() / 1e9;
+    if (now - t_last < 1)
+      continue;
+    uint64_t total = 0;
+    for (int t = 0; t < threads; ++t)
+      total += __atomic_load_n(&w[t].ep.requests, __ATOMIC_RELAXED);
+    if (total != last)
+      printf("[server] %.2f Mrps\n", (total - last) / (now - t_last) / 1e6);
+    last = total;
+    t_last = now;
+  }
+
+  uint64_t requests = 0, doorbells = 0, ahs = 0, unknown = 0;
+  for (int t = 0; t < threads; ++t) {
+    pthread_join(w[t].th, NULL);
+    requests += w[t].ep.requests;
+    doorbells += w[t].ep.doorbells;
+    ahs += w[t].ep.ahs_created;
+    unknown += w[t].ep.unknown;
+    rpc_ep_destroy(&w[t].ep);
+  }
+  printf("[server] %lu requests, %.1f responses per doorbell, %lu cached "
+         "AHs, %lu unknown\n",
+         (unsigned long)requests,
+         doorbells ? (double)requests / doorbells : 0.0, (unsigned long)ahs,
+         (unsigned long)unknown);
+  close(ls);
+  free(w);
+  ibv_dealloc_pd(pd);
+  ibv_close_device(ctx);
+  return 0;
+}
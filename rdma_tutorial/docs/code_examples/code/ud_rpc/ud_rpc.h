@@ -0,0 +1,324 @@
+// ud_rpc.h: a small UD RPC engine in the style of eRPC/HERD, shared by
+// rpc_server.c and rpc_client.c. Each thread owns one RpcEp (its own UD QP,
+// CQs, receive ring and send slots), so the fast path takes no locks.
+//
+// - Requests and responses are single UD SENDs of at most the path MTU,
+//   prefixed by an RpcHdr; receives land behind the 40-byte GRH slot.
+// - Handlers are registered per request type and write their response
+//   straight into a send slot.
+// - Sends queued while a batch of completions is handled are posted with
+//   one ibv_post_send (one doorbell), as are the receive reposts.
+// - Responses reuse one address handle per peer, created from the
+//   request's work completion and cached by source GID (or LID).
+//
+// die(), clocks and the device and QP setup come from the verbs-only part
+// of librdmabench.
+#ifndef UD_RPC_H
+#define UD_RPC_H
+
+#include "../librdmabench/rdma_verbs.h"
+#include <infiniband/verbs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RPC_GRH 40
+#define RPC_QKEY 0x11111111
+#define RPC_MAX_TYPES 256
+#define RPC_BATCH 32        // completions handled per poll, WRs per doorbell
+#define RPC_SIGNAL_EVERY 16 // sends between signaled ones
+#define RPC_AH_CACHE 1024   // peers per endpoint (power of two)
+#define RPC_MAX_WORKERS 64
+
+enum { RPC_RESP = 1 };
+
+struct RpcHdr {
+  uint8_t type;
+  uint8_t flags; // RPC_RESP
+  uint16_t len;  // payload bytes after the header
+  uint32_t tag;  // chosen by the caller, echoed in the response
+} __attribute__((packed));
+
+// Sent over the TCP control connection: how to reach the server's workers.
+struct RpcHello {
+  uint32_t workers, mtu;
+  uint16_t lid;
+  uint8_t gid[16];
+  uint32_t qpn[RPC_MAX_WORKERS];
+} __attribute__((packed));
+
+// Fill `resp` (at most `max` bytes) for one request and return its length.
+typedef size_t (*rpc_handler)(void *arg, const void *req, size_t len,
+                              void *resp, size_t max);
+// Called for every response an endpoint receives.
+typedef void (*rpc_cont)(void *arg, uint32_t tag, const void *resp,
+                         size_t len);
+
+struct RpcAhEntry {
+  uint8_t key[16];
+  struct ibv_ah *ah;
+};
+
+struct RpcEp {
+  struct ibv_context *ctx;
+  struct ibv_pd *pd;
+  struct ibv_cq *send_cq, *recv_cq;
+  struct ibv_qp *qp;
+  struct ibv_mr *mr;
+  uint8_t port;
+  char *rx, *tx; // receive ring (GRH + mtu per entry), send slots (mtu)
+  uint32_t ring, tx_slots, mtu, max_inline;
+  uint64_t tx_posted, tx_done;
+
+  // Pending doorbell batches.
+  struct ibv_send_wr wr[RPC_BATCH];
+  struct ibv_sge sge[RPC_BATCH];
+  int nwr;
+  struct ibv_recv_wr rwr[RPC_BATCH];
+  struct ibv_sge rsge[RPC_BATCH];
+  int nrwr;
+
+  rpc_handler handlers[RPC_MAX_TYPES];
+  void *handler_arg[RPC_MAX_TYPES];
+  rpc_cont cont;
+  void *cont_arg;
+  struct RpcAhEntry ahs[RPC_AH_CACHE];
+
+  uint64_t requests, responses, doorbells, ahs_created, unknown;
+};
+
+static inline void rpc_post_recv_slot(struct RpcEp *ep, uint32_t i) {
+  struct ibv_sge *s = &ep->rsge[ep->nrwr];
+  struct ibv_recv_wr *w = &ep->rwr[ep->nrwr];
+  s->addr = (uintptr_t)(ep->rx + (size_t)i * (RPC_GRH + ep->mtu));
+  s->length = RPC_GRH + ep->mtu;
+  s->lkey = ep->mr->lkey;
+  memset(w, 0, sizeof(*w));
+  w->wr_id = i;
+  w->sg_list = s;
+  w->num_sge = 1;
+  if (ep->nrwr)
+    ep->rwr[ep->nrwr - 1].next = w;
+  if (++ep->nrwr == RPC_BATCH) {
+    struct ibv_recv_wr *bad;
+    if (ibv_post_recv(ep->qp, ep->rwr, &bad))
+      die("post_recv");
+    ep->nrwr = 0;
+  }
+}
+
+// Post everything queued so far: one doorbell for the sends, one for the
+// receive reposts.
+static inline void rpc_flush(struct RpcEp *ep) {
+  if (ep->nwr) {
+    struct ibv_send_wr *bad;
+    if (ibv_post_send(ep->qp, ep->wr, &bad))
+      die("post_send");
+    ep->nwr = 0;
+    ep->doorbells++;
+  }
+  if (ep->nrwr) {
+    struct ibv_recv_wr *bad;
+    if (ibv_post_recv(ep->qp, ep->rwr, &bad))
+      die("post_recv");
+    ep->nrwr = 0;
+  }
+}
+
+// Set up one endpoint on `port` with `ring` receives and `tx_slots` send
+// slots. Messages (header included) may be up to the port's active MTU.
+static inline void rpc_ep_init(struct RpcEp *ep, struct ibv_context *ctx,
+                               struct ibv_pd *pd, uint8_t port, uint32_t ring,
+                               uint32_t tx_slots) {
+  memset(ep, 0, sizeof(*ep));
+  ep->ctx = ctx;
+  ep->pd = pd;
+  ep->port = port;
+  ep->ring = ring;
+  ep->tx_slots = tx_slots;
+
+  ep->mtu = port_mtu(ctx, port);
+
+  ep->send_cq = ibv_create_cq(ctx, (int)tx_slots, NULL, NULL, 0);
+  ep->recv_cq = ibv_create_cq(ctx, (int)ring, NULL, NULL, 0);
+  if (!ep->send_cq || !ep->recv_cq)
+    die("create_cq");
+  struct ibv_qp_init_attr qa = {0};
+  qa.send_cq = ep->send_cq;
+  qa.recv_cq = ep->recv_cq;
+  qa.qp_type = IBV_QPT_UD;
+  qa.cap.max_send_wr = tx_slots;
+  qa.cap.max_recv_wr = ring;
+  qa.cap.max_send_sge = qa.cap.max_recv_sge = 1;
+  qa.cap.max_inline_data = 64;
+  ep->qp = ibv_create_qp(pd, &qa);
+  if (!ep->qp)
+    die("create_qp");
+  ep->max_inline = qa.cap.max_inline_data;
+  ud_qp_ready(ep->qp, port, RPC_QKEY);
+
+  size_t rx_len = (size_t)ring * (RPC_GRH + ep->mtu);
+  size_t len = rx_len + (size_t)tx_slots * ep->mtu;
+  if (posix_memalign((void **)&ep->rx, 4096, len))
+    die("alloc");
+  memset(ep->rx, 0, len);
+  ep->tx = ep->rx + rx_len;
+  ep->mr = ibv_reg_mr(pd, ep->rx, len, IBV_ACCESS_LOCAL_WRITE);
+  if (!ep->mr)
+    die("reg_mr");
+  for (uint32_t i = 0; i < ring; ++i)
+    rpc_post_recv_slot(ep, i);
+  rpc_flush(ep);
+}
+
+static inline void rpc_ep_destroy(struct RpcEp *ep) {
+  for (int i = 0; i < RPC_AH_CACHE; ++i)
+    if (ep->ahs[i].ah)
+      ibv_destroy_ah(ep->ahs[i].ah);
+  ibv_destroy_qp(ep->qp);
+  ibv_destroy_cq(ep->send_cq);
+  ibv_destroy_cq(ep->recv_cq);
+  ibv_dereg_mr(ep->mr);
+  free(ep->rx);
+}
+
+static inline void rpc_register(struct RpcEp *ep, uint8_t type, rpc_handler h,
+                                void *arg) {
+  ep->handlers[type] = h;
+  ep->handler_arg[type] = arg;
+}
+
+// Reclaim send slots. Only every RPC_SIGNAL_EVERY-th send is signaled; its
+// completion frees it and everything posted before it.
+static inline void rpc_reap_sends(struct RpcEp *ep) {
+  struct ibv_wc wc[8];
+  int n = ibv_poll_cq(ep->send_cq, 8, wc);
+  if (n < 0)
+    die("poll_cq");
+  for (int i = 0; i < n; ++i) {
+    if (wc[i].status) {
+      fprintf(stderr, "rpc send failed: %s\n",
+              ibv_wc_status_str(wc[i].status));
+      exit(1);
+    }
+    ep->tx_done = wc[i].wr_id + 1;
+  }
+}
+
+// Payload area of the next send slot, waiting for one to free up.
+static inline void *rpc_tx_reserve(struct RpcEp *ep) {
+  while (ep->tx_posted - ep->tx_done >= ep->tx_slots - RPC_SIGNAL_EVERY) {
+    rpc_flush(ep);
+    rpc_reap_sends(ep);
+  }
+  char *slot = ep->tx + (ep->tx_posted % ep->tx_slots) * ep->mtu;
+  return slot + sizeof(struct RpcHdr);
+}
+
+// Queue the reserved slot, holding `len` payload bytes, for `qpn` behind
+// `ah`. It goes out with the next doorbell.
+static inline void rpc_tx_commit(struct RpcEp *ep, struct ibv_ah *ah,
+                                 uint32_t qpn, uint8_t type, uint8_t flags,
+                                 uint32_t tag, size_t len) {
+  char *slot = ep->tx + (ep->tx_posted % ep->tx_slots) * ep->mtu;
+  struct RpcHdr h = {type, flags, (uint16_t)len, tag};
+  memcpy(slot, &h, sizeof(h));
+
+  struct ibv_sge *s = &ep->sge[ep->nwr];
+  struct ibv_send_wr *w = &ep->wr[ep->nwr];
+  s->addr = (uintptr_t)slot;
+  s->length = (uint32_t)(sizeof(h) + len);
+  s->lkey = ep->mr->lkey;
+  memset(w, 0, sizeof(*w));
+  w->wr_id = ep->tx_posted;
+  w->sg_list = s;
+  w->num_sge = 1;
+  w->opcode = IBV_WR_SEND;
+  if (s->length <= ep->max_inline)
+    w->send_flags |= IBV_SEND_INLINE;
+  if (ep->tx_posted % RPC_SIGNAL_EVERY == RPC_SIGNAL_EVERY - 1)
+    w->send_flags |= IBV_SEND_SIGNALED;
+  w->wr.ud.ah = ah;
+  w->wr.ud.remote_qpn = qpn;
+  w->wr.ud.remote_qkey = RPC_QKEY;
+  if (ep->nwr)
+    ep->wr[ep->nwr - 1].next = w;
+  ep->tx_posted++;
+  if (++ep->nwr == RPC_BATCH)
+    rpc_flush(ep);
+}
+
+// Address handle for the sender of `wc`, from the per-peer cache.
+static inline struct ibv_ah *rpc_peer_ah(struct RpcEp *ep, struct ibv_wc *wc,
+                                         struct ibv_grh *grh) {
+  uint8_t key[16] = {0};
+  if (wc->wc_flags & IBV_WC_GRH)
+    memcpy(key, &grh->sgid, sizeof(key));
+  else
+    memcpy(key, &wc->slid, sizeof(wc->slid));
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < 16; ++i)
+    h = (h ^ key[i]) * 16777619u;
+  for (int probe = 0; probe < RPC_AH_CACHE; ++probe) {
+    struct RpcAhEntry *e = &ep->ahs[(h + probe) & (RPC_AH_CACHE - 1)];
+    if (e->ah && !memcmp(e->key, key, sizeof(key)))
+      return e->ah;
+    if (!e->ah) {
+      e->ah = ibv_create_ah_from_wc(ep->pd, wc, grh, ep->port);
+      if (!e->ah)
+        die("create_ah_from_wc");
+      memcpy(e->key, key, sizeof(key));
+      ep->ahs_created++;
+      return e->ah;
+    }
+  }
+  fprintf(stderr, "rpc: more than %d peers, raise RPC_AH_CACHE\n",
+          RPC_AH_CACHE);
+  exit(1);
+}
+
+// Handle up to RPC_BATCH received messages: run handlers for requests and
+// queue their responses, hand responses to the continuation, repost the
+// receives, then ring one doorbell for everything. Returns the number of
+// messages handled.
+static inline int rpc_poll(struct RpcEp *ep) {
+  struct ibv_wc wc[RPC_BATCH];
+  int n = ibv_poll_cq(ep->recv_cq, RPC_BATCH, wc);
+  if (n < 0)
+    die("poll_cq");
+  for (int i = 0; i < n; ++i) {
+    if (wc[i].status) {
+      fprintf(stderr, "rpc recv failed: %s\n",
+              ibv_wc_status_str(wc[i].status));
+      exit(1);
+    }
+    char *buf = ep->rx + wc[i].wr_id * (RPC_GRH + ep->mtu);
+    struct RpcHdr h;
+    memcpy(&h, buf + RPC_GRH, sizeof(h));
+    char *payload = buf + RPC_GRH + sizeof(h);
+    size_t len = wc[i].byte_len - RPC_GRH - sizeof(h);
+    if (wc[i].byte_len < RPC_GRH + sizeof(h) || h.len > len) {
+      ep->unknown++;
+    } else if (h.flags & RPC_RESP) {
+      ep->responses++;
+      if (ep->cont)
+        ep->cont(ep->cont_arg, h.tag, payload, h.len);
+    } else if (!ep->handlers[h.type]) {
+      ep->unknown++;
+    } else {
+      ep->requests++;
+      struct ibv_ah *ah = rpc_peer_ah(ep, &wc[i], (struct ibv_grh *)buf);
+      void *resp = rpc_tx_reserve(ep);
+      size_t rlen = ep->handlers[h.type](ep->handler_arg[h.type], payload,
+                                         h.len, resp,
+                                         ep->mtu - sizeof(struct RpcHdr));
+      rpc_tx_commit(ep, ah, wc[i].src_qp, h.type, RPC_RESP, h.tag, rlen);
+    }
+    rpc_post_recv_slot(ep, (uint32_t)wc[i].wr_id);
+  }
+  rpc_flush(ep);
+  rpc_reap_sends(ep);
+  return n;
+}
+
+#endif